@@ -0,0 +1,129 @@
+#include <sys/time.h>
+#include <string.h>
+#include "circuit_breaker.h"
+#include "../log/log.h"
+
+circuit_breaker::circuit_breaker()
+    : m_rate(0), m_slow_ms(0), m_min_calls(0), m_open_ms(0), m_state(BREAKER_CLOSED), m_opened(0), m_probe(0), m_close_log(0)
+{
+    memset(m_buckets, 0, sizeof(m_buckets));
+}
+
+void circuit_breaker::init(const string &name, int rate, int slow_ms, int min_calls, int open_ms, int close_log)
+{
+    m_name = name;
+    m_rate = rate;
+    m_slow_ms = slow_ms;
+    m_min_calls = min_calls > 0 ? min_calls : 1;
+    m_open_ms = open_ms;
+    m_close_log = close_log;
+}
+
+void circuit_breaker::init(const string &name, const circuit_breaker &other)
+{
+    init(name, other.m_rate, other.m_slow_ms, other.m_min_calls, other.m_open_ms, other.m_close_log);
+}
+
+long long circuit_breaker::now_ms()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000LL + tv.tv_usec / 1000;
+}
+
+bool circuit_breaker::allow()
+{
+    if (BREAKER_CLOSED == m_state.load(memory_order_acquire))
+        return true;
+
+    long long now = now_ms();
+    bool allowed = false;
+    m_lock.lock();
+    int state = m_state.load(memory_order_relaxed);
+    if (BREAKER_OPEN == state && now - m_opened >= m_open_ms)
+    {
+        m_state.store(BREAKER_HALF_OPEN, memory_order_release);
+        m_probe = now;
+        allowed = true;
+    }
+    else if (BREAKER_HALF_OPEN == state && now - m_probe >= m_open_ms)
+    {
+        m_probe = now;
+        allowed = true;
+    }
+    m_lock.unlock();
+    return allowed;
+}
+
+int circuit_breaker::retry_after()
+{
+    m_lock.lock();
+    long long next = (BREAKER_OPEN == m_state.load(memory_order_relaxed) ? m_opened : m_probe) + m_open_ms;
+    m_lock.unlock();
+    long long left = next - now_ms();
+    return left > 1000 ? (int)((left + 999) / 1000) : 1;
+}
+
+// 断开后到达的结果是断开之前放行的调用，不再统计
+void circuit_breaker::record(bool ok, long long ms)
+{
+    if (0 == m_rate)
+        return;
+    bool failed = !ok || (m_slow_ms > 0 && ms >= m_slow_ms);
+    long long now = now_ms();
+
+    m_lock.lock();
+    int state = m_state.load(memory_order_relaxed);
+    if (BREAKER_HALF_OPEN == state)
+    {
+        if (failed)
+            open(now);
+        else
+            close();
+    }
+    else if (BREAKER_CLOSED == state)
+    {
+        long long sec = now / 1000;
+        bucket &b = m_buckets[sec % WINDOW];
+        if (b.sec != sec)
+        {
+            b.sec = sec;
+            b.calls = b.failures = 0;
+        }
+        ++b.calls;
+        if (failed)
+        {
+            ++b.failures;
+            int calls = 0, failures = 0;
+            for (int i = 0; i < WINDOW; ++i)
+            {
+                if (m_buckets[i].sec <= sec - WINDOW)
+                    continue;
+                calls += m_buckets[i].calls;
+                failures += m_buckets[i].failures;
+            }
+            if (calls >= m_min_calls && failures * 100 >= m_rate * calls)
+            {
+                LOG_ERROR("circuit breaker %s open: %d of %d calls failed in %ds", m_name.c_str(), failures, calls, WINDOW);
+                open(now);
+            }
+        }
+    }
+    m_lock.unlock();
+}
+
+void circuit_breaker::open(long long now)
+{
+    if (BREAKER_HALF_OPEN == m_state.load(memory_order_relaxed))
+        LOG_ERROR("circuit breaker %s probe failed, open again", m_name.c_str());
+    m_state.store(BREAKER_OPEN, memory_order_release);
+    m_opened = now;
+    memset(m_buckets, 0, sizeof(m_buckets));
+}
+
+void circuit_breaker::close()
+{
+    LOG_INFO("circuit breaker %s closed", m_name.c_str());
+    m_state.store(BREAKER_CLOSED, memory_order_release);
+    memset(m_buckets, 0, sizeof(m_buckets));
+}
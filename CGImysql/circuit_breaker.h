@@ -0,0 +1,67 @@
+#ifndef CIRCUIT_BREAKER_H
+#define CIRCUIT_BREAKER_H
+
+#include <string>
+#include <atomic>
+#include "../lock/locker.h"
+
+using namespace std;
+
+// 数据库调用的熔断器
+// 关闭：放行所有调用，按秒分桶统计最近 WINDOW 秒的调用数和失败数，连接错误、取连接超时和超过 m_slow_ms 的调用记为失败，
+//       调用数不少于 m_min_calls 且失败比例达到 m_rate% 时断开
+// 断开：拒绝所有调用，m_open_ms 毫秒后进入半开
+// 半开：只放行一个探测，成功则关闭，失败则重新断开；探测 m_open_ms 毫秒内没有结果时再放行一个
+// 关闭状态下 allow() 只读取一次原子变量，record() 在数据库往返之后调用，持有锁更新统计
+class circuit_breaker
+{
+public:
+    enum STATE
+    {
+        BREAKER_CLOSED = 0,
+        BREAKER_OPEN,
+        BREAKER_HALF_OPEN
+    };
+    static const int WINDOW = 10; // 统计窗口(秒)
+
+    circuit_breaker();
+
+    // rate 为0时不开启熔断，slow_ms 为0时不按耗时判断
+    void init(const string &name, int rate, int slow_ms, int min_calls, int open_ms, int close_log);
+    // 使用与 other 相同的参数
+    void init(const string &name, const circuit_breaker &other);
+
+    bool allow();                       // 是否放行一次调用，半开时只放行探测
+    void record(bool ok, long long ms); // 记录一次放行的调用的结果和耗时(毫秒)
+    bool closed() const { return BREAKER_CLOSED == m_state.load(memory_order_acquire); }
+    int retry_after(); // 距离下一次探测的秒数，至少为1，用于 Retry-After
+
+    static long long now_ms();
+
+private:
+    struct bucket
+    {
+        long long sec; // 所属的秒，不是当前窗口内的桶视为空
+        int calls;
+        int failures;
+    };
+
+    void open(long long now);  // 持有 m_lock 时调用：断开并清空统计
+    void close();              // 持有 m_lock 时调用：关闭并清空统计
+
+    string m_name;
+    int m_rate;
+    int m_slow_ms;
+    int m_min_calls;
+    int m_open_ms;
+
+    atomic<int> m_state;  // STATE
+    locker m_lock;        // 保护以下成员和状态转换
+    long long m_opened;   // 断开的时间(毫秒)
+    long long m_probe;    // 半开时最近一次放行探测的时间(毫秒)
+    bucket m_buckets[WINDOW];
+
+    int m_close_log;
+};
+
+#endif
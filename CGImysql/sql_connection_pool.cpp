@@ -4,28 +4,84 @@
 #include <string.h>
 #include <stdlib.h>
 #include <list>
+#include <vector>
 #include <pthread.h>
 #include <iostream>
+#include <sys/time.h>
+#include <mysql/errmsg.h>
 #include "sql_connection_pool.h"
 
 using namespace std;
 
 connection_pool::connection_pool()
 {
+	m_MaxConn = 0;
+	m_MinConn = 0;
 	m_CurConn = 0;
 	m_FreeConn = 0;
+	m_TotalConn = 0;
+	m_ReadyConn = 0;
+	m_Warming = m_Warmers = m_Warmed = 0;
+	m_Acquires = m_Waits = m_WaitMs = m_MaxWaitMs = m_Failures = 0;
+	m_PeakConn = 0;
+	m_Local = false;
+	m_Waiting = 0;
+	m_StmtGen = 0;
+	m_IsReplica = false;
+	m_Lag = 0;
+	m_MaxLag = 0;
+	m_NextReplica = 0;
+
+	static atomic<int> pools(0);
+	m_Id = pools++;
+	m_stop = false;
+	m_running = false;
 }
 
+// 本线程在各连接池中的暂存，以及最近一次 Stmts() 查找的连接池、连接和结果
+static __thread conn_stash *t_stash[connection_pool::MAX_LOCAL_POOLS];
+static __thread connection_pool *t_stmt_pool = NULL;
+static __thread MYSQL *t_stmt_conn = NULL;
+static __thread conn_stmts *t_stmts = NULL;
+static __thread unsigned t_stmt_gen = 0;
+
+// 开启线程暂存的连接池，按编号索引，DestroyPool() 时清除，线程退出时只处理仍存在的连接池
+// 线程退出时由 s_stash_key 的析构函数调用 thread_exit()，本线程创建第一个暂存时设置
+static connection_pool *s_local_pools[connection_pool::MAX_LOCAL_POOLS];
+static locker s_local_lock;
+static pthread_key_t s_stash_key;
+static pthread_once_t s_stash_once = PTHREAD_ONCE_INIT;
+
 connection_pool *connection_pool::GetInstance()
 {
 	static connection_pool connPool;
 	return &connPool;
 }
 
-// 1.初始化m_url、m_Port、m_User、m_PassWord、m_DatabaseName、m_close_log、m_MaxConn
-// 2.初始化 MaxConn 个 MySQL连接，添加到connList中
-// 3.初始化信号量，设置资源数为 MaxConn 个
-void connection_pool::init(string url, string User, string PassWord, string DBName, int Port, int MaxConn, int close_log)
+static long long now_ms()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000LL + tv.tv_usec / 1000;
+}
+
+// 绝对时间 ms 毫秒对应的 timespec，供 cond::timewait 使用
+static timespec abs_time(long long ms)
+{
+	timespec t;
+	t.tv_sec = ms / 1000;
+	t.tv_nsec = (ms % 1000) * 1000000;
+	return t;
+}
+
+// 1.初始化m_url、m_Port、m_User、m_PassWord、m_DatabaseName、m_close_log、连接数范围和各项超时
+// 2.并行打开 MinConn 个 MySQL连接，添加到connList中，有 ReadyConn 个可用后返回，其余由打开连接的线程在后台继续打开，
+//   部分失败的由维护线程补齐，ReadyConn 不为0而一个都打不开时退出
+// 3.启动维护线程
+// 建立连接的耗时主要是网络往返和认证，并行打开后启动时间约为一个连接的耗时，而不是 MinConn 倍
+void connection_pool::init(string url, string User, string PassWord, string DBName, int Port, int MaxConn, int close_log,
+						   int MinConn, int IdleTimeout, int PingInterval, int WaitTimeout, bool Local, int MaxLag,
+						   int ReadyConn)
 {
 	m_url = url;
 	m_Port = Port;
@@ -34,88 +90,559 @@ void connection_pool::init(string url, string User, string PassWord, string DBNa
 	m_DatabaseName = DBName;
 	m_close_log = close_log;
 
-	for (int i = 0; i < MaxConn; i++)
+	m_MaxConn = MaxConn > 0 ? MaxConn : 0;
+	m_MinConn = MinConn < m_MaxConn ? MinConn : m_MaxConn;
+	if (m_MinConn < 0)
+		m_MinConn = 0;
+	m_IdleTimeout = IdleTimeout;
+	m_PingInterval = PingInterval;
+	m_WaitTimeout = WaitTimeout;
+	m_Local = Local && m_Id < MAX_LOCAL_POOLS;
+	if (m_Local)
 	{
-		MYSQL *con = NULL;
-		con = mysql_init(con);
-
-		if (con == NULL)
-		{
-			LOG_ERROR("MySQL Error");
-			exit(1);
-		}
+		s_local_lock.lock();
+		s_local_pools[m_Id] = this;
+		s_local_lock.unlock();
+	}
+	m_MaxLag = MaxLag;
+	m_ReadyConn = ReadyConn < m_MinConn ? ReadyConn : m_MinConn;
+	if (m_ReadyConn < 0)
+		m_ReadyConn = 0;
 
-		con = mysql_real_connect(con, url.c_str(), User.c_str(), PassWord.c_str(), DBName.c_str(), Port, NULL, 0);
+	long long start = now_ms();
+	lock.lock();
+	m_TotalConn += m_MinConn;
+	Warm(m_MinConn);
+	while (m_Warmers > 0 && m_Warmed < m_ReadyConn)
+		m_warmed.wait(lock.get());
+	int ready = m_Warmed;
+	lock.unlock();
 
-		if (con == NULL)
-		{
-			LOG_ERROR("MySQL Error");
+	if (m_ReadyConn > 0 && 0 == ready)
+	{
+		LOG_ERROR("MySQL Error");
+		if (!m_IsReplica)
 			exit(1);
-		}
-		connList.push_back(con);
-		++m_FreeConn;
 	}
+	LOG_INFO("sql pool %s:%d%s: %d connections ready in %lldms, %d of min %d opening in background",
+			 m_url.c_str(), m_Port, m_IsReplica ? " (replica)" : "", ready, now_ms() - start,
+			 m_MinConn - ready > 0 ? m_MinConn - ready : 0, m_MinConn);
+	if (m_IsReplica)
+		CheckLag();
+
+	if (m_MaxConn > 0)
+	{
+		m_running = (pthread_create(&m_thread, NULL, worker, this) == 0);
+		if (!m_running)
+			LOG_ERROR("%s", "create sql pool thread error");
+	}
+}
 
-	reserve = sem(m_FreeConn);
+// 编译时定义 ASYNC_SQL 则开启连接的非阻塞模式，阻塞接口仍然可用
+// 连接超时 CONNECT_TIMEOUT 秒，读写超时 READ_TIMEOUT 秒，数据库所在主机不可达或停止响应时不会长时间阻塞
+MYSQL *connection_pool::Connect()
+{
+	MYSQL *con = mysql_init(NULL);
+	if (con == NULL)
+		return NULL;
+	unsigned int timeout = CONNECT_TIMEOUT;
+	mysql_options(con, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+	unsigned int rw_timeout = READ_TIMEOUT;
+	mysql_options(con, MYSQL_OPT_READ_TIMEOUT, &rw_timeout);
+	mysql_options(con, MYSQL_OPT_WRITE_TIMEOUT, &rw_timeout);
+#ifdef ASYNC_SQL
+	mysql_options(con, MYSQL_OPT_NONBLOCK, 0);
+#endif
 
-	m_MaxConn = m_FreeConn;
+	if (mysql_real_connect(con, m_url.c_str(), m_User.c_str(), m_PassWord.c_str(), m_DatabaseName.c_str(), m_Port, NULL, 0) == NULL)
+	{
+		LOG_ERROR("MySQL connect error:%s", mysql_error(con));
+		mysql_close(con);
+		return NULL;
+	}
+	return con;
 }
 
 // 当有请求时，从数据库连接池中返回一个可用连接，更新使用和空闲连接数
-// 如果无可用资源，则利用信号量等待
+// 熔断器断开时直接返回NULL，等待超时和建立连接失败计入熔断器的失败
+// 0.开启线程暂存时先取本线程暂存的连接，不加锁，也不计入统计
+// 1.有空闲连接时取最近归还的一个，较早归还的连接留给维护线程关闭
+// 2.没有空闲连接但连接数未满时，在调用者的线程中新建连接，不持有锁
+// 3.否则取走其它线程暂存的连接，都没有时等待归还，最多等待 m_WaitTimeout 毫秒，超时返回NULL
 MYSQL *connection_pool::GetConnection()
 {
 	MYSQL *con = NULL;
 
-	if (0 == connList.size())
+	if (0 == m_MaxConn || !m_breaker.allow())
 		return NULL;
 
-	reserve.wait();
+	if (m_Local && t_stash[m_Id] && (con = t_stash[m_Id]->conn.exchange(NULL, memory_order_acquire)))
+		return con;
+
+	long long start = now_ms();
+	bool open = false, waited = false, timeout = false, stolen = false;
 
 	lock.lock();
+	++m_Acquires;
+	while (true)
+	{
+		if (!connList.empty())
+		{
+			con = connList.back().conn;
+			connList.pop_back();
+			--m_FreeConn;
+			break;
+		}
+		if (m_TotalConn < m_MaxConn)
+		{
+			++m_TotalConn;
+			open = true;
+			break;
+		}
+		// 先登记等待再检查暂存，与 ReleaseConnection() 放入暂存后检查 m_Waiting 相对应，两边至少有一边看到对方
+		++m_Waiting;
+		if (m_Local && (con = Steal()))
+		{
+			--m_Waiting;
+			stolen = true;
+			break;
+		}
 
-	con = connList.front();
-	connList.pop_front();
+		waited = true;
+		if (m_WaitTimeout <= 0)
+			m_released.wait(lock.get());
+		else if (now_ms() - start >= m_WaitTimeout)
+			timeout = true;
+		else
+			m_released.timewait(lock.get(), abs_time(start + m_WaitTimeout));
+		--m_Waiting;
+		if (timeout)
+			break;
+	}
 
-	--m_FreeConn;
-	++m_CurConn;
+	if (waited)
+	{
+		long long ms = now_ms() - start;
+		++m_Waits;
+		m_WaitMs += ms;
+		if (ms > m_MaxWaitMs)
+			m_MaxWaitMs = ms;
+	}
+	// 暂存的连接已计入使用中
+	if (timeout)
+		++m_Failures;
+	else if (!stolen && ++m_CurConn > m_PeakConn)
+		m_PeakConn = m_CurConn;
 
 	lock.unlock();
+
+	if (timeout)
+	{
+		LOG_ERROR("wait for sql connection timeout (%dms)", m_WaitTimeout);
+		m_breaker.record(false, now_ms() - start);
+	}
+
+	if (open && NULL == (con = Connect()))
+	{
+		lock.lock();
+		--m_TotalConn;
+		--m_CurConn;
+		++m_Failures;
+		lock.unlock();
+		m_released.signal();
+		m_breaker.record(false, now_ms() - start);
+	}
 	return con;
 }
 
 // 释放当前使用的连接，更新使用和空闲连接数
+// 最后一次调用或执行预处理语句时出现连接错误(客户端错误码)，连接已不可用，直接关闭
 bool connection_pool::ReleaseConnection(MYSQL *con)
 {
 	if (NULL == con)
 		return false;
 
+	if (mysql_errno(con) >= CR_MIN_ERROR || Stmts(con).broken)
+	{
+		DiscardConnection(con);
+		return true;
+	}
+
+	// 本线程的暂存为空、没有线程在等待时留在本线程，仍计入使用中
+	// 放入后才有线程开始等待时取回，放回共享的空闲连接并唤醒，已被取走则不用再处理
+	if (m_Local && 0 == m_Waiting.load(memory_order_relaxed))
+	{
+		conn_stash *stash = Stash();
+		MYSQL *empty = NULL;
+		stash->last_used.store(time(NULL), memory_order_relaxed);
+		if (stash->conn.compare_exchange_strong(empty, con))
+		{
+			if (0 == m_Waiting.load() || !(con = stash->conn.exchange(NULL)))
+				return true;
+		}
+	}
+
+	time_t now = time(NULL);
+	idle_conn idle = {con, now, now};
+
 	lock.lock();
 
-	connList.push_back(con);
+	connList.push_back(idle);
 	++m_FreeConn;
 	--m_CurConn;
 
 	lock.unlock();
 
-	reserve.post();
+	m_released.signal();
 	return true;
 }
 
-// 关闭数据库池里所有的连接
+// 只有本线程修改 t_stash，创建时加入 m_stashes 供其它线程取走
+conn_stash *connection_pool::Stash()
+{
+	if (t_stash[m_Id])
+		return t_stash[m_Id];
+	conn_stash *stash = new conn_stash;
+	stash->conn.store(NULL, memory_order_relaxed);
+	stash->last_used.store(0, memory_order_relaxed);
+	lock.lock();
+	m_stashes.push_back(stash);
+	lock.unlock();
+	t_stash[m_Id] = stash;
+	pthread_once(&s_stash_once, create_key);
+	pthread_setspecific(s_stash_key, t_stash);
+	return stash;
+}
+
+// 弹性线程池的线程会不断创建和退出，退出线程的暂存不再使用，留在 m_stashes 中会使 Steal() 和 Reclaim() 越来越慢
+// 持有 s_local_lock 时调用，连接池不会同时被销毁
+void connection_pool::Drop(conn_stash *stash)
+{
+	lock.lock();
+	for (size_t i = 0; i < m_stashes.size(); ++i)
+	{
+		if (m_stashes[i] == stash)
+		{
+			m_stashes[i] = m_stashes.back();
+			m_stashes.pop_back();
+			break;
+		}
+	}
+	MYSQL *con = stash->conn.exchange(NULL, memory_order_acquire);
+	if (con)
+	{
+		time_t last_used = stash->last_used.load(memory_order_relaxed);
+		idle_conn idle = {con, last_used, last_used};
+		connList.push_back(idle);
+		++m_FreeConn;
+		--m_CurConn;
+	}
+	lock.unlock();
+
+	if (con)
+		m_released.signal();
+	delete stash;
+}
+
+void connection_pool::create_key()
+{
+	pthread_key_create(&s_stash_key, thread_exit);
+}
+
+// 在退出的线程中调用，t_stash 仍然有效
+// 已销毁的连接池在 DestroyPool() 中关闭了暂存的连接并释放了暂存，这里不再访问
+void connection_pool::thread_exit(void *arg)
+{
+	conn_stash **stashes = (conn_stash **)arg;
+	s_local_lock.lock();
+	for (int i = 0; i < MAX_LOCAL_POOLS; ++i)
+	{
+		if (stashes[i] && s_local_pools[i])
+			s_local_pools[i]->Drop(stashes[i]);
+		stashes[i] = NULL;
+	}
+	s_local_lock.unlock();
+}
+
+MYSQL *connection_pool::Steal()
+{
+	for (size_t i = 0; i < m_stashes.size(); ++i)
+	{
+		MYSQL *con = m_stashes[i]->conn.exchange(NULL);
+		if (con)
+			return con;
+	}
+	return NULL;
+}
+
+// 所属线程不再取连接时，暂存的连接也要参与空闲关闭和 ping 检查
+void connection_pool::Reclaim(time_t now)
+{
+	for (size_t i = 0; i < m_stashes.size(); ++i)
+	{
+		conn_stash *stash = m_stashes[i];
+		time_t last_used = stash->last_used.load(memory_order_relaxed);
+		if (now - last_used < m_PingInterval || !stash->conn.load(memory_order_relaxed))
+			continue;
+		MYSQL *con = stash->conn.exchange(NULL, memory_order_acquire);
+		if (!con)
+			continue;
+		idle_conn idle = {con, last_used, last_used};
+		connList.push_front(idle);
+		++m_FreeConn;
+		--m_CurConn;
+	}
+}
+
+// 连接处于查询中途或已断开等无法继续使用时，关闭连接，连接数减一
+// 之后取连接时按需新建
+void connection_pool::DiscardConnection(MYSQL *con)
+{
+	if (con)
+		Close(con);
+
+	lock.lock();
+
+	--m_TotalConn;
+	--m_CurConn;
+
+	lock.unlock();
+
+	m_released.signal();
+}
+
+void *connection_pool::worker(void *arg)
+{
+	connection_pool *pool = (connection_pool *)arg;
+	pool->run();
+	return pool;
+}
+
+// 维护线程，每秒检查一次，每 REPORT_INTERVAL 秒记录一次统计信息
+void connection_pool::run()
+{
+	time_t report = time(NULL) + REPORT_INTERVAL;
+
+	lock.lock();
+	while (!m_stop)
+	{
+		m_tick.timewait(lock.get(), abs_time(now_ms() + 1000));
+		if (m_stop)
+			break;
+		lock.unlock();
+
+		Maintain();
+		if (!m_breaker.closed())
+			Probe();
+		if (m_IsReplica)
+			CheckLag();
+		if (time(NULL) >= report)
+		{
+			Report();
+			report += REPORT_INTERVAL;
+		}
+
+		lock.lock();
+	}
+	lock.unlock();
+}
+
+// 1.从最早归还的空闲连接开始，连接数多于 m_MinConn 时关闭空闲超过 m_IdleTimeout 秒的连接
+// 2.取出超过 m_PingInterval 秒没有确认的空闲连接，不持有锁 ping，失败的关闭后重连
+// 3.连接数不足 m_MinConn 时补齐，失败时下一秒再试
+void connection_pool::Maintain()
+{
+	time_t now = time(NULL);
+	list<idle_conn> expired, check;
+
+	lock.lock();
+	if (m_Local)
+		Reclaim(now);
+	list<idle_conn>::iterator it = connList.begin();
+	while (it != connList.end())
+	{
+		list<idle_conn>::iterator cur = it++;
+		if (m_TotalConn - (int)expired.size() > m_MinConn && now - cur->last_used >= m_IdleTimeout)
+			expired.splice(expired.end(), connList, cur);
+		else if (now - cur->last_ping >= m_PingInterval)
+			check.splice(check.end(), connList, cur);
+	}
+	m_FreeConn -= expired.size() + check.size();
+	m_TotalConn -= expired.size();
+	lock.unlock();
+
+	for (it = expired.begin(); it != expired.end(); ++it)
+		Close(it->conn);
+
+	for (it = check.begin(); it != check.end(); ++it)
+	{
+		if (0 == mysql_ping(it->conn))
+		{
+			it->last_ping = now;
+			continue;
+		}
+		LOG_ERROR("MySQL ping error:%s, reconnect", mysql_error(it->conn));
+		Close(it->conn);
+		it->conn = Connect();
+		it->last_used = it->last_ping = time(NULL);
+	}
+
+	lock.lock();
+	// 检查过的连接按原来的顺序放回空闲连接的前部
+	it = check.begin();
+	while (it != check.end())
+	{
+		if (it->conn)
+		{
+			++m_FreeConn;
+			++it;
+		}
+		else
+		{
+			--m_TotalConn;
+			it = check.erase(it);
+		}
+	}
+	connList.splice(connList.begin(), check);
+	// 正在打开的连接已计入 m_TotalConn，上一秒没有打开完的不会重复打开
+	int missing = m_MinConn - m_TotalConn;
+	if (missing > 0)
+	{
+		m_TotalConn += missing;
+		Warm(missing);
+	}
+	lock.unlock();
+	m_released.broadcast();
+}
+
+// 每个线程打开连接直到 m_Warming 为0，线程数不超过 WARMUP_THREADS
+// 一个线程都没有启动时放弃这次打开，由维护线程下一秒重试；DestroyPool() 之后不再打开
+void connection_pool::Warm(int count)
+{
+	if (m_stop)
+	{
+		m_TotalConn -= count;
+		return;
+	}
+	m_Warming += count;
+	int threads = m_Warming < WARMUP_THREADS - m_Warmers ? m_Warming : WARMUP_THREADS - m_Warmers;
+	for (int i = 0; i < threads; ++i)
+	{
+		pthread_t tid;
+		if (pthread_create(&tid, NULL, warmer, this) != 0)
+		{
+			LOG_ERROR("%s", "create sql warm-up thread error");
+			break;
+		}
+		pthread_detach(tid);
+		++m_Warmers;
+	}
+	if (0 == m_Warmers)
+	{
+		m_TotalConn -= m_Warming;
+		m_Warming = 0;
+	}
+}
+
+void *connection_pool::warmer(void *arg)
+{
+	connection_pool *pool = (connection_pool *)arg;
+	pool->warm();
+	return pool;
+}
+
+// 打开的连接放入空闲连接并唤醒等待的请求，失败的从 m_TotalConn 中减去
+void connection_pool::warm()
+{
+	lock.lock();
+	while (m_Warming > 0)
+	{
+		--m_Warming;
+		lock.unlock();
+
+		MYSQL *con = Connect();
+
+		lock.lock();
+		if (con)
+		{
+			time_t now = time(NULL);
+			idle_conn idle = {con, now, now};
+			connList.push_back(idle);
+			++m_FreeConn;
+			++m_Warmed;
+		}
+		else
+			--m_TotalConn;
+		m_released.signal();
+		m_warmed.broadcast();
+	}
+	--m_Warmers;
+	m_warmed.broadcast();
+	lock.unlock();
+}
+
+// 记录连接数、使用率和等待时间，之后清零
+void connection_pool::Report()
+{
+	lock.lock();
+	int total = m_TotalConn, busy = m_CurConn, peak = m_PeakConn;
+	long long acquires = m_Acquires, waits = m_Waits, wait_ms = m_WaitMs, max_wait = m_MaxWaitMs, failures = m_Failures;
+	m_Acquires = m_Waits = m_WaitMs = m_MaxWaitMs = m_Failures = 0;
+	m_PeakConn = m_CurConn;
+	lock.unlock();
+
+	LOG_INFO("sql pool %s:%d%s: %d/%d connections in use, peak %d, max %d; %lld acquires, %lld waited (avg %lldms, max %lldms), %lld failed",
+			 m_url.c_str(), m_Port, m_IsReplica ? " (replica)" : "", busy, total, peak, m_MaxConn,
+			 acquires, waits, waits ? wait_ms / waits : 0LL, max_wait, failures);
+}
+
+// 停止维护线程和打开连接的线程，关闭数据库池里所有的空闲连接，销毁从库连接池
+// 打开连接的线程不再开始新的连接，等正在打开的连接完成
 void connection_pool::DestroyPool()
 {
+	s_local_lock.lock();
+	if (m_Id < MAX_LOCAL_POOLS && s_local_pools[m_Id] == this)
+		s_local_pools[m_Id] = NULL;
+	s_local_lock.unlock();
+
+	for (size_t i = 0; i < m_replicas.size(); ++i)
+		delete m_replicas[i];
+	m_replicas.clear();
 
 	lock.lock();
-	if (connList.size() > 0)
+	m_stop = true;
+	m_tick.signal();
+	m_TotalConn -= m_Warming;
+	m_Warming = 0;
+	while (m_Warmers > 0)
+		m_warmed.wait(lock.get());
+	lock.unlock();
+
+	if (m_running)
 	{
-		list<MYSQL *>::iterator it;
-		for (it = connList.begin(); it != connList.end(); ++it)
+		pthread_join(m_thread, NULL);
+		m_running = false;
+	}
+
+	lock.lock();
+	for (size_t i = 0; i < m_stashes.size(); ++i)
+	{
+		MYSQL *con = m_stashes[i]->conn.exchange(NULL);
+		if (con)
 		{
-			MYSQL *con = *it;
-			mysql_close(con);
+			Close(con);
+			--m_CurConn;
+			--m_TotalConn;
 		}
-		m_CurConn = 0;
+		delete m_stashes[i];
+	}
+	m_stashes.clear();
+	if (connList.size() > 0)
+	{
+		list<idle_conn>::iterator it;
+		for (it = connList.begin(); it != connList.end(); ++it)
+			Close(it->conn);
+		m_TotalConn -= m_FreeConn;
 		m_FreeConn = 0;
 		connList.clear();
 	}
@@ -123,6 +650,238 @@ void connection_pool::DestroyPool()
 	lock.unlock();
 }
 
+// map 的节点地址不变，取得引用后不持有锁，只有取得该连接的线程使用
+// 同一线程连续使用同一连接时直接返回上次的结果，其间有连接关闭时重新查找，避免关闭后地址被新连接复用
+conn_stmts &connection_pool::Stmts(MYSQL *con)
+{
+	unsigned gen = m_StmtGen.load(memory_order_acquire);
+	if (this == t_stmt_pool && con == t_stmt_conn && gen == t_stmt_gen)
+		return *t_stmts;
+
+	m_stmt_lock.lock();
+	map<MYSQL *, conn_stmts>::iterator it = m_stmts.find(con);
+	if (it == m_stmts.end())
+	{
+		it = m_stmts.insert(make_pair(con, conn_stmts())).first;
+		it->second.broken = false;
+	}
+	conn_stmts &stmts = it->second;
+	m_stmt_lock.unlock();
+	t_stmt_pool = this;
+	t_stmt_conn = con;
+	t_stmts = &stmts;
+	t_stmt_gen = gen;
+	return stmts;
+}
+
+void connection_pool::Close(MYSQL *con)
+{
+	m_stmt_lock.lock();
+	map<MYSQL *, conn_stmts>::iterator it = m_stmts.find(con);
+	if (it != m_stmts.end())
+	{
+		map<string, MYSQL_STMT *>::iterator s;
+		for (s = it->second.stmts.begin(); s != it->second.stmts.end(); ++s)
+			mysql_stmt_close(s->second);
+		m_stmts.erase(it);
+	}
+	m_StmtGen.fetch_add(1, memory_order_release);
+	m_stmt_lock.unlock();
+	mysql_close(con);
+}
+
+// 同一连接上相同的SQL只解析一次，之后每次只发送参数
+MYSQL_STMT *connection_pool::Prepare(MYSQL *con, const char *sql)
+{
+	conn_stmts &cache = Stmts(con);
+	map<string, MYSQL_STMT *>::iterator it = cache.stmts.find(sql);
+	if (it != cache.stmts.end())
+		return it->second;
+
+	MYSQL_STMT *stmt = mysql_stmt_init(con);
+	if (NULL == stmt)
+		return NULL;
+	if (mysql_stmt_prepare(stmt, sql, strlen(sql)) != 0)
+	{
+		LOG_ERROR("prepare %s error:%s", sql, mysql_stmt_error(stmt));
+		Failed(con, stmt);
+		mysql_stmt_close(stmt);
+		return NULL;
+	}
+	cache.stmts[sql] = stmt;
+	return stmt;
+}
+
+// 参数以字符串类型绑定，length 为NULL时长度取 buffer_length
+MYSQL_STMT *connection_pool::Bind(MYSQL *con, const char *sql, const char **params, int count)
+{
+	MYSQL_STMT *stmt = Prepare(con, sql);
+	if (NULL == stmt)
+		return NULL;
+
+	vector<MYSQL_BIND> bind(count);
+	memset(&bind[0], 0, sizeof(MYSQL_BIND) * count);
+	for (int i = 0; i < count; ++i)
+	{
+		bind[i].buffer_type = MYSQL_TYPE_STRING;
+		bind[i].buffer = (void *)params[i];
+		bind[i].buffer_length = strlen(params[i]);
+	}
+	if (mysql_stmt_bind_param(stmt, &bind[0]))
+	{
+		LOG_ERROR("bind %s error:%s", sql, mysql_stmt_error(stmt));
+		return NULL;
+	}
+	return stmt;
+}
+
+// 连接错误和超过熔断器耗时阈值的执行记为失败，数据库拒绝(如主键冲突)说明数据库正常，记为成功
+int connection_pool::Run(MYSQL *con, MYSQL_STMT *stmt)
+{
+	long long start = now_ms();
+	int err = 0;
+	if (mysql_stmt_execute(stmt) != 0)
+		err = Failed(con, stmt);
+	m_breaker.record(err < CR_MIN_ERROR, now_ms() - start);
+	return err;
+}
+
+int connection_pool::Execute(MYSQL *con, const char *sql, const char **params, int count)
+{
+	MYSQL_STMT *stmt = Bind(con, sql, params, count);
+	if (NULL == stmt)
+		return -1;
+	return Run(con, stmt);
+}
+
+// 结果集在客户端缓存后只取第一行，超出 size 的部分截断
+int connection_pool::Fetch(MYSQL *con, const char *sql, const char **params, int count, char *value, size_t size)
+{
+	MYSQL_STMT *stmt = Bind(con, sql, params, count);
+	if (NULL == stmt)
+		return -1;
+	if (Run(con, stmt) != 0)
+		return -1;
+
+	unsigned long length = 0;
+	MYSQL_BIND result;
+	memset(&result, 0, sizeof(result));
+	result.buffer_type = MYSQL_TYPE_STRING;
+	result.buffer = value;
+	result.buffer_length = size;
+	result.length = &length;
+	if (mysql_stmt_bind_result(stmt, &result) || mysql_stmt_store_result(stmt))
+	{
+		Failed(con, stmt);
+		mysql_stmt_free_result(stmt);
+		return -1;
+	}
+
+	int ret = mysql_stmt_fetch(stmt);
+	mysql_stmt_free_result(stmt);
+	if (MYSQL_NO_DATA == ret)
+		return 0;
+	if (0 != ret && MYSQL_DATA_TRUNCATED != ret)
+	{
+		Failed(con, stmt);
+		return -1;
+	}
+	value[length < size ? length : size - 1] = '\0';
+	return 1;
+}
+
+int connection_pool::Failed(MYSQL *con, MYSQL_STMT *stmt)
+{
+	int err = mysql_stmt_errno(stmt);
+	if (err >= CR_MIN_ERROR)
+		Stmts(con).broken = true;
+	return err ? err : -1;
+}
+
+void connection_pool::SetBreaker(int Rate, int SlowMs, int MinCalls, int OpenMs)
+{
+	char name[128];
+	snprintf(name, sizeof(name), "%s:%d", m_url.c_str(), m_Port);
+	m_breaker.init(name, Rate, SlowMs, MinCalls, OpenMs, m_close_log);
+}
+
+// 不经过连接池，断开期间连接池中的连接可能都已失效，探测结果只取决于数据库本身
+void connection_pool::Probe()
+{
+	if (!m_breaker.allow())
+		return;
+	long long start = now_ms();
+	MYSQL *con = Connect();
+	bool ok = con && 0 == mysql_ping(con);
+	if (con)
+		mysql_close(con);
+	m_breaker.record(ok, now_ms() - start);
+}
+
+// 从库连接池与主库使用相同的参数，各自有维护线程
+void connection_pool::AddReplica(string url, int Port)
+{
+	connection_pool *replica = new connection_pool;
+	replica->m_IsReplica = true;
+	char name[128];
+	snprintf(name, sizeof(name), "%s:%d", url.c_str(), Port);
+	replica->m_breaker.init(name, m_breaker);
+	replica->init(url, m_User, m_PassWord, m_DatabaseName, Port, m_MaxConn, m_close_log,
+				  m_MinConn, m_IdleTimeout, m_PingInterval, m_WaitTimeout, m_Local, m_MaxLag, m_ReadyConn);
+	m_replicas.push_back(replica);
+}
+
+connection_pool *connection_pool::ReadPool()
+{
+	size_t n = m_replicas.size();
+	if (0 == n)
+		return NULL;
+	unsigned start = m_NextReplica.fetch_add(1, memory_order_relaxed);
+	for (size_t i = 0; i < n; ++i)
+	{
+		connection_pool *replica = m_replicas[(start + i) % n];
+		int lag = replica->m_Lag.load(memory_order_relaxed);
+		if (lag >= 0 && lag <= m_MaxLag && replica->Available())
+			return replica;
+	}
+	return NULL;
+}
+
+// SHOW SLAVE STATUS 的 Seconds_Behind_Master(MySQL 8.0.22 起为 Seconds_Behind_Source)，复制中断时为NULL
+// 没有配置复制(结果为空)时视为没有延迟，连接或查询失败时记为-1，可用状态变化时记录日志
+void connection_pool::CheckLag()
+{
+	int lag = -1;
+	MYSQL *con = GetConnection();
+	if (con && 0 == mysql_query(con, "SHOW SLAVE STATUS"))
+	{
+		MYSQL_RES *result = mysql_store_result(con);
+		MYSQL_ROW row = result ? mysql_fetch_row(result) : NULL;
+		if (result && !row)
+			lag = 0;
+		if (row)
+		{
+			unsigned int num_fields = mysql_num_fields(result);
+			MYSQL_FIELD *fields = mysql_fetch_fields(result);
+			for (unsigned int i = 0; i < num_fields; ++i)
+			{
+				if (strcmp(fields[i].name, "Seconds_Behind_Master") && strcmp(fields[i].name, "Seconds_Behind_Source"))
+					continue;
+				lag = row[i] ? atoi(row[i]) : -1;
+				break;
+			}
+		}
+		if (result)
+			mysql_free_result(result);
+	}
+	ReleaseConnection(con);
+
+	int old = m_Lag.exchange(lag);
+	bool usable = lag >= 0 && lag <= m_MaxLag;
+	if (usable != (old >= 0 && old <= m_MaxLag))
+		LOG_INFO("replica %s:%d %s, lag %d", m_url.c_str(), m_Port, usable ? "usable" : "skipped", lag);
+}
+
 // 获取当前空闲的连接数
 int connection_pool::GetFreeConn()
 {
@@ -2,7 +2,11 @@
 #define _CONNECTION_POOL_
 
 #include <stdio.h>
+#include <time.h>
 #include <list>
+#include <map>
+#include <vector>
+#include <atomic>
 #include <mysql/mysql.h>
 #include <error.h>
 #include <string.h>
@@ -10,41 +14,179 @@
 #include <string>
 #include "../lock/locker.h"
 #include "../log/log.h"
+#include "circuit_breaker.h"
 
 using namespace std;
 
+// 空闲连接
+struct idle_conn
+{
+	MYSQL *conn;
+	time_t last_used; // 最后一次归还的时间
+	time_t last_ping; // 最后一次确认连接可用的时间
+};
+
+// 线程暂存的连接，只有所属线程放入，所属线程、等待连接的线程和维护线程都可能取走
+struct conn_stash
+{
+	atomic<MYSQL *> conn;
+	atomic<time_t> last_used; // 放入的时间
+};
+
+// 连接上缓存的预处理语句，按SQL文本查找
+// 只有取得该连接的线程访问，连接关闭时一并关闭
+struct conn_stmts
+{
+	map<string, MYSQL_STMT *> stmts;
+	bool broken; // 执行语句时出现连接错误，归还时关闭连接
+};
+
+// 弹性数据库连接池
+// 启动时用最多 WARMUP_THREADS 个线程并行打开 MinConn 个连接，有 ReadyConn 个可用后 init() 即返回，其余在后台继续打开
+// 连接不够用时按需新建，最多 MaxConn 个
+// 后台维护线程每秒检查一次：关闭空闲超过 m_IdleTimeout 秒的多余连接，ping 超过 m_PingInterval 秒没有确认的空闲连接，
+// ping 失败的连接关闭后重连，连接数不足 MinConn 时同样并行补齐，每 REPORT_INTERVAL 秒记录一次等待时间和使用率
+// 取连接最多等待 m_WaitTimeout 毫秒，超时返回NULL，数据库不可用时请求快速失败
+// 线程暂存模式下每个线程归还的连接先留在本线程，下次取连接时不经过锁，暂存的连接计入使用中，
+// 本线程的暂存为空、有线程在等待时才使用共享的空闲连接；连接不够时等待的线程取走其它线程暂存的连接，
+// 暂存超过 m_PingInterval 秒的连接由维护线程放回共享的空闲连接，线程退出时暂存的连接放回共享的空闲连接、暂存随之释放
+// 读写分离：单例为主库连接池，AddReplica() 为每个从库创建一个同样参数的连接池，
+// 从库的维护线程每秒查询一次复制延迟，只读查询通过 ReadPool() 轮询选择延迟不超过 m_MaxLag 秒的从库
+// 熔断：每个连接池一个熔断器，统计取连接和执行语句的失败率和耗时，断开期间取连接直接返回NULL，
+// 维护线程每秒用一个新连接 ping 探测，成功后恢复
 class connection_pool
 {
 public:
-	MYSQL *GetConnection();				 // 获取数据库连接
-	bool ReleaseConnection(MYSQL *conn); // 释放连接
-	int GetFreeConn();					 // 获取连接
-	void DestroyPool();					 // 销毁所有连接
+	static const int REPORT_INTERVAL = 60; // 记录统计信息的间隔(秒)
+	static const int CONNECT_TIMEOUT = 3;  // 建立连接的超时时间(秒)
+	static const int READ_TIMEOUT = 5;	   // 读写的超时时间(秒)，数据库停止响应时调用不会一直阻塞
+	static const int MAX_LOCAL_POOLS = 8;  // 可以开启线程暂存的连接池数，超出的连接池不暂存
+	static const int WARMUP_THREADS = 8;   // 并行打开连接的最多线程数
+
+	MYSQL *GetConnection();				 // 获取数据库连接，熔断、超时或无法建立连接时返回NULL
+	bool ReleaseConnection(MYSQL *conn); // 释放连接，最后一次调用出现连接错误时关闭连接
+	void DiscardConnection(MYSQL *conn); // 关闭不能再使用的连接
+	int GetFreeConn();					 // 获取空闲连接数
+
+	// 取连接上缓存的预处理语句，第一次使用时 mysql_stmt_prepare，失败返回NULL
+	MYSQL_STMT *Prepare(MYSQL *con, const char *sql);
+	// 取预处理语句并绑定 count 个字符串参数，参数在执行完之前必须保持有效
+	MYSQL_STMT *Bind(MYSQL *con, const char *sql, const char **params, int count);
+	// 以二进制协议执行预处理语句，成功返回0，失败返回错误码
+	int Execute(MYSQL *con, const char *sql, const char **params, int count);
+	// 执行只返回一个字符串列的查询，取第一行存入 value，有结果返回1，没有返回0，失败返回-1
+	int Fetch(MYSQL *con, const char *sql, const char **params, int count, char *value, size_t size);
+	// 语句执行失败后调用，连接错误时记录连接已断开，返回错误码
+	int Failed(MYSQL *con, MYSQL_STMT *stmt);
+	void DestroyPool();					 // 停止维护线程，销毁所有空闲连接和从库连接池
+
+	// 添加一个从库，使用与主库相同的用户、库名和连接池参数，只能在开始处理请求之前调用
+	// 从库暂时不可用时不退出，恢复后自动使用
+	void AddReplica(string url, int Port);
+	// 轮询选择一个复制延迟不超过 m_MaxLag 秒且没有熔断的从库，没有可用的从库时返回NULL，由调用者使用主库
+	connection_pool *ReadPool();
+
+	// 设置熔断参数，在 AddReplica() 之前调用，从库使用相同的参数
+	// 最近10秒调用数不少于 MinCalls 且失败比例达到 Rate% 时断开，OpenMs 毫秒后探测，Rate 为0时不熔断
+	void SetBreaker(int Rate, int SlowMs, int MinCalls, int OpenMs);
+	bool Available() { return m_breaker.closed(); } // 熔断器是否关闭
+	int RetryAfter() { return m_breaker.retry_after(); } // 熔断时建议客户端重试的秒数
+	// 记录一次不经过 Execute()/Fetch() 的调用结果，如非阻塞接口执行的语句
+	void Record(bool ok, long long ms) { m_breaker.record(ok, ms); }
 
 	// 获取数据库连接池的单例
 	static connection_pool *GetInstance();
 
-	// 1.初始化m_url、m_Port、m_User、m_PassWord、m_DatabaseName、m_close_log、m_MaxConn
-	// 2.初始化 MaxConn 个 MySQL连接，添加到connList中
-	// 3.初始化信号量，设置资源数为 MaxConn 个
-	void init(string url, string User, string PassWord, string DataBaseName, int Port, int MaxConn, int close_log);
+	// 1.初始化m_url、m_Port、m_User、m_PassWord、m_DatabaseName、m_close_log、连接数范围和各项超时
+	// 2.并行打开 MinConn 个 MySQL连接，添加到connList中，等到 ReadyConn 个可用或全部尝试完，一个都打不开时退出
+	// 3.启动维护线程
+	// MinConn 不超过 MaxConn，ReadyConn 不超过 MinConn，为0时不等待、数据库不可用时也不退出
+	// IdleTimeout、PingInterval 单位为秒，WaitTimeout 单位为毫秒，为0时一直等待
+	// Local 为true时开启线程暂存，MaxLag 为从库可以接受的复制延迟(秒)
+	void init(string url, string User, string PassWord, string DataBaseName, int Port, int MaxConn, int close_log,
+			  int MinConn = 1, int IdleTimeout = 60, int PingInterval = 30, int WaitTimeout = 3000, bool Local = false,
+			  int MaxLag = 5, int ReadyConn = 1);
 
 private:
 	// 设置当前已使用的连接数、当前空闲的连接数为0
 	connection_pool();
 	~connection_pool();
 
+	MYSQL *Connect();		  // 建立一个到数据库的连接，失败返回NULL
+	void Close(MYSQL *con);	  // 关闭连接上缓存的预处理语句和连接
+	conn_stmts &Stmts(MYSQL *con); // 连接的预处理语句缓存，不存在时创建
+
+	conn_stash *Stash();		// 本线程的暂存，第一次调用时创建
+	void Drop(conn_stash *stash); // 线程退出时调用：暂存的连接放回空闲连接，从 m_stashes 中移除并释放暂存
+	static void thread_exit(void *arg); // 线程退出时对本线程在各连接池中的暂存调用 Drop()
+	static void create_key();			// 创建线程退出时调用 thread_exit() 的 pthread_key_t，只调用一次
+	MYSQL *Steal();				// 持有 lock 时调用：取走任一线程暂存的连接，没有返回NULL
+	void Reclaim(time_t now);	// 持有 lock 时调用：把暂存过久的连接放回空闲连接
+	void CheckLag();			// 从库的维护线程调用：查询并记录复制延迟
+	void Probe();				// 维护线程调用：熔断器允许时用一个新连接探测数据库
+	int Run(MYSQL *con, MYSQL_STMT *stmt); // 执行语句并记录结果和耗时，成功返回0，失败返回错误码
+
+	// 持有 lock 时调用：再打开 count 个连接，count 已计入 m_TotalConn，必要时启动打开连接的线程
+	void Warm(int count);
+	static void *warmer(void *arg);
+	void warm(); // 打开连接的线程，m_Warming 为0时退出
+
+	static void *worker(void *arg);
+	void run();		 // 维护线程
+	void Maintain(); // 关闭多余的空闲连接，检查空闲连接，补齐 MinConn 个连接
+	void Report();	 // 记录并清零统计信息
+
 	int m_MaxConn;			// 最大连接数
+	int m_MinConn;			// 最少保持的连接数
 	int m_CurConn;			// 当前已使用的连接数
 	int m_FreeConn;			// 当前空闲的连接数
-	list<MYSQL *> connList; // 连接池
+	int m_TotalConn;		// 已打开和正在打开的连接数，包括正在检查的空闲连接
+	int m_ReadyConn;		// init() 返回前至少打开的连接数
+	int m_Warming;			// 等待打开线程打开的连接数
+	int m_Warmers;			// 正在运行的打开连接的线程数
+	int m_Warmed;			// 打开连接的线程成功打开的连接数
+	list<idle_conn> connList; // 空闲连接，最近归还的在末尾
+
+	int m_IdleTimeout;	// 多余连接的最长空闲时间(秒)
+	int m_PingInterval; // 空闲连接的检查间隔(秒)
+	int m_WaitTimeout;	// 取连接的最长等待时间(毫秒)
+
+	bool m_Local;				  // 是否开启线程暂存
+	vector<conn_stash *> m_stashes; // 各线程的暂存，持有 lock 时修改
+	atomic<int> m_Waiting;		  // 正在等待连接的线程数
+	int m_Id;					  // 连接池的编号，线程暂存按编号区分
+
+	bool m_IsReplica;					// 是否为从库连接池
+	atomic<int> m_Lag;					// 从库最近一次查询到的复制延迟(秒)，复制中断或查询失败时为-1
+	int m_MaxLag;						// 可以接受的复制延迟(秒)
+	vector<connection_pool *> m_replicas; // 主库连接池的各从库连接池，开始处理请求后不再修改
+	atomic<unsigned> m_NextReplica;		// 轮询的起点
+
+	circuit_breaker m_breaker;
+
+	// 统计信息，REPORT_INTERVAL 秒清零一次
+	long long m_Acquires;  // 取连接次数
+	long long m_Waits;	   // 需要等待的次数
+	long long m_WaitMs;	   // 等待的总时间(毫秒)
+	long long m_MaxWaitMs; // 最长的一次等待(毫秒)
+	long long m_Failures;  // 等待超时或建立连接失败的次数
+	int m_PeakConn;		   // 同时使用的最多连接数
+
+	locker lock;	 // 保护可修改的成员变量
+	cond m_released; // 有连接归还或连接数减少，唤醒等待的请求
+	cond m_tick;	 // 唤醒维护线程退出
+	cond m_warmed;	 // 打开了一个连接或打开连接的线程退出，唤醒 init() 和 DestroyPool()
 
-	sem reserve; // 信号量封装类
-	locker lock; // 保护可修改的成员变量
+	locker m_stmt_lock;				  // 保护 m_stmts 的结构
+	map<MYSQL *, conn_stmts> m_stmts; // 各连接的预处理语句缓存
+	atomic<unsigned> m_StmtGen;		  // 每关闭一个连接加一，线程缓存的 Stmts() 查找结果随之失效
+	bool m_stop;
+	bool m_running;
+	pthread_t m_thread;
 
 public:
 	string m_url;		   // 主机地址
-	string m_Port;		   // 数据库端口号
+	int m_Port;			   // 数据库端口号
 	string m_User;		   // 登陆数据库用户名
 	string m_PassWord;	   // 登陆数据库密码
 	string m_DatabaseName; // 使用数据库名
@@ -0,0 +1,121 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bundle.h"
+#include "../log/log.h"
+
+bundle *bundle::m_current = NULL;
+locker bundle::m_current_lock;
+
+bundle::~bundle()
+{
+    if (m_addr)
+        munmap(m_addr, m_size);
+    if (m_fd != -1)
+        close(m_fd);
+}
+
+// 打开、映射并校验资源包：文件头、索引和每个资源的范围都必须在文件内
+bool bundle::open(const string &path)
+{
+    m_fd = ::open(path.c_str(), O_RDONLY);
+    if (m_fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(m_fd, &st) < 0 || st.st_size < (off_t)sizeof(bundle_header))
+        return false;
+    m_size = st.st_size;
+
+    void *addr = mmap(0, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (addr == MAP_FAILED)
+        return false;
+    m_addr = (char *)addr;
+
+    const bundle_header *header = (const bundle_header *)m_addr;
+    if (memcmp(header->magic, BUNDLE_MAGIC, 8) != 0 || header->size != m_size ||
+        sizeof(bundle_header) + (uint64_t)header->count * sizeof(bundle_entry) > m_size)
+        return false;
+
+    m_count = header->count;
+    m_entries = (const bundle_entry *)(m_addr + sizeof(bundle_header));
+    for (uint32_t i = 0; i < m_count; ++i)
+    {
+        const bundle_entry &e = m_entries[i];
+        if (memchr(e.path, '\0', sizeof(e.path)) == NULL || memchr(e.mime, '\0', sizeof(e.mime)) == NULL ||
+            memchr(e.etag, '\0', sizeof(e.etag)) == NULL || e.offset + e.length > m_size ||
+            e.gz_offset + e.gz_length > m_size)
+            return false;
+    }
+    return true;
+}
+
+// 加载新的资源包，成功后替换当前资源包
+// 旧资源包仍可能被正在发送的连接使用，只释放当前资源包持有的引用
+bool bundle::reload(const string &path, int close_log)
+{
+    int m_close_log = close_log;
+    bundle *b = new bundle;
+    if (!b->open(path))
+    {
+        LOG_ERROR("load bundle %s error:%d", path.c_str(), errno);
+        delete b;
+        return false;
+    }
+
+    m_current_lock.lock();
+    bundle *old = m_current;
+    m_current = b;
+    m_current_lock.unlock();
+
+    if (old)
+        old->release();
+    LOG_INFO("load bundle %s, %u entries", path.c_str(), b->m_count);
+    return true;
+}
+
+// 获取当前资源包并增加引用计数
+bundle *bundle::acquire()
+{
+    m_current_lock.lock();
+    bundle *b = m_current;
+    if (b)
+    {
+        b->m_lock.lock();
+        ++b->m_refs;
+        b->m_lock.unlock();
+    }
+    m_current_lock.unlock();
+    return b;
+}
+
+// 减少引用计数，最后一个使用者释放后关闭资源包
+void bundle::release()
+{
+    m_lock.lock();
+    int refs = --m_refs;
+    m_lock.unlock();
+    if (0 == refs)
+        delete this;
+}
+
+// 索引按 path 升序排列，二分查找
+const bundle_entry *bundle::find(const char *path) const
+{
+    int lo = 0, hi = (int)m_count - 1;
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        int cmp = strcmp(path, m_entries[mid].path);
+        if (0 == cmp)
+            return &m_entries[mid];
+        if (cmp < 0)
+            hi = mid - 1;
+        else
+            lo = mid + 1;
+    }
+    return NULL;
+}
@@ -0,0 +1,71 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stdint.h>
+#include <string>
+#include "../lock/locker.h"
+
+using namespace std;
+
+// 资源包文件格式，由 pack 工具生成：
+// bundle_header | bundle_entry * count (按 path 升序) | 按页对齐的文件内容及其gzip版本
+#define BUNDLE_MAGIC "TWSBNDL1"
+
+static const int BUNDLE_PAGE = 4096;
+
+struct bundle_header
+{
+    char magic[8];     // BUNDLE_MAGIC
+    uint32_t count;    // 资源数量
+    uint32_t reserved;
+    uint64_t size;     // 资源包文件的总大小，用于检查文件是否完整
+};
+
+struct bundle_entry
+{
+    char path[192];     // 相对网站根目录的路径，以'/'开头
+    char mime[40];      // Content-Type
+    char etag[24];      // 带引号的ETag，由内容的哈希生成
+    uint64_t offset;    // 内容在资源包中的偏移，按页对齐
+    uint64_t length;    // 内容长度
+    uint64_t gz_offset; // gzip版本的偏移，没有为0
+    uint64_t gz_length; // gzip版本的长度，没有为0
+};
+
+// 只读的资源包
+// 启动时整体mmap，索引直接在映射区上二分查找，内容通过 fd() 用 sendfile 发送
+// 收到SIGHUP后 reload() 加载新的资源包替换当前资源包，旧资源包在最后一个使用者释放后关闭
+class bundle
+{
+public:
+    // 加载 path 为当前资源包，失败时保留原来的资源包并返回false
+    static bool reload(const string &path, int close_log);
+
+    // 获取当前资源包并增加引用计数，没有资源包返回NULL，用完后调用 release()
+    static bundle *acquire();
+    void release();
+
+    // 按路径查找资源，没有返回NULL
+    const bundle_entry *find(const char *path) const;
+
+    int fd() const { return m_fd; }
+
+private:
+    bundle() : m_fd(-1), m_addr(NULL), m_size(0), m_entries(NULL), m_count(0), m_refs(1) {}
+    ~bundle();
+
+    bool open(const string &path); // 打开、映射并校验资源包
+
+    int m_fd;
+    char *m_addr;             // 整个资源包的映射区
+    size_t m_size;
+    const bundle_entry *m_entries;
+    uint32_t m_count;
+    int m_refs;               // 引用计数，当前资源包本身持有一个
+    locker m_lock;            // 保护 m_refs
+
+    static bundle *m_current; // 当前资源包
+    static locker m_current_lock;
+};
+
+#endif
@@ -0,0 +1,238 @@
+// 把网站根目录打包为一个资源包文件
+// 用法：./pack root root.bundle
+// 先写入同目录下的临时文件再rename，替换资源包是原子的，之后向服务器发送SIGHUP即可加载
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#ifdef BUNDLE_GZIP
+#include <zlib.h>
+#endif
+#include "bundle.h"
+
+struct pack_file
+{
+    string path;    // 相对根目录的路径
+    string content;
+    string gz;      // gzip版本，不压缩或压缩效果不好时为空
+    bundle_entry entry;
+};
+
+static bool by_path(const pack_file &a, const pack_file &b)
+{
+    return strcmp(a.entry.path, b.entry.path) < 0;
+}
+
+// 按扩展名确定 Content-Type
+static const char *mime_type(const string &path)
+{
+    static const char *types[][2] = {
+        {".html", "text/html"}, {".htm", "text/html"}, {".css", "text/css"},
+        {".js", "application/javascript"}, {".json", "application/json"}, {".txt", "text/plain"},
+        {".xml", "text/xml"}, {".svg", "image/svg+xml"}, {".jpg", "image/jpeg"},
+        {".jpeg", "image/jpeg"}, {".png", "image/png"}, {".gif", "image/gif"},
+        {".ico", "image/x-icon"}, {".mp4", "video/mp4"}, {".pdf", "application/pdf"}};
+    size_t dot = path.rfind('.');
+    if (dot != string::npos)
+    {
+        string ext = path.substr(dot);
+        for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i)
+            if (strcasecmp(ext.c_str(), types[i][0]) == 0)
+                return types[i][1];
+    }
+    return "application/octet-stream";
+}
+
+// 只压缩文本类资源，图片、视频本身已经压缩过
+static bool compressible(const char *mime)
+{
+    return strncmp(mime, "text/", 5) == 0 || strcmp(mime, "application/javascript") == 0 ||
+           strcmp(mime, "application/json") == 0 || strcmp(mime, "image/svg+xml") == 0;
+}
+
+static bool gzip(const string &in, string &out)
+{
+#ifdef BUNDLE_GZIP
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // 15 + 16: 生成gzip格式而不是zlib格式
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    out.resize(deflateBound(&zs, in.size()) + 32);
+    zs.next_in = (Bytef *)in.data();
+    zs.avail_in = in.size();
+    zs.next_out = (Bytef *)&out[0];
+    zs.avail_out = out.size();
+    int ret = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END;
+#else
+    (void)in;
+    (void)out;
+    return false;
+#endif
+}
+
+// FNV-1a 64位哈希，用于生成ETag
+static uint64_t fnv1a(const string &data)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static bool read_file(const string &path, string &content)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return false;
+    char buf[65536];
+    size_t n;
+    content.clear();
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        content.append(buf, n);
+    bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+// 递归收集目录下的普通文件
+static void walk(const string &root, const string &rel, vector<pack_file> &files)
+{
+    string dir = root + rel;
+    DIR *dp = opendir(dir.c_str());
+    if (!dp)
+    {
+        fprintf(stderr, "opendir %s failed\n", dir.c_str());
+        return;
+    }
+    dirent *entry;
+    while ((entry = readdir(dp)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+        string path = rel + "/" + entry->d_name;
+        struct stat st;
+        if (stat((root + path).c_str(), &st) < 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+        {
+            walk(root, path, files);
+            continue;
+        }
+        if (!S_ISREG(st.st_mode) || !(st.st_mode & S_IROTH))
+            continue;
+        if (path.size() >= sizeof(((bundle_entry *)0)->path))
+        {
+            fprintf(stderr, "skip %s: path too long\n", path.c_str());
+            continue;
+        }
+
+        pack_file f;
+        f.path = path;
+        if (!read_file(root + path, f.content))
+        {
+            fprintf(stderr, "read %s failed\n", path.c_str());
+            continue;
+        }
+        files.push_back(f);
+    }
+    closedir(dp);
+}
+
+static uint64_t align_page(uint64_t off)
+{
+    return (off + BUNDLE_PAGE - 1) / BUNDLE_PAGE * BUNDLE_PAGE;
+}
+
+static bool write_at(FILE *fp, uint64_t off, const string &data)
+{
+    return fseeko(fp, off, SEEK_SET) == 0 && fwrite(data.data(), 1, data.size(), fp) == data.size();
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s root_dir bundle_file\n", argv[0]);
+        return 1;
+    }
+    string root = argv[1];
+    string out = argv[2];
+
+    vector<pack_file> files;
+    walk(root, "", files);
+
+    // 生成索引，内容从索引之后的第一页开始按页对齐
+    uint64_t off = align_page(sizeof(bundle_header) + files.size() * sizeof(bundle_entry));
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        pack_file &f = files[i];
+        bundle_entry &e = f.entry;
+        memset(&e, 0, sizeof(e));
+        strcpy(e.path, f.path.c_str());
+        strcpy(e.mime, mime_type(f.path));
+        snprintf(e.etag, sizeof(e.etag), "\"%016llx\"", (unsigned long long)fnv1a(f.content));
+
+        e.offset = off;
+        e.length = f.content.size();
+        off = align_page(off + e.length);
+
+        // 压缩后至少小10%才保留gzip版本
+        if (compressible(e.mime) && gzip(f.content, f.gz) && f.gz.size() * 10 < f.content.size() * 9)
+        {
+            e.gz_offset = off;
+            e.gz_length = f.gz.size();
+            off = align_page(off + e.gz_length);
+        }
+        else
+            f.gz.clear();
+    }
+    sort(files.begin(), files.end(), by_path);
+
+    bundle_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BUNDLE_MAGIC, 8);
+    header.count = files.size();
+    header.size = off;
+
+    string tmp = out + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (!fp)
+    {
+        fprintf(stderr, "open %s failed\n", tmp.c_str());
+        return 1;
+    }
+    string index((const char *)&header, sizeof(header));
+    for (size_t i = 0; i < files.size(); ++i)
+        index.append((const char *)&files[i].entry, sizeof(bundle_entry));
+    bool ok = write_at(fp, 0, index);
+    for (size_t i = 0; ok && i < files.size(); ++i)
+    {
+        ok = write_at(fp, files[i].entry.offset, files[i].content);
+        if (ok && !files[i].gz.empty())
+            ok = write_at(fp, files[i].entry.gz_offset, files[i].gz);
+    }
+    // 最后一个资源之后补齐到页边界，文件大小与 header.size 一致
+    ok = ok && fflush(fp) == 0 && ftruncate(fileno(fp), off) == 0;
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), out.c_str()) < 0)
+    {
+        fprintf(stderr, "write %s failed\n", out.c_str());
+        unlink(tmp.c_str());
+        return 1;
+    }
+
+    printf("packed %zu files into %s (%llu bytes)\n", files.size(), out.c_str(), (unsigned long long)off);
+    return 0;
+}
@@ -30,11 +30,53 @@ Config::Config(){
 
     //并发模型,默认是proactor
     actor_model = 0;
+
+    //上传文件大小上限,默认为0,不开启上传
+    upload_max = 0;
+
+    //反向代理路由,默认为空,不开启代理
+    proxy_pass = "";
+
+    //上游负载均衡策略,默认轮询
+    proxy_balance = 0;
+
+    //FastCGI路由,默认为空,不开启FastCGI
+    fastcgi_pass = "";
+
+    //处理函数插件目录,默认为空,只使用静态注册的处理函数
+    handler_dir = "";
+
+    //资源包路径,默认为空,直接从root目录读取文件
+    bundle_path = "";
+
+    //各阶段的超时时间,默认为空,均为15秒,最低速率1024字节每秒
+    timeouts = "";
+
+    //注册的批量写入,默认为空,每个注册单独写数据库
+    reg_batch = "";
+
+    //数据库连接池的弹性参数,默认为空,最少1个连接,空闲60秒关闭,30秒检查一次,最多等待3秒,不开启线程暂存,从库最多延迟5秒,失败50%时熔断,1个连接可用后开始监听
+    sql_limits = "";
+
+    //用户缓存,默认为空,最多缓存100000个用户名,存在的缓存300秒,不存在的缓存30秒,不预热
+    user_cache = "";
+
+    //从库,默认为空,所有查询都使用主库
+    sql_replicas = "";
+
+    //登录会话,默认为空,空闲1800秒过期,最多100000个会话
+    sessions = "";
+
+    //用户数据后端,默认为mysql
+    backend = "mysql";
+
+    //线程池的弹性参数,默认为空,固定为 -t 个线程
+    workers = "";
 }
 
 void Config::parse_arg(int argc, char*argv[]){
     int opt;
-    const char *str = "p:l:m:o:s:t:c:a:";
+    const char *str = "p:l:m:o:s:t:c:a:u:x:b:f:d:r:e:g:n:k:y:i:j:w:";
     // getopt用于 解析命令行传入参数
     while ((opt = getopt(argc, argv, str)) != -1)
     {
@@ -80,6 +122,76 @@ void Config::parse_arg(int argc, char*argv[]){
             actor_model = atoi(optarg);
             break;
         }
+        case 'u':
+        {
+            upload_max = atoi(optarg);
+            break;
+        }
+        case 'x':
+        {
+            proxy_pass = optarg;
+            break;
+        }
+        case 'b':
+        {
+            proxy_balance = atoi(optarg);
+            break;
+        }
+        case 'f':
+        {
+            fastcgi_pass = optarg;
+            break;
+        }
+        case 'd':
+        {
+            handler_dir = optarg;
+            break;
+        }
+        case 'r':
+        {
+            bundle_path = optarg;
+            break;
+        }
+        case 'e':
+        {
+            timeouts = optarg;
+            break;
+        }
+        case 'g':
+        {
+            reg_batch = optarg;
+            break;
+        }
+        case 'n':
+        {
+            sql_limits = optarg;
+            break;
+        }
+        case 'k':
+        {
+            user_cache = optarg;
+            break;
+        }
+        case 'y':
+        {
+            sql_replicas = optarg;
+            break;
+        }
+        case 'i':
+        {
+            sessions = optarg;
+            break;
+        }
+        case 'j':
+        {
+            backend = optarg;
+            break;
+        }
+        case 'w':
+        {
+            workers = optarg;
+            break;
+        }
         default:
             break;
         }
@@ -42,6 +42,48 @@ public:
 
     //并发模型选择
     int actor_model;
+
+    //上传文件大小上限(MB)，为0时关闭上传路由
+    int upload_max;
+
+    //反向代理路由，格式为 前缀=host:port,host:port;前缀=...
+    string proxy_pass;
+
+    //上游负载均衡策略
+    int proxy_balance;
+
+    //FastCGI路由，格式为 前缀=unix:路径,host:port;前缀=...
+    string fastcgi_pass;
+
+    //处理函数插件目录
+    string handler_dir;
+
+    //资源包路径
+    string bundle_path;
+
+    //各阶段的超时时间，格式为 head=秒,body=秒,send=秒,idle=秒,rate=字节每秒
+    string timeouts;
+
+    //注册的批量写入，格式为 rows=行数,wait=毫秒,behind=0或1
+    string reg_batch;
+
+    //数据库连接池的弹性参数，格式为 min=连接数,idle=秒,ping=秒,wait=毫秒,local=0或1,lag=秒,fail=百分比,slow=毫秒,calls=次数,open=毫秒,ready=连接数
+    string sql_limits;
+
+    //用户缓存，格式为 size=用户数,ttl=秒,neg=秒,warm=用户数
+    string user_cache;
+
+    //从库，格式为 host:port,host:port
+    string sql_replicas;
+
+    //登录会话，格式为 ttl=秒,size=会话数
+    string sessions;
+
+    //用户数据后端，mysql、memory 或 sqlite:路径
+    string backend;
+
+    //线程池的弹性参数，格式为 min=线程数,max=线程数,wait=毫秒,idle=秒
+    string workers;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../handler.h"
+
+// 回显请求方法、路径、查询串、User-Agent 和请求体
+class hello_handler : public http_handler
+{
+public:
+    void handle(request_view &req, response_writer &res)
+    {
+        const char *agent = req.header("User-Agent");
+        res.add_header("Content-Type", "text/plain");
+        res.write(string("hello ") + req.method() + " " + req.path() + "\n");
+        res.write(string("query: ") + req.query() + "\n");
+        res.write(string("user-agent: ") + (agent ? agent : "") + "\n");
+
+        char buf[256];
+        int len;
+        while ((len = req.read(buf, sizeof(buf))) > 0)
+            res.write(buf, len);
+    }
+};
+
+// 分块输出：/stream/?n=行数，每行发送一块
+class stream_handler : public http_handler
+{
+public:
+    void handle(request_view &req, response_writer &res)
+    {
+        int n = 10;
+        if (strncmp(req.query(), "n=", 2) == 0)
+            n = atoi(req.query() + 2);
+
+        res.add_header("Content-Type", "text/plain");
+        char line[64];
+        for (int i = 0; i < n; ++i)
+        {
+            int len = snprintf(line, sizeof(line), "line %d\n", i);
+            if (!res.write(line, len) || !res.flush())
+                return;
+        }
+    }
+};
+
+extern "C" void register_handlers(handler_registry *registry)
+{
+    registry->add("/hello/", new hello_handler);
+    registry->add("/stream/", new stream_handler);
+}
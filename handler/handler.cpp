@@ -0,0 +1,217 @@
+#include <dirent.h>
+#include <dlfcn.h>
+#include <stdio.h>
+#include <strings.h>
+#include "handler.h"
+#include "../log/log.h"
+
+request_view::request_view(const char *method, const char *url, const char *headers,
+                           const char *body, long body_len, const sockaddr_in &addr)
+{
+    const char *query = strchr(url, '?');
+    m_method = method;
+    m_path = query ? string(url, query - url) : string(url);
+    m_query = query ? query + 1 : "";
+    m_headers = headers;
+    m_body = body;
+    m_body_len = body ? body_len : 0;
+    m_body_read = 0;
+    m_addr = addr;
+}
+
+// 按名字查找首部（不区分大小写）
+const char *request_view::header(const char *name) const
+{
+    size_t name_len = strlen(name);
+    for (const char *line = m_headers; *line != '\0'; line += strlen(line) + 2)
+    {
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':')
+        {
+            const char *value = line + name_len + 1;
+            return value + strspn(value, " \t");
+        }
+    }
+    return NULL;
+}
+
+// 逐个访问首部行
+bool request_view::header_at(int index, string &name, string &value) const
+{
+    for (const char *line = m_headers; *line != '\0'; line += strlen(line) + 2)
+    {
+        const char *colon = strchr(line, ':');
+        if (!colon || index-- > 0)
+            continue;
+        name.assign(line, colon - line);
+        value = colon + 1 + strspn(colon + 1, " \t");
+        return true;
+    }
+    return false;
+}
+
+// 顺序读取请求体，返回读到的字节数，读完返回0
+int request_view::read(char *buf, int len)
+{
+    long left = m_body_len - m_body_read;
+    if (len > left)
+        len = left;
+    memcpy(buf, m_body + m_body_read, len);
+    m_body_read += len;
+    return len;
+}
+
+response_writer::response_writer(int sockfd, bool keep_alive)
+{
+    m_sockfd = sockfd;
+    m_keep_alive = keep_alive;
+    m_status = 200;
+    m_title = "OK";
+    m_chunked = false;
+    m_failed = false;
+}
+
+void response_writer::set_status(int status, const char *title)
+{
+    m_status = status;
+    m_title = title;
+}
+
+void response_writer::add_header(const char *name, const char *value)
+{
+    m_headers.append(name).append(":").append(value).append("\r\n");
+}
+
+// 追加响应体，累积超过 CHUNK_SIZE 时作为一块发送
+bool response_writer::write(const char *data, size_t len)
+{
+    if (m_failed)
+        return false;
+    m_body.append(data, len);
+    if (m_body.size() >= (size_t)CHUNK_SIZE)
+        return flush();
+    return true;
+}
+
+// 首次发送时先写入状态行和首部，之后的数据都以分块传输
+bool response_writer::flush()
+{
+    if (m_failed)
+        return false;
+    if (!m_chunked)
+    {
+        append_head("Transfer-Encoding:chunked\r\n");
+        m_chunked = true;
+    }
+    append_chunk();
+    return send_out();
+}
+
+// 生成剩余待发送的数据
+// 未分块时整体以 Content-Length 发送，否则补上最后一块和结束块
+void response_writer::finish()
+{
+    if (m_failed)
+        return;
+    if (!m_chunked)
+    {
+        char framing[64];
+        snprintf(framing, sizeof(framing), "Content-Length:%zu\r\n", m_body.size());
+        append_head(framing);
+        m_out.append(m_body);
+    }
+    else
+    {
+        append_chunk();
+        m_out.append("0\r\n\r\n");
+    }
+    string().swap(m_body);
+}
+
+void response_writer::append_head(const char *framing)
+{
+    char line[64];
+    snprintf(line, sizeof(line), "HTTP/1.1 %d ", m_status);
+    m_out.append(line).append(m_title).append("\r\n");
+    m_out.append(m_headers);
+    m_out.append(framing);
+    m_out.append(m_keep_alive ? "Connection:keep-alive\r\n\r\n" : "Connection:close\r\n\r\n");
+}
+
+void response_writer::append_chunk()
+{
+    if (m_body.empty())
+        return;
+    char size[32];
+    snprintf(size, sizeof(size), "%zx\r\n", m_body.size());
+    m_out.append(size).append(m_body).append("\r\n");
+    m_body.clear();
+}
+
+// 不阻塞地发送 m_out，客户端连接是非阻塞的
+// 发送缓冲区满时不等待客户端，工作线程继续执行处理函数，剩余数据排在后面的块之前，由 http_conn 在可写时发送
+bool response_writer::send_out()
+{
+    size_t sent = 0;
+    while (sent < m_out.size())
+    {
+        int ret = send(m_sockfd, m_out.data() + sent, m_out.size() - sent, MSG_NOSIGNAL);
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (ret <= 0)
+        {
+            m_failed = true;
+            return false;
+        }
+        sent += ret;
+    }
+    m_out.erase(0, sent);
+    return true;
+}
+
+// 注册处理函数
+void handler_registry::add(const string &prefix, http_handler *handler)
+{
+    m_handlers.push_back(make_pair(prefix, handler));
+}
+
+// 加载 dir 下所有的 .so 插件，调用插件导出的 register_handlers
+// 插件一旦加载就不再卸载，其注册的处理函数在整个进程中有效
+int handler_registry::load_dir(const string &dir, int close_log)
+{
+    int m_close_log = close_log;
+    DIR *dp = opendir(dir.c_str());
+    if (!dp)
+    {
+        LOG_ERROR("open handler dir %s error:%d", dir.c_str(), errno);
+        return 0;
+    }
+
+    int loaded = 0;
+    dirent *entry;
+    while ((entry = readdir(dp)) != NULL)
+    {
+        size_t len = strlen(entry->d_name);
+        if (len < 4 || strcmp(entry->d_name + len - 3, ".so") != 0)
+            continue;
+
+        string path = dir + "/" + entry->d_name;
+        void *lib = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (!lib)
+        {
+            LOG_ERROR("dlopen %s error:%s", path.c_str(), dlerror());
+            continue;
+        }
+        register_handlers_fn fn = (register_handlers_fn)dlsym(lib, "register_handlers");
+        if (!fn)
+        {
+            LOG_ERROR("%s has no register_handlers", path.c_str());
+            dlclose(lib);
+            continue;
+        }
+        fn(this);
+        ++loaded;
+        LOG_INFO("load handler plugin %s", path.c_str());
+    }
+    closedir(dp);
+    return loaded;
+}
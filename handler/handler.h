@@ -0,0 +1,148 @@
+#ifndef HANDLER_H
+#define HANDLER_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// 请求视图，指向 http_conn 接收缓冲区中已解析的请求，只在 handle() 调用期间有效
+class request_view
+{
+public:
+    request_view(const char *method, const char *url, const char *headers,
+                 const char *body, long body_len, const sockaddr_in &addr);
+
+    const char *method() const { return m_method; }
+    const string &path() const { return m_path; }   // URL中'?'之前的部分
+    const char *query() const { return m_query; }   // URL中'?'之后的部分，没有为空串
+    const sockaddr_in &remote() const { return m_addr; }
+
+    // 按名字查找首部（不区分大小写），返回去掉前导空白的值，没有返回NULL
+    const char *header(const char *name) const;
+
+    // 逐个访问首部行：index 从0开始，越界返回false
+    bool header_at(int index, string &name, string &value) const;
+
+    // 请求体：body()/body_length() 直接访问全部数据，read() 按流的方式顺序读取
+    const char *body() const { return m_body; }
+    long body_length() const { return m_body_len; }
+    int read(char *buf, int len);
+
+private:
+    const char *m_method;
+    string m_path;
+    const char *m_query;
+    const char *m_headers; // 首部行以两个'\0'分隔，空行结束
+    const char *m_body;
+    long m_body_len;
+    long m_body_read;      // read() 已读取的字节数
+    sockaddr_in m_addr;
+};
+
+// 响应写入器
+// 处理函数返回前未调用 flush() 时，响应整体以 Content-Length 发送
+// 调用 flush() 或累积的响应体超过 CHUNK_SIZE 后改为分块传输，已有数据不阻塞地发送给客户端，
+// 客户端发送缓冲区满时不等待，未发出的数据留在 m_out 中
+// 剩余数据和结束块在处理函数返回后由 http_conn 的写流程注册写事件发送
+class response_writer
+{
+public:
+    static const int CHUNK_SIZE = 16384;   // 累积到此大小自动发送一块
+
+    response_writer(int sockfd, bool keep_alive);
+
+    // 设置状态码和短语，须在首次发送之前调用
+    void set_status(int status, const char *title);
+    // 添加响应首部，须在首次发送之前调用，Content-Length、Transfer-Encoding、Connection 由写入器生成
+    void add_header(const char *name, const char *value);
+
+    // 追加响应体，发送失败返回false
+    bool write(const char *data, size_t len);
+    bool write(const string &data) { return write(data.data(), data.size()); }
+
+    // 把已累积的响应体作为一块尽量发送，发不完的留待处理函数返回后发送，连接出错返回false
+    bool flush();
+
+    bool failed() const { return m_failed; }
+
+    // 以下由 http_conn 调用
+    void finish();                                    // 生成剩余待发送的数据
+    const char *pending() const { return m_out.data(); }
+    size_t pending_size() const { return m_out.size(); }
+
+private:
+    void append_head(const char *framing);            // 状态行、首部和分帧首部写入 m_out
+    void append_chunk();                              // m_body 作为一块写入 m_out
+    bool send_out();                                  // 不阻塞地发送 m_out，发送缓冲区满时返回true
+
+    int m_sockfd;
+    bool m_keep_alive;
+    int m_status;
+    string m_title;
+    string m_headers; // 处理函数添加的首部
+    string m_body;    // 尚未发送的响应体
+    string m_out;     // 待发送的数据
+    bool m_chunked;   // 是否已经开始分块传输
+    bool m_failed;
+};
+
+// 处理函数接口
+// handle() 在线程池的工作线程中调用，不会阻塞主线程的事件循环
+// 同一个对象会被多个工作线程同时调用，实现需保证线程安全
+class http_handler
+{
+public:
+    virtual ~http_handler() {}
+    virtual void handle(request_view &req, response_writer &res) = 0;
+};
+
+// 处理函数注册表，单例
+// 静态注册使用 REGISTER_HANDLER，动态加载的插件导出
+//     extern "C" void register_handlers(handler_registry *registry)
+// 并在其中调用 registry->add()
+class handler_registry
+{
+public:
+    static handler_registry *get_instance()
+    {
+        static handler_registry instance;
+        return &instance;
+    }
+
+    // 注册处理函数，prefix 为URL前缀
+    void add(const string &prefix, http_handler *handler);
+
+    // 加载 dir 下所有的 .so 插件，返回成功加载的插件数量
+    int load_dir(const string &dir, int close_log);
+
+    size_t size() const { return m_handlers.size(); }
+    const string &prefix(size_t i) const { return m_handlers[i].first; }
+    http_handler *handler(size_t i) const { return m_handlers[i].second; }
+
+private:
+    handler_registry() {}
+
+    vector<pair<string, http_handler *> > m_handlers;
+};
+
+typedef void (*register_handlers_fn)(handler_registry *registry);
+
+// 静态注册：在全局对象构造时把处理函数加入注册表
+struct handler_registrar
+{
+    handler_registrar(const char *prefix, http_handler *handler)
+    {
+        handler_registry::get_instance()->add(prefix, handler);
+    }
+};
+
+#define REGISTER_HANDLER(prefix, cls) \
+    static handler_registrar cls##_registrar(prefix, new cls)
+
+#endif
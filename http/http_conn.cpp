@@ -1,54 +1,39 @@
 #include "http_conn.h"
 
 #include <mysql/mysql.h>
+#include <mysql/errmsg.h>
 #include <fstream>
 
 // 定义http响应的一些状态信息
 const char *ok_200_title = "OK";
+const char *ok_201_title = "Created";
+const char *ok_201_form = "The file was uploaded successfully.\n";
 const char *error_400_title = "Bad Request";
 const char *error_400_form = "Your request has bad syntax or is inherently impossible to staisfy.\n";
 const char *error_403_title = "Forbidden";
 const char *error_403_form = "You do not have permission to get file form this server.\n";
 const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
+const char *error_411_title = "Length Required";
+const char *error_411_form = "The upload needs a non-zero Content-Length.\n";
+const char *error_413_title = "Payload Too Large";
+const char *error_413_form = "The request body exceeds the limit of this server.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
+const char *error_502_title = "Bad Gateway";
+const char *error_502_form = "The upstream server is unavailable or sent an invalid response.\n";
+const char *error_503_title = "Service Unavailable";
+const char *error_503_form = "The database is temporarily unavailable, please try again later.\n";
+const char *not_modified_304_title = "Not Modified";
 
-// user表的保护锁
-locker m_lock;
-// 存放用户名-密码对
-map<string, string> users;
+// 与 http_conn::METHOD 一一对应
+const char *method_name[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATH"};
 
-// 从传入的connection_pool中运行 SELECT username,passwd FROM user
-// 将用户名-密码对放到user中
-void http_conn::initmysql_result(connection_pool *connPool)
+// 启动时不再读取整个 user 表，登录时由 user_table 按用户名向后端查询并缓存
+void http_conn::init_backend(user_backend *backend, connection_pool *connPool)
 {
-    // 先从连接池中取一个连接
-    MYSQL *mysql = NULL;
-    connectionRAII mysqlcon(&mysql, connPool);
-
-    // 在user表中检索username，passwd数据，浏览器端输入
-    if (mysql_query(mysql, "SELECT username,passwd FROM user"))
-    {
-        LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
-    }
-
-    // 从表中检索完整的结果集
-    MYSQL_RES *result = mysql_store_result(mysql);
-
-    // 返回结果集中的列数
-    int num_fields = mysql_num_fields(result);
-
-    // 返回所有字段结构的数组
-    MYSQL_FIELD *fields = mysql_fetch_fields(result);
-
-    // 从结果集中获取下一行，将对应的用户名和密码，存入map中
-    while (MYSQL_ROW row = mysql_fetch_row(result))
-    {
-        string temp1(row[0]);
-        string temp2(row[1]);
-        users[temp1] = temp2;
-    }
+    m_backend = backend;
+    m_connPool = connPool;
 }
 
 // 设置fd文件描述符为非阻塞
@@ -67,6 +52,7 @@ int setnonblocking(int fd)
 void addfd(int epollfd, int fd, bool one_shot, int TRIGMode)
 {
     epoll_event event;
+    bzero(&event, sizeof(event));
     event.data.fd = fd;
     // EPOLLIN       对应文件描述符可读
     // EPOLLET       使用边缘触发模式
@@ -96,6 +82,7 @@ void removefd(int epollfd, int fd)
 void modfd(int epollfd, int fd, int ev, int TRIGMode)
 {
     epoll_event event;
+    bzero(&event, sizeof(event));
     event.data.fd = fd;
 
     // EPOLLET       使用边缘触发模式
@@ -112,14 +99,55 @@ void modfd(int epollfd, int fd, int ev, int TRIGMode)
 
 int http_conn::m_user_count = 0; // http用户数量
 int http_conn::m_epollfd = -1;   // 由WebServer类创建
+vector<route_entry> http_conn::m_routes;
+user_backend *http_conn::m_backend = NULL;
+connection_pool *http_conn::m_connPool = NULL;
+int http_conn::m_timeouts[http_conn::PHASE_COUNT] = {15, 15, 15, 15};
+int http_conn::m_min_rate = 1024;
+
+// 添加一条路由，按添加顺序匹配URL前缀
+void http_conn::add_route(const string &prefix, int type, const string &target, long long limit,
+                          upstream *up, http_handler *handler)
+{
+    route_entry route;
+    route.prefix = prefix;
+    route.type = type;
+    route.target = target;
+    route.limit = limit;
+    route.up = up;
+    route.handler = handler;
+    m_routes.push_back(route);
+}
+
+// 按前缀在 m_routes 中查找 m_url 对应的路由，未匹配返回NULL
+const route_entry *http_conn::match_route()
+{
+    for (size_t i = 0; i < m_routes.size(); ++i)
+    {
+        if (strncmp(m_url, m_routes[i].prefix.c_str(), m_routes[i].prefix.size()) == 0)
+            return &m_routes[i];
+    }
+    return NULL;
+}
 
 // 若 real_close = true, 则关闭m_sockfd
 // 并从m_epollfd中移除, m_user_count减1
+// 释放上传、代理占用的文件、管道和上游连接
 void http_conn::close_conn(bool real_close)
 {
     if (real_close && (m_sockfd != -1))
     {
         printf("close %d\n", m_sockfd);
+        abort_upload();
+        proxy_abort();
+#ifdef ASYNC_SQL
+        sql_abort();
+#endif
+        if (m_batch_state.load(std::memory_order_acquire) != BATCH_NONE)
+            user_writer::get_instance()->detach(this);
+        m_batch_state.store(BATCH_NONE, std::memory_order_relaxed);
+        close_pipe();
+        bundle_release();
         removefd(m_epollfd, m_sockfd);
         m_sockfd = -1;
         m_user_count--;
@@ -152,6 +180,8 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
     strcpy(sql_name, sqlname.c_str());
 
     init();
+    // 新连接从建立时开始计算请求头的超时
+    set_phase(PHASE_HEAD);
 }
 
 // 初始化新接受的连接
@@ -168,10 +198,17 @@ void http_conn::init()
     m_version = 0;
     m_content_length = 0;
     m_host = 0;
+    m_if_none_match = 0;
+    m_accept_gzip = false;
+    m_session = 0;
+    m_session_buf[0] = '\0';
+    m_set_cookie[0] = '\0';
+    m_route = NULL;
     m_start_line = 0;
     m_checked_idx = 0;
     m_read_idx = 0;
     m_write_idx = 0;
+    m_body_address = 0;
     cgi = 0;
     m_state = 0;
     timer_flag = 0;
@@ -180,6 +217,93 @@ void http_conn::init()
     memset(m_read_buf, '\0', READ_BUFFER_SIZE);
     memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
     memset(m_real_file, '\0', FILENAME_LEN);
+    set_phase(PHASE_IDLE);
+    if (m_fcgi)
+        m_fcgi->release();
+    if (m_writer)
+    {
+        delete m_writer;
+        m_writer = NULL;
+    }
+    bundle_release();
+}
+
+// 进入新阶段，重新开始计时和统计传输字节数
+void http_conn::set_phase(CONN_PHASE phase)
+{
+    time_t now = time(NULL);
+    m_phase_start.store(now, std::memory_order_relaxed);
+    m_last_active.store(now, std::memory_order_relaxed);
+    m_phase_bytes.store(0, std::memory_order_relaxed);
+    m_unsent.store(0, std::memory_order_relaxed);
+    m_phase.store(phase, std::memory_order_release);
+}
+
+// 本阶段传输了 bytes 字节，空闲的连接收到数据即开始接收下一个请求的请求头
+// 发送的数据先进入内核发送队列，定时器到期时在 deadline() 中按队列的减少量计入传输字节数
+void http_conn::progress(long bytes)
+{
+    int phase = m_phase.load(std::memory_order_acquire);
+    if (PHASE_IDLE == phase)
+    {
+        set_phase(PHASE_HEAD);
+        phase = PHASE_HEAD;
+    }
+    m_last_active.store(time(NULL), std::memory_order_relaxed);
+    if (PHASE_SEND == phase)
+    {
+        m_unsent.fetch_add(bytes, std::memory_order_relaxed);
+        return;
+    }
+    m_phase_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    if (PHASE_BODY == phase)
+        next_round();
+}
+
+// 每个超时周期重新统计一次速率，之前快速传输的数据不能抵消之后的低速
+void http_conn::next_round()
+{
+    time_t last_active = m_last_active.load(std::memory_order_relaxed);
+    time_t elapsed = last_active - m_phase_start.load(std::memory_order_relaxed);
+    if (elapsed >= m_timeouts[m_phase.load(std::memory_order_relaxed)] &&
+        m_phase_bytes.load(std::memory_order_relaxed) >= (long long)elapsed * m_min_rate)
+    {
+        m_phase_start.store(last_active, std::memory_order_relaxed);
+        m_phase_bytes.store(0, std::memory_order_relaxed);
+    }
+}
+
+// 当前阶段的截止时间
+// 请求头和空闲阶段从进入阶段时算起，收到数据也不推迟，慢速发送请求头的连接在 head 秒后关闭
+// 请求体和发送阶段超过 body/send 秒没有传输数据即超时；
+// m_min_rate 不为0时，本轮统计每传输 m_min_rate 字节把截止时间推迟1秒，低于该速率的连接最终仍会超时
+time_t http_conn::deadline(bool fired)
+{
+    int phase = m_phase.load(std::memory_order_acquire);
+    if (PHASE_HEAD == phase || PHASE_IDLE == phase)
+        return m_phase_start.load(std::memory_order_relaxed) + m_timeouts[phase];
+
+    // 发送缓冲区很大时，客户端慢速接收很久才会触发一次可写事件，按内核发送队列的减少量统计进展
+    // 只在定时器到期时查询，调整定时器时按已知的进展计算，截止时间只会偏早，到期后在这里推迟
+    int unsent = 0;
+    long long queued = m_unsent.load(std::memory_order_relaxed);
+    if (fired && PHASE_SEND == phase && queued > 0 && ioctl(m_sockfd, SIOCOUTQ, &unsent) == 0 && unsent < queued)
+    {
+        m_phase_bytes.fetch_add(queued - unsent, std::memory_order_relaxed);
+        m_unsent.store(unsent, std::memory_order_relaxed);
+        m_last_active.store(time(NULL), std::memory_order_relaxed);
+        next_round();
+    }
+
+    time_t deadline = m_last_active.load(std::memory_order_relaxed) + m_timeouts[phase];
+    if (m_min_rate > 0)
+    {
+        time_t slow = m_phase_start.load(std::memory_order_relaxed) + m_timeouts[phase] +
+                      m_phase_bytes.load(std::memory_order_relaxed) / m_min_rate;
+        if (slow < deadline)
+            deadline = slow;
+    }
+    return deadline;
 }
 
 // 从接收缓冲区中解析出一行数据，并将回车换行字符改为空
@@ -222,6 +346,10 @@ http_conn::LINE_STATUS http_conn::parse_line()
 // 读取网络数据，LT模式下只读取一次，ET模式下使用while循环读取
 bool http_conn::read_once()
 {
+    // 上传状态下请求体不经过 m_read_buf
+    if (CHECK_STATE_UPLOAD == m_check_state)
+        return splice_upload();
+
     if (m_read_idx >= READ_BUFFER_SIZE)
     {
         return false;
@@ -239,6 +367,7 @@ bool http_conn::read_once()
             return false;
         }
 
+        progress(bytes_read);
         return true;
     }
     // ET读数据
@@ -260,13 +389,14 @@ bool http_conn::read_once()
                 return false;
             }
             m_read_idx += bytes_read;
+            progress(bytes_read);
         }
         return true;
     }
 }
 
 // 解析http请求行
-// 请求方法记录到 m_method 中(只处理 GET 和 POST)，如果出现过POST，cgi = 1
+// 请求方法记录到 m_method 中(只处理 GET、POST 和 PUT)，如果出现过POST，cgi = 1
 // URL地址记录到 m_url 中，只保留'/'所在的位置，‘/’则改为 "/judge.html"
 // 版本信息记录到 m_version 中
 // 设置 m_check_state = CHECK_STATE_HEADER
@@ -290,6 +420,8 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
         m_method = POST;
         cgi = 1;
     }
+    else if (strcasecmp(method, "PUT") == 0)
+        m_method = PUT;
     else
         return BAD_REQUEST;
 
@@ -326,12 +458,14 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     if (strlen(m_url) == 1)
         strcat(m_url, "judge.html");
 
+    m_route = match_route();
     m_check_state = CHECK_STATE_HEADER;
     return NO_REQUEST;
 }
 
 // 解析http请求的一个头部信息
 
+// 解析到回车换行，若匹配到上传路由，则调用 begin_upload() 开始接收上传文件
 // 解析到回车换行，若存在实体主体，则设置 m_check_state = CHECK_STATE_CONTENT，返回 NO_REQUEST
 // 解析到回车换行，若不存在实体主体，则返回GET_REQUEST
 
@@ -344,9 +478,18 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
     // 若存在实体主体，则设置 m_check_state = CHECK_STATE_CONTENT
     if (text[0] == '\0')
     {
+        // 上传路由的请求体不进入 m_read_buf，直接落盘
+        if (m_route && ROUTE_UPLOAD == m_route->type && (PUT == m_method || POST == m_method))
+            return begin_upload();
+
+        // 静态文件路由不支持PUT
+        if (PUT == m_method && !(m_route && ROUTE_STATIC != m_route->type))
+            return BAD_REQUEST;
+
         if (m_content_length != 0)
         {
             m_check_state = CHECK_STATE_CONTENT;
+            set_phase(PHASE_BODY);
             return NO_REQUEST;
         }
         return GET_REQUEST;
@@ -372,6 +515,43 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
         text += strspn(text, " \t");
         m_host = text;
     }
+    else if (strncasecmp(text, "If-None-Match:", 14) == 0)
+    {
+        text += 14;
+        text += strspn(text, " \t");
+        m_if_none_match = text;
+    }
+    else if (strncasecmp(text, "Accept-Encoding:", 16) == 0)
+    {
+        text += 16;
+        m_accept_gzip = (strcasestr(text, "gzip") != NULL);
+    }
+    // Cookie: a=1; sid=令牌，只取会话令牌，复制到 m_session_buf
+    // 首部行在 m_read_buf 中以'\0'分隔，代理、FastCGI和处理函数还要按原样遍历，不能在行内截断
+    // 长度超过 TOKEN_LEN 的令牌不可能有效，直接忽略
+    else if (strncasecmp(text, "Cookie:", 7) == 0)
+    {
+        text += 7;
+        const size_t name_len = strlen(SESSION_COOKIE);
+        while (*text)
+        {
+            text += strspn(text, " \t;");
+            char *end = text + strcspn(text, ";");
+            if (strncmp(text, SESSION_COOKIE "=", name_len + 1) == 0)
+            {
+                const char *value = text + name_len + 1;
+                size_t len = end - value;
+                if (len > 0 && len <= (size_t)session_store::TOKEN_LEN)
+                {
+                    memcpy(m_session_buf, value, len);
+                    m_session_buf[len] = '\0';
+                    m_session = m_session_buf;
+                }
+                break;
+            }
+            text = end;
+        }
+    }
     else
     {
         LOG_INFO("oop!unknow header: %s", text);
@@ -400,6 +580,10 @@ http_conn::HTTP_CODE http_conn::process_read()
     HTTP_CODE ret = NO_REQUEST;
     char *text = 0;
 
+    // 上传的请求体在 read_once() 中已经写入文件
+    if (CHECK_STATE_UPLOAD == m_check_state)
+        return m_upload_left > 0 ? NO_REQUEST : finish_upload();
+
     // 接收缓冲区成功解析出一行，或者已经解析到了 CHECK_STATE_CONTENT
     while ((m_check_state == CHECK_STATE_CONTENT && line_status == LINE_OK) || ((line_status = parse_line()) == LINE_OK))
     {
@@ -416,6 +600,7 @@ http_conn::HTTP_CODE http_conn::process_read()
             ret = parse_request_line(text);
             if (ret == BAD_REQUEST)
                 return BAD_REQUEST;
+            m_headers_idx = m_start_line;
             break;
         }
         case CHECK_STATE_HEADER:
@@ -428,6 +613,9 @@ http_conn::HTTP_CODE http_conn::process_read()
             {
                 return do_request();
             }
+            // 开始上传后，剩余数据都属于请求体
+            else if (ret != NO_REQUEST || CHECK_STATE_UPLOAD == m_check_state)
+                return ret;
             break;
         }
         case CHECK_STATE_CONTENT:
@@ -449,11 +637,34 @@ http_conn::HTTP_CODE http_conn::process_read()
 // 根据m_url将需要显示的HTML文件路径放在 m_real_file 中，并映射到m_file_address处
 http_conn::HTTP_CODE http_conn::do_request()
 {
+    // 请求已完整收到，处理请求的时间计入发送响应阶段
+    set_phase(PHASE_SEND);
+
+    // 代理路由，转发给上游服务器
+    if (m_route && ROUTE_PROXY == m_route->type)
+        return do_proxy();
+    // FastCGI路由，交给应用进程处理
+    if (m_route && ROUTE_FASTCGI == m_route->type)
+        return do_fastcgi();
+    // 处理函数路由
+    if (m_route && ROUTE_HANDLER == m_route->type)
+        return do_handler();
+
     strcpy(m_real_file, doc_root);
     int len = strlen(doc_root);
     // printf("m_url:%s\n", m_url);
     const char *p = strrchr(m_url, '/');
 
+    // 带有效会话令牌时首页和登录页直接显示欢迎页，不再提交和校验用户名、密码
+    session_store *sessions = session_store::get_instance();
+    string session_user;
+    if (m_session && (strcmp(m_url, "/judge.html") == 0 || strcmp(m_url, "/1") == 0) &&
+        sessions->find(m_session, session_user))
+    {
+        strcpy(m_url, "/welcome.html");
+        return do_file();
+    }
+
     // 处理cgi
     if (cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3'))
     {
@@ -483,40 +694,83 @@ http_conn::HTTP_CODE http_conn::do_request()
 
         if (*(p + 1) == '3')
         {
-            // 拼接数据库运行语句
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-
-            if (users.find(name) == users.end())
+            // 数据库熔断期间注册需要写数据库，直接返回503，不占用工作线程等待
+            if (m_backend && !m_backend->available())
+                return SERVICE_UNAVAILABLE;
+
+            // 先占用用户名，同名的并发注册只有一个会写数据库
+            // 先写后确认时用户立即可见，不能等数据库的唯一约束拒绝，先查询用户名是否已存在
+            user_table *table = user_table::get_instance();
+            user_writer *writer = user_writer::get_instance();
+            string stored;
+            bool taken = writer->write_behind() && USER_ACTIVE == table->get(name, stored);
+            if (!taken && table->reserve(name))
             {
-                m_lock.lock();
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(pair<string, string>(name, password));
-                m_lock.unlock();
-
-                if (!res)
+                // 开启批量写入时交给写入线程，与其它注册合并为一条INSERT
+                if (writer->enabled())
+                {
+                    // 先写后确认：用户立即对登录可见，之后由写入线程写入数据库
+                    if (writer->write_behind())
+                    {
+                        table->commit(name, password, true);
+                        writer->submit(name, password, NULL, NULL);
+                        strcpy(m_url, "/log.html");
+                        return do_file();
+                    }
+                    // 等待所在批次写完，由 process() 提交给写入线程
+                    snprintf(m_sql_name, sizeof(m_sql_name), "%s", name);
+                    snprintf(m_sql_passwd, sizeof(m_sql_passwd), "%s", password);
+                    return BATCH_REQUEST;
+                }
+#ifdef ASYNC_SQL
+                // MySQL 后端非阻塞地发出INSERT，不等待数据库返回
+                if (m_connPool)
+                    return sql_start(name, password);
+#endif
+                // 由后端写入，MySQL 后端此时才从连接池取连接，写完立即归还，取不到连接时按注册失败处理
+                // 用户名和密码作为预处理语句的参数发送，不拼接进SQL
+                if (BACKEND_OK == m_backend->insert(name, password))
+                {
+                    table->commit(name, password);
                     strcpy(m_url, "/log.html");
+                }
                 else
+                {
+                    table->cancel(name);
                     strcpy(m_url, "/registerError.html");
+                }
             }
             else
                 strcpy(m_url, "/registerError.html");
         }
         // 如果是登录，直接判断
-        // 若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
+        // 用户名不在缓存中时查询数据库，数据库不可用时使用已过期的缓存，仍没有时按登录失败处理
+        // 已有同一用户的有效会话时不再校验密码；登录成功后创建新会话，替换请求带来的旧会话
         else if (*(p + 1) == '2')
         {
-            if (users.find(name) != users.end() && users[name] == password)
+            if (m_session && sessions->find(m_session, session_user) && session_user == name)
+                strcpy(m_url, "/welcome.html");
+            else if (user_table::get_instance()->check(name, password))
+            {
+                if (m_session)
+                    sessions->remove(m_session);
+                if (!sessions->create(name, m_set_cookie))
+                    m_set_cookie[0] = '\0';
                 strcpy(m_url, "/welcome.html");
+            }
             else
                 strcpy(m_url, "/logError.html");
         }
     }
+    return do_file();
+}
+
+// 根据m_url将需要显示的文件路径放在 m_real_file 中，并映射到m_file_address处
+// m_real_file 中已是 doc_root，注册异步写数据库时在写完之后按改写后的 m_url 调用
+http_conn::HTTP_CODE http_conn::do_file()
+{
+    int len = strlen(doc_root);
+    const char *p = strrchr(m_url, '/');
 
     // 新用户注册界面
     if (*(p + 1) == '0')
@@ -567,6 +821,10 @@ http_conn::HTTP_CODE http_conn::do_request()
     else
         strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
 
+    // 资源包中有的文件不再 stat、open、mmap
+    if (find_bundle(m_real_file + len))
+        return BUNDLE_REQUEST;
+
     // 获取对应URL的文件信息到 m_file_stat 中，判断资源是否可用
     if (stat(m_real_file, &m_file_stat) < 0)
         return NO_RESOURCE;
@@ -591,6 +849,1086 @@ http_conn::HTTP_CODE http_conn::do_request()
     return FILE_REQUEST;
 }
 
+// 批次写完，在写入线程中调用，user_table 中的占位已经提交或取消
+// 客户端 socket 在等待期间没有注册事件，注册写事件后由 write() 发送注册结果
+void http_conn::batch_done(void *arg, bool ok)
+{
+    http_conn *conn = (http_conn *)arg;
+    // 结果先于事件注册对其它线程可见，write() 读到 BATCH_OK/BATCH_FAIL 时批次已经写完
+    conn->m_batch_state.store(ok ? BATCH_OK : BATCH_FAIL, std::memory_order_release);
+    modfd(m_epollfd, conn->m_sockfd, EPOLLOUT, conn->m_TRIGMode);
+}
+
+// 按批量写入的结果组装响应并发送
+bool http_conn::batch_write()
+{
+    strcpy(m_url, BATCH_OK == m_batch_state.load(std::memory_order_acquire) ? "/log.html" : "/registerError.html");
+    m_batch_state.store(BATCH_NONE, std::memory_order_relaxed);
+    m_write_idx = 0;
+    if (!process_write(do_file()))
+        return false;
+    return write();
+}
+
+#ifdef ASYNC_SQL
+// 从连接池取一个连接，用非阻塞接口执行注册的预处理语句，name 已在 user_table 中占位
+// 查询需要等待数据库时返回 SQL_REQUEST，由 process() 注册数据库连接的事件，在 write() 中继续
+// 用户名、密码保存在成员中并作为参数绑定，等待期间 m_read_buf 可能被改写
+http_conn::HTTP_CODE http_conn::sql_start(const char *name, const char *password)
+{
+    snprintf(m_sql_name, sizeof(m_sql_name), "%s", name);
+    snprintf(m_sql_passwd, sizeof(m_sql_passwd), "%s", password);
+    const char *params[2] = {m_sql_name, m_sql_passwd};
+
+    mysql = m_connPool->GetConnection();
+    m_sql_stmt = mysql ? m_connPool->Bind(mysql, INSERT_USER_SQL, params, 2) : NULL;
+    if (!m_sql_stmt)
+    {
+        m_connPool->ReleaseConnection(mysql);
+        mysql = NULL;
+        user_table::get_instance()->cancel(name);
+        strcpy(m_url, "/registerError.html");
+        return do_file();
+    }
+    m_sql_registered = false;
+
+    int err = 0;
+    m_sql_begin = circuit_breaker::now_ms();
+    m_sql_status = mysql_stmt_execute_start(&err, m_sql_stmt);
+    if (m_sql_status)
+        return SQL_REQUEST;
+    return sql_finish(err);
+}
+
+// 在 m_epollfd 中注册数据库连接上 m_sql_status 所等待的事件，仅监听一次
+// 与 proxy_wait() 相同，data.u64 带 AUX_EVENT 标志，先更新 m_sql_registered 再 epoll_ctl
+// 不单独等待 MYSQL_WAIT_TIMEOUT，数据库长时间不响应时由发送阶段的定时器关闭连接
+void http_conn::sql_wait()
+{
+    epoll_event event;
+    bzero(&event, sizeof(event));
+    event.data.u64 = AUX_EVENT | (uint32_t)m_sockfd;
+    event.events = EPOLLRDHUP | EPOLLONESHOT;
+    if (m_sql_status & MYSQL_WAIT_READ)
+        event.events |= EPOLLIN;
+    if (m_sql_status & MYSQL_WAIT_WRITE)
+        event.events |= EPOLLOUT;
+    int op = m_sql_registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    m_sql_registered = true;
+    epoll_ctl(m_epollfd, op, mysql_get_socket(mysql), &event);
+}
+
+// 数据库连接就绪，继续执行查询，完成后组装响应并发送
+// 事件由 EPOLLONESHOT 触发，就绪的正是所等待的事件，原样传回 mysql_stmt_execute_cont()
+bool http_conn::sql_write()
+{
+    int err = 0;
+    m_sql_status = mysql_stmt_execute_cont(&err, m_sql_stmt, m_sql_status);
+    if (m_sql_status)
+    {
+        sql_wait();
+        return true;
+    }
+
+    m_write_idx = 0;
+    if (!process_write(sql_finish(err)))
+        return false;
+    return write();
+}
+
+// 查询完成：从 m_epollfd 中移除数据库连接并归还，按结果提交或取消占位
+// 连接的 fd 会被其它请求重新注册，必须在归还之前移除，连接错误时由连接池在归还时关闭
+http_conn::HTTP_CODE http_conn::sql_finish(int err)
+{
+    if (m_sql_registered)
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, mysql_get_socket(mysql), 0);
+    m_sql_registered = false;
+    m_sql_status = 0;
+    m_connPool->Record(err < CR_MIN_ERROR, circuit_breaker::now_ms() - m_sql_begin);
+
+    user_table *table = user_table::get_instance();
+    if (!err)
+    {
+        table->commit(m_sql_name, m_sql_passwd);
+        strcpy(m_url, "/log.html");
+    }
+    else
+    {
+        LOG_ERROR("INSERT error:%s", mysql_stmt_error(m_sql_stmt));
+        m_connPool->Failed(mysql, m_sql_stmt);
+        table->cancel(m_sql_name);
+        strcpy(m_url, "/registerError.html");
+    }
+    m_connPool->ReleaseConnection(mysql);
+    mysql = NULL;
+    return do_file();
+}
+
+// 查询未完成时关闭连接：数据库连接处于查询中途，不能再给其它请求使用，交给连接池关闭
+// INSERT 可能已经执行，也可能没有，释放占位，同名的再次注册由数据库的唯一约束判断
+void http_conn::sql_abort()
+{
+    if (!m_sql_status)
+        return;
+    if (m_sql_registered)
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, mysql_get_socket(mysql), 0);
+    m_sql_registered = false;
+    m_sql_status = 0;
+    m_connPool->Record(false, circuit_breaker::now_ms() - m_sql_begin);
+    user_table::get_instance()->cancel(m_sql_name);
+    m_connPool->DiscardConnection(mysql);
+    mysql = NULL;
+}
+#endif
+
+// 请求头解析完后开始上传
+// 文件名为URL去掉路由前缀的部分，先写入同目录下的临时文件，接收完毕后再rename
+// 已读入 m_read_buf 的部分请求体直接写入临时文件，其余部分由 splice_upload() 搬运
+http_conn::HTTP_CODE http_conn::begin_upload()
+{
+    if (m_content_length < 0)
+        return BAD_REQUEST;
+    // 没有 Content-Length 时无法确定请求体的结尾，长度为0时没有内容可写，都不创建目标文件
+    if (0 == m_content_length)
+        return LENGTH_REQUIRED;
+    if (m_content_length > m_route->limit)
+        return ENTITY_TOO_LARGE;
+
+    // 不允许上传到子目录或者隐藏文件
+    const char *name = m_url + m_route->prefix.size();
+    if (name[0] == '\0' || name[0] == '.' || strchr(name, '/'))
+        return BAD_REQUEST;
+    if (m_route->target.size() + strlen(name) + 2 > FILENAME_LEN)
+        return BAD_REQUEST;
+
+    snprintf(m_upload_path, FILENAME_LEN, "%s/%s", m_route->target.c_str(), name);
+    snprintf(m_upload_tmp, FILENAME_LEN, "%s/.upload.XXXXXX", m_route->target.c_str());
+
+    m_upload_fd = mkstemp(m_upload_tmp);
+    if (m_upload_fd < 0)
+    {
+        LOG_ERROR("upload mkstemp error:%d", errno);
+        return INTERNAL_ERROR;
+    }
+    fchmod(m_upload_fd, 0644);
+
+    if (!open_pipe())
+    {
+        LOG_ERROR("upload pipe error:%d", errno);
+        abort_upload();
+        return INTERNAL_ERROR;
+    }
+
+    long long buffered = m_read_idx - m_checked_idx;
+    if (buffered > m_content_length)
+        buffered = m_content_length;
+    if (buffered > 0 && ::write(m_upload_fd, m_read_buf + m_checked_idx, buffered) != buffered)
+    {
+        LOG_ERROR("upload write error:%d", errno);
+        abort_upload();
+        return INTERNAL_ERROR;
+    }
+    m_checked_idx += buffered;
+
+    m_upload_left = m_content_length - buffered;
+    m_check_state = CHECK_STATE_UPLOAD;
+    set_phase(PHASE_BODY);
+    if (0 == m_upload_left)
+        return finish_upload();
+    return NO_REQUEST;
+}
+
+// socket -> 管道 -> 临时文件，数据不经过用户态
+// LT模式下只搬运一次，ET模式下循环直到 EAGAIN、请求体接收完毕或本次搬运了 IO_BUDGET 字节
+// 未搬运完的数据在 process() 重新注册读事件后会再次触发
+// 对端关闭或出错返回false
+bool http_conn::splice_upload()
+{
+    int budget = IO_BUDGET;
+    while (m_upload_left > 0 && budget > 0)
+    {
+        size_t len = m_upload_left < UPLOAD_CHUNK ? m_upload_left : UPLOAD_CHUNK;
+        ssize_t in = splice(m_sockfd, NULL, m_pipe[1], NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (in == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return false;
+        }
+        else if (in == 0)
+        {
+            return false;
+        }
+
+        // 把管道中的数据全部搬到文件中
+        ssize_t left = in;
+        while (left > 0)
+        {
+            ssize_t out = splice(m_pipe[0], NULL, m_upload_fd, NULL, left, SPLICE_F_MOVE);
+            if (out <= 0)
+            {
+                LOG_ERROR("upload splice error:%d", errno);
+                return false;
+            }
+            left -= out;
+        }
+        m_upload_left -= in;
+        budget -= in;
+        progress(in);
+
+        if (0 == m_TRIGMode)
+            break;
+    }
+    return true;
+}
+
+// 请求体接收完毕，关闭临时文件并 rename 到目标路径，rename 保证替换是原子的
+http_conn::HTTP_CODE http_conn::finish_upload()
+{
+    int ret = close(m_upload_fd);
+    m_upload_fd = -1;
+    if (ret < 0 || rename(m_upload_tmp, m_upload_path) < 0)
+    {
+        LOG_ERROR("upload rename %s error:%d", m_upload_path, errno);
+        unlink(m_upload_tmp);
+        return INTERNAL_ERROR;
+    }
+    LOG_INFO("upload %s done", m_upload_path);
+    return CREATED_REQUEST;
+}
+
+// 放弃未完成的上传，关闭管道和临时文件并删除临时文件
+void http_conn::abort_upload()
+{
+    if (m_upload_fd != -1)
+    {
+        close(m_upload_fd);
+        unlink(m_upload_tmp);
+        m_upload_fd = -1;
+        close_pipe();
+    }
+    m_upload_left = 0;
+}
+
+// 创建 splice 中转管道，已存在则直接返回
+bool http_conn::open_pipe()
+{
+    if (m_pipe[0] != -1)
+        return true;
+    return pipe(m_pipe) == 0;
+}
+
+// 关闭中转管道
+void http_conn::close_pipe()
+{
+    if (m_pipe[0] != -1)
+    {
+        close(m_pipe[0]);
+        close(m_pipe[1]);
+        m_pipe[0] = m_pipe[1] = -1;
+    }
+}
+
+// 组装转发给上游的请求，交给 proxy_start() 连接上游并发送
+// 请求行改为 HTTP/1.0 并带上 Connection: keep-alive，上游只能用 Content-Length 或关闭连接来界定响应
+// 去掉逐跳首部，附加 X-Forwarded-For
+// 返回 PROXY_REQUEST 后由 process() 注册上游连接的事件，请求的剩余部分和响应在 write() 中处理
+http_conn::HTTP_CODE http_conn::do_proxy()
+{
+    if (!m_proxy_buf)
+        m_proxy_buf = new char[PROXY_BUFFER_SIZE * 2 + 256];
+
+    // 组装转发的请求
+    char *buf = m_proxy_buf;
+    int size = PROXY_BUFFER_SIZE;
+    int len = snprintf(buf, size, "%s %s HTTP/1.0\r\n", method_name[m_method], m_url);
+
+    // 首部行在 m_read_buf 中以两个'\0'分隔，空行结束
+    char *line = m_read_buf + m_headers_idx;
+    while (len < size && *line != '\0')
+    {
+        int line_len = strlen(line);
+        if (strncasecmp(line, "Connection:", 11) != 0 && strncasecmp(line, "Keep-Alive:", 11) != 0 &&
+            strncasecmp(line, "Proxy-Connection:", 17) != 0)
+            len += snprintf(buf + len, size - len, "%s\r\n", line);
+        line += line_len + 2;
+    }
+
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &m_address.sin_addr, ip, sizeof(ip));
+    if (len < size)
+        len += snprintf(buf + len, size - len, "X-Forwarded-For: %s\r\nConnection: keep-alive\r\n\r\n", ip);
+    if (len + m_content_length >= size)
+        return BAD_REQUEST;
+    if (m_content_length > 0)
+    {
+        memcpy(buf + len, m_string, m_content_length);
+        len += m_content_length;
+    }
+
+    if (!open_pipe())
+        return INTERNAL_ERROR;
+
+    // 请求留在 m_proxy_buf 前半部分，发完之后才开始接收响应头
+    m_proxy_up = m_route->up;
+    m_proxy_out = buf;
+    m_proxy_out_len = len;
+    m_proxy_idx = 0;
+    m_proxy_piped = 0;
+    m_proxy_reuse = true;
+    m_proxy_fcgi = false;
+    return proxy_start();
+}
+
+// 连接上游并尽量发出 m_proxy_out 中的请求，do_proxy() 和 do_fastcgi() 组装好请求后调用
+// 复用的空闲连接或立即建立的连接直接发送；连接尚未建立或发送缓冲区满时返回，由 process() 注册写事件，在 write() 中继续
+// 工作线程不等待上游：连接建立失败在 proxy_request() 中计入失败次数并换下一个后端
+http_conn::HTTP_CODE http_conn::proxy_start()
+{
+    m_proxy_tries = m_proxy_up->size() * upstream::MAX_FAILS;
+    if (!proxy_connect())
+    {
+        LOG_ERROR("no upstream available for %s", m_url);
+        return BAD_GATEWAY;
+    }
+    if (PROXY_SEND_REQUEST == m_proxy_state && proxy_send_request() < 0)
+    {
+        LOG_ERROR("send to upstream error:%d", errno);
+        proxy_abort();
+        return BAD_GATEWAY;
+    }
+    return PROXY_REQUEST;
+}
+
+// 从上游服务器组取一个连接，新建且尚未建立的连接进入 PROXY_CONNECT，否则进入 PROXY_SEND_REQUEST
+bool http_conn::proxy_connect()
+{
+    bool connecting;
+    m_proxy_fd = m_proxy_up->get_connection(m_proxy_backend, connecting);
+    if (m_proxy_fd < 0)
+        return false;
+    m_proxy_registered = false;
+    m_proxy_state = connecting ? PROXY_CONNECT : PROXY_SEND_REQUEST;
+    m_proxy_sent = 0;
+    return true;
+}
+
+// 上游连接可写后继续：
+// 1. PROXY_CONNECT: 取 SO_ERROR 判断连接是否建立，失败时计入该后端的失败次数，换一个连接重新开始
+// 2. PROXY_SEND_REQUEST: 发送请求的剩余部分
+// 请求发完进入 PROXY_HEAD 返回1；需要等待时已注册上游连接的写事件，返回0；没有可用的后端或发送失败返回-1
+int http_conn::proxy_request()
+{
+    while (PROXY_CONNECT == m_proxy_state)
+    {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(m_proxy_fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+            err = errno;
+        if (0 == err)
+        {
+            m_proxy_up->connect_result(m_proxy_backend, m_proxy_fd, 0);
+            m_proxy_state = PROXY_SEND_REQUEST;
+            break;
+        }
+
+        if (m_proxy_registered)
+            epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_proxy_fd, 0);
+        m_proxy_up->connect_result(m_proxy_backend, m_proxy_fd, err);
+        m_proxy_fd = -1;
+        m_proxy_registered = false;
+        if (--m_proxy_tries <= 0 || !proxy_connect())
+        {
+            LOG_ERROR("no upstream available for %s", m_url);
+            errno = err;
+            return -1;
+        }
+        if (PROXY_CONNECT == m_proxy_state)
+        {
+            proxy_wait();
+            return 0;
+        }
+    }
+
+    int ret = proxy_send_request();
+    if (0 == ret)
+        proxy_wait();
+    return ret;
+}
+
+// 非阻塞地发送 m_proxy_out 中的请求，发完进入 PROXY_HEAD，m_proxy_sent 清零留给响应使用
+int http_conn::proxy_send_request()
+{
+    while (m_proxy_sent < m_proxy_out_len)
+    {
+        int ret = send(m_proxy_fd, m_proxy_out + m_proxy_sent, m_proxy_out_len - m_proxy_sent, MSG_NOSIGNAL);
+        if (ret < 0)
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        m_proxy_sent += ret;
+    }
+    m_proxy_state = PROXY_HEAD;
+    m_proxy_sent = 0;
+    return 1;
+}
+
+// 在 m_epollfd 中注册上游连接所等待的事件，仅监听一次：建立连接和发送请求时为写事件，之后为读事件
+// data.u64 带 AUX_EVENT 标志，事件由 WebServer 交给 m_sockfd 对应的连接处理
+// epoll_ctl 之后事件可能立刻在主线程被处理，所以先更新 m_proxy_registered
+void http_conn::proxy_wait()
+{
+    epoll_event event;
+    bzero(&event, sizeof(event));
+    event.data.u64 = AUX_EVENT | (uint32_t)m_sockfd;
+    event.events = (m_proxy_state < PROXY_HEAD ? EPOLLOUT : EPOLLIN) | EPOLLRDHUP | EPOLLONESHOT;
+    int op = m_proxy_registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    m_proxy_registered = true;
+    epoll_ctl(m_epollfd, op, m_proxy_fd, &event);
+}
+
+// 解析上游响应头，并在 m_proxy_buf 后半部分生成发给客户端的数据：
+// 状态行改为 HTTP/1.1，去掉逐跳首部，按 m_linger 添加 Connection，后面接着已经读到的响应体
+// 响应体长度由 Content-Length 决定，没有时由上游关闭连接界定，此时客户端连接在转发完后关闭
+// 未收完返回0，格式错误返回-1，成功返回1
+int http_conn::proxy_parse_head()
+{
+    char *end = (char *)memmem(m_proxy_buf, m_proxy_idx, "\r\n\r\n", 4);
+    if (!end)
+        return 0;
+    *end = '\0';
+    char *body = end + 4;
+
+    char *line = m_proxy_buf;
+    char *next = strstr(line, "\r\n");
+    if (next)
+        *next = '\0';
+    if (strncmp(line, "HTTP/1.", 7) != 0 || !strchr(line, ' '))
+        return -1;
+    int status = atoi(strchr(line, ' ') + 1);
+    bool keep_alive = (line[7] == '1');
+
+    char *out = m_proxy_buf + PROXY_BUFFER_SIZE;
+    int len = sprintf(out, "HTTP/1.1%s\r\n", strchr(line, ' '));
+
+    m_proxy_left = -1;
+    while (next)
+    {
+        line = next + 2;
+        next = strstr(line, "\r\n");
+        if (next)
+            *next = '\0';
+
+        if (strncasecmp(line, "Connection:", 11) == 0)
+        {
+            if (strcasestr(line + 11, "close"))
+                keep_alive = false;
+            else if (strcasestr(line + 11, "keep-alive"))
+                keep_alive = true;
+            continue;
+        }
+        else if (strncasecmp(line, "Keep-Alive:", 11) == 0 || strncasecmp(line, "Proxy-Connection:", 17) == 0)
+            continue;
+        // HTTP/1.0 请求不允许分块响应
+        else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0)
+            return -1;
+        else if (strncasecmp(line, "Content-Length:", 15) == 0)
+            m_proxy_left = atoll(line + 15);
+        len += sprintf(out + len, "%s\r\n", line);
+    }
+
+    // 1xx、204、304 没有响应体
+    if (status < 200 || status == 204 || status == 304)
+        m_proxy_left = 0;
+    if (m_proxy_left < 0)
+    {
+        keep_alive = false;
+        m_linger = false;
+    }
+    m_proxy_reuse = keep_alive;
+    len += sprintf(out + len, "Connection:%s\r\n\r\n", m_linger ? "keep-alive" : "close");
+
+    // 已经读到的响应体
+    long long extra = m_proxy_buf + m_proxy_idx - body;
+    if (m_proxy_left >= 0 && extra > m_proxy_left)
+    {
+        extra = m_proxy_left;
+        m_proxy_reuse = false;
+    }
+    memcpy(out + len, body, extra);
+    len += extra;
+    if (m_proxy_left > 0)
+        m_proxy_left -= extra;
+
+    m_proxy_out = out;
+    m_proxy_out_len = len;
+    m_proxy_sent = 0;
+    return 1;
+}
+
+// 转发上游响应，请求尚未发完时先由 proxy_request() 继续
+// 1. PROXY_HEAD: 读取上游响应头并改写
+// 2. PROXY_SEND_HEAD: 发送改写后的响应头和已读到的部分响应体
+// 3. PROXY_BODY: 上游 -> 管道 -> 客户端，全程 splice()
+// 上游暂时不可读时注册上游连接的读事件，客户端暂时不可写时注册 m_sockfd 的写事件，两者同一时刻只注册一个
+// 每次最多转发 IO_BUDGET 字节的响应体，用完后注册 m_sockfd 的写事件
+bool http_conn::proxy_write()
+{
+    if (m_proxy_state < PROXY_HEAD)
+    {
+        int ret = proxy_request();
+        if (ret <= 0)
+            return ret == 0 ? true : proxy_fail();
+    }
+
+    int budget = IO_BUDGET;
+    while (true)
+    {
+        if (PROXY_HEAD == m_proxy_state)
+        {
+            int ret = recv(m_proxy_fd, m_proxy_buf + m_proxy_idx, PROXY_BUFFER_SIZE - m_proxy_idx, 0);
+            if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                proxy_wait();
+                return true;
+            }
+            if (ret <= 0)
+                return proxy_fail();
+            m_proxy_idx += ret;
+
+            int parsed = proxy_parse_head();
+            if (parsed < 0 || (0 == parsed && m_proxy_idx >= PROXY_BUFFER_SIZE))
+                return proxy_fail();
+            if (parsed > 0)
+                m_proxy_state = PROXY_SEND_HEAD;
+        }
+        else if (PROXY_SEND_HEAD == m_proxy_state)
+        {
+            int ret = send(m_sockfd, m_proxy_out + m_proxy_sent, m_proxy_out_len - m_proxy_sent, MSG_NOSIGNAL);
+            if (ret < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+                    return true;
+                }
+                proxy_abort();
+                return false;
+            }
+            m_proxy_sent += ret;
+            progress(ret);
+            if (m_proxy_sent == m_proxy_out_len)
+                m_proxy_state = PROXY_BODY;
+        }
+        else
+        {
+            // 先把管道中的数据发给客户端
+            if (m_proxy_piped > 0)
+            {
+                ssize_t ret = splice(m_pipe[0], NULL, m_sockfd, NULL, m_proxy_piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (ret < 0)
+                {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    {
+                        modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+                        return true;
+                    }
+                    proxy_abort();
+                    return false;
+                }
+                m_proxy_piped -= ret;
+                budget -= ret;
+                progress(ret);
+                continue;
+            }
+            if (0 == m_proxy_left)
+                return proxy_done();
+            // 本次转发已用完预算，管道已清空，等客户端下一次可写时继续
+            if (budget <= 0)
+            {
+                modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+                return true;
+            }
+
+            size_t len = (m_proxy_left < 0 || m_proxy_left > UPLOAD_CHUNK) ? UPLOAD_CHUNK : m_proxy_left;
+            ssize_t ret = splice(m_proxy_fd, NULL, m_pipe[1], NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (ret < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    proxy_wait();
+                    return true;
+                }
+                proxy_abort();
+                return false;
+            }
+            else if (ret == 0)
+            {
+                // 由上游关闭连接界定的响应体到此结束
+                if (m_proxy_left < 0)
+                {
+                    m_proxy_reuse = false;
+                    return proxy_done();
+                }
+                proxy_abort();
+                return false;
+            }
+            m_proxy_piped += ret;
+            if (m_proxy_left > 0)
+                m_proxy_left -= ret;
+        }
+    }
+}
+
+// 上游出错：尚未向客户端发送任何数据时（收完上游响应头之前）回复502，否则只能关闭连接
+bool http_conn::proxy_fail()
+{
+    LOG_ERROR("upstream response error:%d", errno);
+    bool sent = (m_proxy_state > PROXY_HEAD);
+    proxy_abort();
+    if (sent)
+        return false;
+
+    m_write_idx = 0;
+    if (!process_write(BAD_GATEWAY))
+        return false;
+    return write();
+}
+
+// 响应转发完毕，归还上游连接
+// 与 write() 相同，m_linger 为真则重新init，否则返回false关闭连接
+bool http_conn::proxy_done()
+{
+    proxy_release(m_proxy_reuse);
+    modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+    if (m_linger)
+    {
+        init();
+        return true;
+    }
+    return false;
+}
+
+// 从 m_epollfd 中移除上游连接并归还给上游服务器组
+void http_conn::proxy_release(bool reuse)
+{
+    if (m_proxy_fd == -1)
+        return;
+    if (m_proxy_registered)
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_proxy_fd, 0);
+    m_proxy_up->release_connection(m_proxy_backend, m_proxy_fd, reuse);
+    m_proxy_fd = -1;
+    m_proxy_registered = false;
+}
+
+// 放弃转发，关闭上游连接，管道中可能残留数据，一并关闭
+void http_conn::proxy_abort()
+{
+    if (m_proxy_fd == -1)
+        return;
+    proxy_release(false);
+    close_pipe();
+}
+
+// 把请求交给应用进程
+// 应用进程的连接由上游服务器组管理，请求带 FCGI_KEEP_CONN，完整读到 END_REQUEST 的连接放回空闲连接池
+// 与反向代理相同由 proxy_start() 连接并发出请求，工作线程不等待应用进程；
+// 返回 PROXY_REQUEST 后由 process() 注册应用进程连接的事件，输出在 write() 中由 fastcgi_write() 边读边转发
+http_conn::HTTP_CODE http_conn::do_fastcgi()
+{
+    if (!m_fcgi)
+        m_fcgi = new fastcgi;
+
+    m_fcgi->begin();
+    fastcgi_params();
+    m_fcgi->add_stdin(m_string, m_content_length);
+    if (m_content_length > 0)
+        m_fcgi->add_stdin(NULL, 0);
+
+    m_proxy_up = m_route->up;
+    m_proxy_out = (char *)m_fcgi->request().data();
+    m_proxy_out_len = m_fcgi->request().size();
+    m_proxy_left = -1;
+    m_proxy_reuse = false;
+    m_proxy_fcgi = true;
+    return proxy_start();
+}
+
+// 按CGI/1.1规范生成 PARAMS
+// SCRIPT_FILENAME 为网站根目录加上URL中的路径，请求首部行转为 HTTP_ 开头的大写名字
+void http_conn::fastcgi_params()
+{
+    const char *query = strchr(m_url, '?');
+    string script = query ? string(m_url, query - m_url) : string(m_url);
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &m_address.sin_addr, ip, sizeof(ip));
+
+    m_fcgi->add_param("GATEWAY_INTERFACE", "CGI/1.1");
+    m_fcgi->add_param("SERVER_SOFTWARE", "TinyWebServer");
+    m_fcgi->add_param("SERVER_PROTOCOL", "HTTP/1.1");
+    m_fcgi->add_param("REQUEST_METHOD", method_name[m_method]);
+    m_fcgi->add_param("REQUEST_URI", m_url);
+    m_fcgi->add_param("SCRIPT_NAME", script.c_str());
+    m_fcgi->add_param("SCRIPT_FILENAME", (string(doc_root) + script).c_str());
+    m_fcgi->add_param("DOCUMENT_ROOT", doc_root);
+    m_fcgi->add_param("QUERY_STRING", query ? query + 1 : "");
+    m_fcgi->add_param("REMOTE_ADDR", ip);
+    m_fcgi->add_param("REMOTE_PORT", (long long)ntohs(m_address.sin_port));
+    if (m_host)
+        m_fcgi->add_param("SERVER_NAME", m_host);
+    if (m_content_length > 0)
+        m_fcgi->add_param("CONTENT_LENGTH", (long long)m_content_length);
+
+    // 首部行在 m_read_buf 中以两个'\0'分隔，空行结束
+    char name[256];
+    char *line = m_read_buf + m_headers_idx;
+    while (*line != '\0')
+    {
+        int line_len = strlen(line);
+        char *colon = strchr(line, ':');
+        if (colon && colon - line < (int)sizeof(name) - 6)
+        {
+            char *value = colon + 1 + strspn(colon + 1, " \t");
+            int len = 0;
+            if (strncasecmp(line, "Content-Type:", 13) == 0)
+                len = sprintf(name, "CONTENT_TYPE");
+            // Content-Length 已由 CONTENT_LENGTH 给出；Proxy 首部会被当作代理设置(httpoxy)，丢弃
+            else if (strncasecmp(line, "Content-Length:", 15) != 0 && strncasecmp(line, "Proxy:", 6) != 0)
+            {
+                len = sprintf(name, "HTTP_");
+                for (char *p = line; p < colon; ++p)
+                    name[len++] = (*p == '-') ? '_' : toupper(*p);
+                name[len] = '\0';
+            }
+            if (len > 0)
+                m_fcgi->add_param(name, value);
+        }
+        line += line_len + 2;
+    }
+    m_fcgi->end_params();
+}
+
+// 转发应用进程的输出，请求尚未发完时先由 proxy_request() 继续
+// 1. PROXY_HEAD: 缓冲应用进程的输出直到收完CGI响应头，生成状态行和响应头
+// 2. PROXY_BODY: 每次读到的输出追加到待发送数据，应用进程结束前以分块传输发送
+// 待发送数据发完之前不再读取应用进程的连接，客户端接收得慢时应用进程的写入被套接字缓冲区挡住，服务器最多缓冲一次读到的输出
+// 读到 END_REQUEST 且数据发完后归还连接；每次最多发送 IO_BUDGET 字节，用完后注册 m_sockfd 的写事件
+bool http_conn::fastcgi_write()
+{
+    if (m_proxy_state < PROXY_HEAD)
+    {
+        int ret = proxy_request();
+        if (ret <= 0)
+            return ret == 0 ? true : proxy_fail();
+    }
+
+    string &out = m_fcgi->client_data();
+    int budget = IO_BUDGET;
+    while (true)
+    {
+        if (m_proxy_sent < (int)out.size())
+        {
+            int ret = send(m_sockfd, out.data() + m_proxy_sent, out.size() - m_proxy_sent, MSG_NOSIGNAL);
+            if (ret < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+                    return true;
+                }
+                proxy_abort();
+                return false;
+            }
+            m_proxy_sent += ret;
+            budget -= ret;
+            progress(ret);
+            continue;
+        }
+        out.clear();
+        m_proxy_sent = 0;
+        if (0 == m_proxy_left)
+        {
+            if (!m_fcgi->stderr_data().empty())
+                LOG_WARN("fastcgi stderr: %s", m_fcgi->stderr_data().c_str());
+            return proxy_done();
+        }
+        // 本次转发已用完预算，等客户端下一次可写时继续
+        if (budget <= 0)
+        {
+            modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+            return true;
+        }
+
+        fastcgi::RECV_RESULT ret = m_fcgi->receive(m_proxy_fd);
+        if (fastcgi::RECV_AGAIN == ret)
+        {
+            proxy_wait();
+            return true;
+        }
+        if (fastcgi::RECV_ERROR == ret)
+            return proxy_fail();
+        bool end = (fastcgi::RECV_END == ret);
+        if (PROXY_HEAD == m_proxy_state)
+        {
+            int parsed = fastcgi_parse_head(end);
+            if (parsed < 0 || (0 == parsed && end))
+            {
+                LOG_ERROR("fastcgi application sent an invalid response for %s", m_url);
+                return proxy_fail();
+            }
+            if (0 == parsed)
+                continue;
+            m_proxy_state = PROXY_BODY;
+        }
+        if (!fastcgi_forward(end))
+        {
+            LOG_ERROR("fastcgi response for %s exceeds %d bytes", m_url, fastcgi::MAX_RESPONSE);
+            proxy_abort();
+            return false;
+        }
+        if (end)
+        {
+            m_proxy_left = 0;
+            m_proxy_reuse = true;
+        }
+    }
+}
+
+// 解析应用进程输出的响应头，首部行之间及与响应体之间的换行可以是 \r\n 或 \n
+// Status 首部给出状态码和短语，没有时有 Location 为302，否则为200
+// 收完响应头之前不修改输出，超过 fastcgi::MAX_HEAD 仍未收完视为格式错误
+// 应用进程给出的 Content-Length 或已结束时的全部输出超过 fastcgi::MAX_RESPONSE 时不转发，由调用者回复502
+// 收完后首部行就地改为以'\0'结尾，写入 m_write_buf 后连同已读到的响应体放入待发送数据
+int http_conn::fastcgi_parse_head(bool end)
+{
+    string &out = m_fcgi->stdout_data();
+    size_t head_len = 0;
+    size_t pos = 0;
+    while (0 == head_len)
+    {
+        size_t next = out.find('\n', pos);
+        if (next == string::npos)
+            return out.size() > (size_t)fastcgi::MAX_HEAD ? -1 : 0;
+        if (next == pos || (next == pos + 1 && out[pos] == '\r'))
+            head_len = next + 1;
+        pos = next + 1;
+    }
+    if (head_len > (size_t)fastcgi::MAX_HEAD)
+        return -1;
+
+    char *start = &out[0];
+    char *end_of_head = start + head_len;
+    m_fcgi_status = 200;
+    m_fcgi_title = (char *)ok_200_title;
+    m_fcgi_head = start;
+    bool location = false;
+    long long length = -1;
+    char *line = start;
+    while (true)
+    {
+        char *next = (char *)memchr(line, '\n', end_of_head - line);
+        *next = '\0';
+        if (next > line && *(next - 1) == '\r')
+            *(next - 1) = '\0';
+        if (*line == '\0')
+        {
+            m_fcgi_head_end = line;
+            break;
+        }
+
+        if (strncasecmp(line, "Status:", 7) == 0)
+        {
+            char *value = line + 7;
+            value += strspn(value, " \t");
+            m_fcgi_status = atoi(value);
+            if (m_fcgi_status < 100 || m_fcgi_status > 999)
+                return -1;
+            char *title = strchr(value, ' ');
+            m_fcgi_title = title ? title + 1 : (char *)"";
+        }
+        else if (strncasecmp(line, "Location:", 9) == 0)
+            location = true;
+        else if (strncasecmp(line, "Content-Length:", 15) == 0)
+            length = atoll(line + 15);
+        line = next + 1;
+    }
+    if (location && 200 == m_fcgi_status)
+    {
+        m_fcgi_status = 302;
+        m_fcgi_title = (char *)"Found";
+    }
+
+    long long body_len = out.size() - head_len;
+    if (length > fastcgi::MAX_RESPONSE || (end && body_len > fastcgi::MAX_RESPONSE))
+        return -1;
+    m_fcgi_no_body = m_fcgi_status < 200 || 204 == m_fcgi_status || 304 == m_fcgi_status;
+    m_fcgi_chunked = !end && !m_fcgi_no_body;
+    m_write_idx = 0;
+    if (!add_fastcgi_response(m_fcgi_chunked ? -1 : (m_fcgi_no_body ? 0 : body_len)))
+        return -1;
+    m_fcgi->client_data().assign(m_write_buf, m_write_idx);
+    out.erase(0, head_len);
+    m_fcgi_total = 0;
+    return 1;
+}
+
+// 已读到的输出追加到待发送数据：分块传输时作为一块，读到 END_REQUEST 时补上结束块
+// 没有响应体的状态码丢弃输出
+bool http_conn::fastcgi_forward(bool end)
+{
+    string &data = m_fcgi->stdout_data();
+    string &out = m_fcgi->client_data();
+    m_fcgi_total += data.size();
+    if (m_fcgi_total > fastcgi::MAX_RESPONSE)
+        return false;
+    if (m_fcgi_chunked && !data.empty())
+    {
+        char size[32];
+        snprintf(size, sizeof(size), "%zx\r\n", data.size());
+        out.append(size).append(data).append("\r\n");
+    }
+    else if (!m_fcgi_no_body)
+        out.append(data);
+    if (m_fcgi_chunked && end)
+        out.append("0\r\n\r\n");
+    data.clear();
+    return true;
+}
+
+// 缓冲区添加应用进程的状态行和响应头
+// 去掉 Status 和逐跳首部，Content-Length 或 Transfer-Encoding 和 Connection 由服务器给出
+bool http_conn::add_fastcgi_response(long long body_len)
+{
+    if (!add_status_line(m_fcgi_status, m_fcgi_title))
+        return false;
+    for (char *line = m_fcgi_head; line < m_fcgi_head_end; line += strlen(line) + 1)
+    {
+        // 被去掉的 \r 留下的空串
+        if (*line == '\0')
+            continue;
+        if (strncasecmp(line, "Status:", 7) == 0 || strncasecmp(line, "Content-Length:", 15) == 0 ||
+            strncasecmp(line, "Connection:", 11) == 0 || strncasecmp(line, "Transfer-Encoding:", 18) == 0 ||
+            strncasecmp(line, "Keep-Alive:", 11) == 0)
+            continue;
+        if (!add_response("%s\r\n", line))
+            return false;
+    }
+    if (body_len >= 0)
+        return add_headers(body_len);
+    return add_response("Transfer-Encoding:chunked\r\n") && add_linger() && add_session_cookie() &&
+           add_blank_line();
+}
+
+// 调用路由的处理函数
+// 处理函数中 flush() 的数据已经直接发给客户端，剩余数据由 process_write() 交给 write() 发送
+// 发送失败说明客户端已断开，返回 CLOSED_CONNECTION 关闭连接
+http_conn::HTTP_CODE http_conn::do_handler()
+{
+    request_view req(method_name[m_method], m_url, m_read_buf + m_headers_idx,
+                     m_string, m_content_length, m_address);
+    m_writer = new response_writer(m_sockfd, m_linger);
+    m_route->handler->handle(req, *m_writer);
+    m_writer->finish();
+    if (m_writer->failed())
+        return CLOSED_CONNECTION;
+    return HANDLER_REQUEST;
+}
+
+// 在当前资源包中查找文件，找到时持有资源包的引用直到响应发送完毕
+bool http_conn::find_bundle(const char *path)
+{
+    bundle *b = bundle::acquire();
+    if (!b)
+        return false;
+    const bundle_entry *entry = b->find(path);
+    if (!entry)
+    {
+        b->release();
+        return false;
+    }
+    m_bundle = b;
+    m_bundle_entry = entry;
+    return true;
+}
+
+// 缓冲区添加资源包文件的状态行和响应头
+// If-None-Match 与 ETag 相同时回复304，没有响应体，不再需要资源包
+// 客户端接受gzip且有gzip版本时发送gzip版本
+bool http_conn::add_bundle_response()
+{
+    const bundle_entry *e = m_bundle_entry;
+    if (m_if_none_match && (strstr(m_if_none_match, e->etag) || strcmp(m_if_none_match, "*") == 0))
+    {
+        bundle_release();
+        return add_status_line(304, not_modified_304_title) && add_response("ETag:%s\r\n", e->etag) &&
+               add_linger() && add_blank_line();
+    }
+
+    bool gz = m_accept_gzip && e->gz_length > 0;
+    uint64_t length = gz ? e->gz_length : e->length;
+    m_send_offset = gz ? e->gz_offset : e->offset;
+    if (!add_status_line(200, ok_200_title) || !add_response("Content-Type:%s\r\nETag:%s\r\n", e->mime, e->etag))
+        return false;
+    if (e->gz_length > 0 && !add_response("Vary:Accept-Encoding\r\n"))
+        return false;
+    if (gz && !add_response("Content-Encoding:gzip\r\n"))
+        return false;
+    if (!add_headers(length))
+        return false;
+    bytes_to_send = m_write_idx + length;
+    return true;
+}
+
+// 先发送 m_write_buf 中的响应头，再从资源包 sendfile 文件内容，结束后的处理与 write() 相同
+bool http_conn::bundle_write()
+{
+    int budget = IO_BUDGET;
+    while (bytes_to_send > 0)
+    {
+        // 本次发送已用完预算，重新注册写事件，排到其它就绪连接之后
+        if (budget <= 0)
+        {
+            modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+            return true;
+        }
+        int ret;
+        if (bytes_have_send < m_write_idx)
+            ret = send(m_sockfd, m_write_buf + bytes_have_send, m_write_idx - bytes_have_send, MSG_NOSIGNAL | MSG_MORE);
+        else
+            ret = sendfile(m_sockfd, m_bundle->fd(), &m_send_offset, bytes_to_send);
+        if (ret < 0)
+        {
+            if (errno == EAGAIN)
+            {
+                modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+                return true;
+            }
+            return false;
+        }
+        bytes_have_send += ret;
+        bytes_to_send -= ret;
+        budget -= ret;
+        progress(ret);
+    }
+
+    bundle_release();
+    modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+    if (m_linger)
+    {
+        init();
+        return true;
+    }
+    return false;
+}
+
+// 释放资源包的引用
+void http_conn::bundle_release()
+{
+    if (m_bundle)
+    {
+        m_bundle->release();
+        m_bundle = NULL;
+    }
+}
+
 // 取消内存映射操作
 void http_conn::unmap()
 {
@@ -601,13 +1939,27 @@ void http_conn::unmap()
     }
 }
 
+// 代理请求交给 proxy_write() 转发上游响应
 // 若bytes_to_send为0，则改变 m_sockfd 为监听读事件，重新init
 // 在while循环里不断向套接字写入数据
 //     若发送完成，改变 m_sockfd 为监听读事件，m_linger 为真则重新init
 //     若缓冲区空间不够，则改变 m_sockfd 为监听写事件，等待套接字可写
+//     若本次已发送 IO_BUDGET 字节，同样改为监听写事件，让其它连接先发送
 bool http_conn::write()
 {
     int temp = 0;
+    int budget = IO_BUDGET;
+
+    if (m_proxy_fd != -1)
+        return m_proxy_fcgi ? fastcgi_write() : proxy_write();
+#ifdef ASYNC_SQL
+    if (m_sql_status)
+        return sql_write();
+#endif
+    if (m_batch_state.load(std::memory_order_acquire) != BATCH_NONE)
+        return batch_write();
+    if (m_bundle)
+        return bundle_write();
 
     if (bytes_to_send == 0)
     {
@@ -634,10 +1986,12 @@ bool http_conn::write()
 
         bytes_have_send += temp;
         bytes_to_send -= temp;
+        budget -= temp;
+        progress(temp);
         if (bytes_have_send >= m_iv[0].iov_len)
         {
             m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
+            m_iv[1].iov_base = m_body_address + (bytes_have_send - m_write_idx);
             m_iv[1].iov_len = bytes_to_send;
         }
         else
@@ -661,6 +2015,13 @@ bool http_conn::write()
                 return false;
             }
         }
+
+        // 本次发送已用完预算，重新注册写事件，排到其它就绪连接之后
+        if (budget <= 0)
+        {
+            modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+            return true;
+        }
     }
 }
 
@@ -694,7 +2055,7 @@ bool http_conn::add_status_line(int status, const char *title)
 // 缓冲区添加 Content-Length、Connection 和 回车换行
 bool http_conn::add_headers(int content_len)
 {
-    return add_content_length(content_len) && add_linger() &&
+    return add_content_length(content_len) && add_linger() && add_session_cookie() &&
            add_blank_line();
 }
 
@@ -716,6 +2077,15 @@ bool http_conn::add_linger()
     return add_response("Connection:%s\r\n", (m_linger == true) ? "keep-alive" : "close");
 }
 
+// 缓冲区添加 Set-Cookie 字段，只在登录成功的响应中出现
+bool http_conn::add_session_cookie()
+{
+    if (!m_set_cookie[0])
+        return true;
+    return add_response("Set-Cookie:%s=%s; Max-Age=%d; Path=/; HttpOnly; SameSite=Lax\r\n",
+                        SESSION_COOKIE, m_set_cookie, session_store::get_instance()->ttl());
+}
+
 // 缓冲区添加回车换行
 bool http_conn::add_blank_line()
 {
@@ -730,7 +2100,8 @@ bool http_conn::add_content(const char *content)
 
 // 根据传入的 HTTP_CODE，组成HTTP数据包
 // m_write_buf和m_iv[0]存放HTTP的头部
-// m_file_address和m_iv[1]存放映射的HTML文件数据
+// m_file_address和m_iv[1]存放映射的HTML文件数据，FastCGI请求的 m_iv[1] 为应用进程的输出
+// 处理函数请求的 m_iv[0] 为空，m_iv[1] 为写入器中剩余的数据
 // 仅当正确返回HTML文件时，返回TRUE
 bool http_conn::process_write(HTTP_CODE ret)
 {
@@ -754,6 +2125,25 @@ bool http_conn::process_write(HTTP_CODE ret)
             return false;
         break;
     }
+    // 数据库熔断，告知客户端稍后重试
+    case SERVICE_UNAVAILABLE:
+    {
+        add_status_line(503, error_503_title);
+        add_response("Retry-After:%d\r\n", m_backend->retry_after());
+        add_headers(strlen(error_503_form));
+        if (!add_content(error_503_form))
+            return false;
+        break;
+    }
+    // 上游不可用
+    case BAD_GATEWAY:
+    {
+        add_status_line(502, error_502_title);
+        add_headers(strlen(error_502_form));
+        if (!add_content(error_502_form))
+            return false;
+        break;
+    }
     // 服务器理解了客户端的请求，但是拒绝执行
     case FORBIDDEN_REQUEST:
     {
@@ -763,6 +2153,61 @@ bool http_conn::process_write(HTTP_CODE ret)
             return false;
         break;
     }
+    // 上传完成
+    case CREATED_REQUEST:
+    {
+        add_status_line(201, ok_201_title);
+        add_headers(strlen(ok_201_form));
+        if (!add_content(ok_201_form))
+            return false;
+        break;
+    }
+    // 上传没有长度，请求体的边界未知，发送完后关闭连接
+    case LENGTH_REQUIRED:
+    {
+        m_linger = false;
+        add_status_line(411, error_411_title);
+        add_headers(strlen(error_411_form));
+        if (!add_content(error_411_form))
+            return false;
+        break;
+    }
+    // 请求体过大，剩余的请求体不再读取，发送完后关闭连接
+    case ENTITY_TOO_LARGE:
+    {
+        m_linger = false;
+        add_status_line(413, error_413_title);
+        add_headers(strlen(error_413_form));
+        if (!add_content(error_413_form))
+            return false;
+        break;
+    }
+    // 资源包中的文件，响应头由 m_iv[0] 给出，内容在 write() 中 sendfile
+    case BUNDLE_REQUEST:
+    {
+        if (!add_bundle_response())
+            return false;
+        if (m_bundle)
+        {
+            m_iv[0].iov_base = m_write_buf;
+            m_iv[0].iov_len = m_write_idx;
+            m_iv_count = 1;
+            return true;
+        }
+        break;
+    }
+    // 处理函数的剩余输出，状态行和首部由写入器生成
+    case HANDLER_REQUEST:
+    {
+        m_iv[0].iov_base = m_write_buf;
+        m_iv[0].iov_len = 0;
+        m_body_address = (char *)m_writer->pending();
+        m_iv[1].iov_base = m_body_address;
+        m_iv[1].iov_len = m_writer->pending_size();
+        m_iv_count = 2;
+        bytes_to_send = m_writer->pending_size();
+        return true;
+    }
     case FILE_REQUEST:
     {
         // 服务器收到正确的响应，将HTML文件作为HTTP的实体主体，写入到发送缓冲区
@@ -772,7 +2217,8 @@ bool http_conn::process_write(HTTP_CODE ret)
             add_headers(m_file_stat.st_size);
             m_iv[0].iov_base = m_write_buf;
             m_iv[0].iov_len = m_write_idx;
-            m_iv[1].iov_base = m_file_address;
+            m_body_address = m_file_address;
+            m_iv[1].iov_base = m_body_address;
             m_iv[1].iov_len = m_file_stat.st_size;
             m_iv_count = 2;
             bytes_to_send = m_write_idx + m_file_stat.st_size;
@@ -815,7 +2261,33 @@ void http_conn::process()
         modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
         return;
     }
+    // 请求已交给上游或应用进程，等其连接可写或可读后在 write() 中继续发送请求或转发响应
+    // 注册上游连接必须是最后一步，之后该连接可能立刻被主线程处理
+    if (read_ret == PROXY_REQUEST)
+    {
+        proxy_wait();
+        return;
+    }
+    // 注册交给写入线程，批次写完后由写入线程注册 m_sockfd 的写事件，在 write() 中发送结果
+    // 提交必须是最后一步，之后该连接可能立刻被主线程处理
+    if (read_ret == BATCH_REQUEST)
+    {
+        m_batch_state.store(BATCH_WAIT, std::memory_order_relaxed);
+        user_writer::get_instance()->submit(m_sql_name, m_sql_passwd, batch_done, this);
+        return;
+    }
+#ifdef ASYNC_SQL
+    // 注册的INSERT正在执行，等数据库连接就绪后在 write() 中继续
+    if (read_ret == SQL_REQUEST)
+    {
+        sql_wait();
+        return;
+    }
+#endif
     // 根据传入的 HTTP_CODE，组成HTTP数据包
+    // 出错的请求没有经过 do_request()，在这里进入发送响应阶段
+    if (m_phase.load(std::memory_order_relaxed) != PHASE_SEND)
+        set_phase(PHASE_SEND);
     bool write_ret = process_write(read_ret);
     if (!write_ret)
     {
@@ -19,12 +19,46 @@
 #include <errno.h>
 #include <sys/wait.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
 #include <map>
+#include <vector>
+#include <atomic>
 
 #include "../lock/locker.h"
 #include "../CGImysql/sql_connection_pool.h"
 #include "../timer/lst_timer.h"
 #include "../log/log.h"
+#include "../proxy/upstream.h"
+#include "../proxy/fastcgi.h"
+#include "../handler/handler.h"
+#include "../bundle/bundle.h"
+#include "../user/user_table.h"
+#include "../user/user_writer.h"
+#include "../user/mysql_backend.h"
+#include "../session/session.h"
+
+// 路由类型
+enum ROUTE_TYPE
+{
+    ROUTE_STATIC = 0, // 静态文件，由 do_request() 按URL映射
+    ROUTE_UPLOAD,     // 上传，请求体经 splice() 直接落盘
+    ROUTE_PROXY,      // 反向代理，转发给上游服务器组
+    ROUTE_FASTCGI,    // FastCGI，交给应用进程处理
+    ROUTE_HANDLER     // 进程内的处理函数
+};
+
+// 路由表项，按URL前缀匹配
+struct route_entry
+{
+    string prefix;   // URL前缀
+    int type;        // ROUTE_TYPE
+    string target;   // 上传路由为保存目录，代理和FastCGI路由为后端列表
+    long long limit; // 请求体大小上限(字节)
+    upstream *up;    // 代理和FastCGI路由的上游服务器组
+    http_handler *handler; // 处理函数路由的处理函数
+};
 
 class http_conn
 {
@@ -44,11 +78,16 @@ public:
         CONNECT,
         PATH
     };
+    static const int UPLOAD_CHUNK = 65536;      // 每次splice搬运的最大字节数
+    static const int IO_BUDGET = 262144;        // 每个读写事件最多搬运的字节数，用完后重新注册事件，让其它连接先处理
+    static const int PROXY_BUFFER_SIZE = 8192;  // 代理请求及上游响应头的缓冲区大小
+    static const uint64_t AUX_EVENT = 1ULL << 32; // 辅助fd在epoll中的data.u64带此标志，低32位为所属连接的m_sockfd
     enum CHECK_STATE
     {
         CHECK_STATE_REQUESTLINE = 0, // 解析请求行
         CHECK_STATE_HEADER,          // 解析首部行
-        CHECK_STATE_CONTENT          // 解析实体主体
+        CHECK_STATE_CONTENT,         // 解析实体主体
+        CHECK_STATE_UPLOAD           // 实体主体直接写入上传文件
     };
     enum HTTP_CODE
     {
@@ -59,7 +98,40 @@ public:
         FORBIDDEN_REQUEST, // 请求被禁止（没有读权限）
         FILE_REQUEST,      // 成功的请求到了文件
         INTERNAL_ERROR,    // 意外错误（无法正确解析HTTP文件）
-        CLOSED_CONNECTION
+        CLOSED_CONNECTION,
+        CREATED_REQUEST,   // 上传完成，文件已就位
+        ENTITY_TOO_LARGE,  // 请求体超过路由的大小上限
+        PROXY_REQUEST,     // 请求已转发给上游或应用进程，等待响应
+        BAD_GATEWAY,       // 没有可用的上游或上游响应错误
+        HANDLER_REQUEST,   // 处理函数已处理完请求，剩余输出在 m_writer 中
+        BUNDLE_REQUEST,    // 请求的文件在资源包中，由 sendfile 发送
+        SQL_REQUEST,       // 注册的INSERT已非阻塞地发出，等待数据库返回
+        BATCH_REQUEST,     // 注册交给写入线程，等待所在批次写完
+        SERVICE_UNAVAILABLE, // 数据库熔断，注册直接拒绝，稍后重试
+        LENGTH_REQUIRED      // 上传没有给出非0的 Content-Length，不创建文件
+    };
+    enum PROXY_STATE
+    {
+        PROXY_CONNECT = 0,  // 等待与上游的连接建立
+        PROXY_SEND_REQUEST, // 向上游发送请求
+        PROXY_HEAD,      // 读取上游响应头
+        PROXY_SEND_HEAD, // 向客户端发送改写后的响应头
+        PROXY_BODY       // 上游 -> 管道 -> 客户端 转发响应体
+    };
+    enum CONN_PHASE
+    {
+        PHASE_HEAD = 0, // 接收请求头，从连接建立或收到请求的第一个字节算起
+        PHASE_BODY,     // 接收请求体
+        PHASE_SEND,     // 处理请求并发送响应
+        PHASE_IDLE,     // keep-alive 连接等待下一个请求
+        PHASE_COUNT
+    };
+    enum BATCH_STATE
+    {
+        BATCH_NONE = 0, // 没有交给写入线程的注册
+        BATCH_WAIT,     // 等待所在批次写完
+        BATCH_OK,       // 写入成功
+        BATCH_FAIL      // 写入失败
     };
     enum LINE_STATUS
     {
@@ -69,7 +141,10 @@ public:
     };
 
 public:
-    http_conn() {}
+    http_conn() : m_inflight(0), m_route(NULL), m_upload_fd(-1), m_upload_left(0), m_proxy_fd(-1), m_proxy_buf(NULL), m_fcgi(NULL), m_writer(NULL), m_bundle(NULL), m_sql_status(0), m_batch_state(BATCH_NONE)
+    {
+        m_pipe[0] = m_pipe[1] = -1;
+    }
     ~http_conn() {}
 
 public:
@@ -80,6 +155,7 @@ public:
 
     // 若 real_close = true, 则关闭 m_sockfd
     // 并从m_epollfd中移除, m_user_count减1
+    // 释放上传、代理占用的文件、管道和上游连接
     void close_conn(bool real_close = true);
 
     // 从接收缓冲区读取数据，解析HTTP
@@ -90,8 +166,9 @@ public:
     // 读取网络数据，LT模式下只读取一次，ET模式下使用while循环读取
     bool read_once();
 
+    // 代理请求交给 proxy_write() 或 fastcgi_write() 转发响应，进行中的数据库查询交给 sql_write() 继续，资源包中的文件交给 bundle_write() 发送
     // bytes_to_send为0，则将 m_sockfd 设置为 EPOLLIN ，调用init函数，返回
-    // 否则调用 writev 持续发送数据，直到发送完成
+    // 否则调用 writev 持续发送数据，直到发送完成或本次发送了 IO_BUDGET 字节
     bool write();
 
     sockaddr_in *get_address()
@@ -99,9 +176,24 @@ public:
         return &m_address;
     }
 
-    // 从传入的connection_pool中运行 SELECT username,passwd FROM user
-    // 将用户名-密码对放到user中
-    void initmysql_result(connection_pool *connPool);
+    // 保存用户数据后端，注册写入和熔断判断都经过后端
+    // connPool 为 MySQL 后端的连接池，其它后端为NULL，非阻塞的注册写入只用于 MySQL
+    static void init_backend(user_backend *backend, connection_pool *connPool);
+
+    // 添加一条路由，按添加顺序匹配URL前缀
+    static void add_route(const string &prefix, int type, const string &target, long long limit,
+                          upstream *up = NULL, http_handler *handler = NULL);
+
+    // 放弃未完成的上传，关闭管道和临时文件并删除临时文件
+    void abort_upload();
+
+    // 当前阶段的截止时间，由主线程的定时器调用
+    // fired 为 true 表示定时器已到期，发送阶段此时才查询内核发送队列，调整定时器时不查询
+    time_t deadline(bool fired = false);
+
+    // 连接是否已放入线程池、还没处理完，此时定时器不能关闭连接，否则工作线程会访问已释放的资源
+    bool in_flight() const { return m_inflight.load(std::memory_order_acquire) > 0; }
+
     int timer_flag; // 初始化为0
     int improv;     // 初始化为0
 
@@ -111,7 +203,7 @@ private:
     bool process_write(HTTP_CODE ret); // 根据传入的 HTTP_CODE，组成HTTP数据包
 
     // 解析http请求行
-    // 请求方法记录到 m_method 中(只处理 GET 和 POST)，如果出现过POST，cgi = 1
+    // 请求方法记录到 m_method 中(只处理 GET、POST 和 PUT)，如果出现过POST，cgi = 1
     // URL地址记录到 m_url 中，只保留'/'所在的位置，‘/’则改为 "/judge.html"
     // 版本信息记录到 m_version 中
     // 设置 m_check_state = CHECK_STATE_HEADER
@@ -120,6 +212,64 @@ private:
     HTTP_CODE parse_headers(char *text);      // 解析http请求的一个头部信息，获得是否保持连接、主机名、实体主体长度
     HTTP_CODE parse_content(char *text);      // 若http请求被完整读入，则将实体主体内容放入m_string中
     HTTP_CODE do_request();                   // 根据m_url将需要显示的文件路径放在 m_real_file 中，并映射到m_file_address处
+    HTTP_CODE do_file();                      // do_request() 的后半部分，按m_url映射文件
+
+    void set_phase(CONN_PHASE phase); // 进入新阶段，重新开始计时和统计传输字节数
+    void progress(long bytes);        // 本阶段传输了 bytes 字节
+    void next_round();                // 本轮速率统计已满一个超时周期且速率达标时，开始新一轮统计
+
+    const route_entry *match_route(); // 按前缀在 m_routes 中查找 m_url 对应的路由
+
+    // 请求头解析完后开始上传：创建临时文件和管道，写入已读入 m_read_buf 的部分请求体
+    // 请求体已完整时直接调用 finish_upload()
+    HTTP_CODE begin_upload();
+    bool splice_upload();       // 通过管道把 socket 中的请求体 splice 到临时文件
+    HTTP_CODE finish_upload();  // 请求体接收完毕，rename 临时文件到目标路径
+
+    bool open_pipe();  // 创建 splice 中转管道，已存在则直接返回
+    void close_pipe(); // 关闭中转管道，管道中可能残留数据时调用
+
+    // 从上游服务器组取一个连接，改写请求头后把请求转发给上游
+    HTTP_CODE do_proxy();
+    bool proxy_write();           // 转发上游响应，上游或客户端暂时不可读写时注册对应事件后返回true
+    int proxy_parse_head();       // 解析并改写上游响应头，未收完返回0，格式错误返回-1
+    HTTP_CODE proxy_start();      // 连接上游并尽量发出请求，没有可用的后端或发送失败返回 BAD_GATEWAY
+    bool proxy_connect();         // 从上游服务器组取一个连接，没有可用的后端返回false
+    int proxy_request();          // 继续建立连接和发送请求，发完返回1，需要等待返回0，失败返回-1
+    int proxy_send_request();     // 非阻塞地发送请求，发完返回1，发送缓冲区满返回0，出错返回-1
+    void proxy_wait();            // 在 m_epollfd 中注册上游连接所等待的事件，仅监听一次
+    bool proxy_fail();            // 上游出错：尚未发送任何数据时回复502，否则关闭连接
+    bool proxy_done();            // 响应转发完毕，归还上游连接
+    void proxy_release(bool reuse); // 从 m_epollfd 中移除上游连接并归还给上游服务器组
+    void proxy_abort();           // 放弃转发，关闭上游连接和中转管道
+
+    // 把请求交给应用进程，输出与反向代理相同在 write() 中转发
+    HTTP_CODE do_fastcgi();
+    void fastcgi_params();        // 按CGI/1.1规范生成 PARAMS
+    bool fastcgi_write();         // 边读边转发应用进程的输出，应用进程或客户端暂时不可读写时注册对应事件后返回true
+    int fastcgi_parse_head(bool end); // 解析应用进程输出的响应头，未收完返回0，格式错误或超出上限返回-1
+    bool fastcgi_forward(bool end);   // 已读到的输出追加到待发送数据，超过 fastcgi::MAX_RESPONSE 返回false
+    bool add_fastcgi_response(long long body_len); // 缓冲区添加应用进程的状态行和响应头，body_len 为-1时分块传输
+
+    // 调用路由的处理函数，处理函数可能已经发送了部分响应
+    HTTP_CODE do_handler();
+
+    bool find_bundle(const char *path); // 在当前资源包中查找文件，找到时持有资源包的引用
+    bool add_bundle_response();         // 缓冲区添加资源包文件的状态行和响应头，ETag匹配时为304
+    bool bundle_write();                // 先发送 m_write_buf 中的响应头，再从资源包 sendfile 文件内容
+    void bundle_release();              // 释放资源包的引用
+
+    static void batch_done(void *arg, bool ok); // 写入线程写完批次后的回调
+    bool batch_write();                         // 发送批量写入的注册结果
+
+#ifdef ASYNC_SQL
+    // 注册的INSERT使用 MariaDB 的非阻塞接口，数据库连接的 fd 加入 m_epollfd，工作线程不等待数据库
+    HTTP_CODE sql_start(const char *name, const char *password); // 取连接并发出注册的INSERT
+    void sql_wait();              // 在 m_epollfd 中注册数据库连接所等待的事件，仅监听一次
+    bool sql_write();             // 数据库连接就绪，继续查询，完成后发送响应
+    HTTP_CODE sql_finish(int err); // 查询完成，归还连接，提交或取消用户名占位
+    void sql_abort();             // 关闭连接时查询未完成，丢弃数据库连接
+#endif
 
     char *get_line() { return m_read_buf + m_start_line; }; // 返回当前行的首地址
     LINE_STATUS parse_line();                               // 从接收缓冲区中解析出一行数据，并将回车换行字符改为空
@@ -133,13 +283,20 @@ private:
     bool add_content_type();                             // 缓冲区添加 Content-Type:text/html
     bool add_content_length(int content_length);         // 缓冲区添加 Content-Length 字段
     bool add_linger();                                   // 缓冲区添加 Connection 字段
+    bool add_session_cookie();                           // 登录成功时缓冲区添加 Set-Cookie 字段
     bool add_blank_line();                               // 缓冲区添加回车换行
 
 public:
     static int m_epollfd;    // epoll对应的socket
     static int m_user_count; // 连接的用户数
-    MYSQL *mysql;            // 在initmysql_result()中在连接池中获取连接
+    static vector<route_entry> m_routes; // 路由表，由WebServer::route_table()初始化
+    static int m_timeouts[PHASE_COUNT];  // 各阶段的超时时间(秒)
+    static int m_min_rate;               // 接收请求体和发送响应的最低速率(字节/秒)，为0时不检查
+    static user_backend *m_backend;     // 用户数据后端
+    static connection_pool *m_connPool; // MySQL 后端的连接池，非阻塞写入时从中取连接，其它后端为NULL
+    MYSQL *mysql;            // 访问数据库时从 m_connPool 获取的连接，用完立即归还
     int m_state;             // 读为0, 写为1，初始化为0
+    std::atomic<int> m_inflight; // 已放入线程池、尚未处理完的任务数，线程池入队时加1，工作线程处理完后减1
 
 private:
     int m_sockfd;          // 由构造函数初始化，客户端对应的socket
@@ -162,9 +319,22 @@ private:
     bool m_linger;         // 链接是否需要释放
     long m_content_length; // 实体主体的长度
     char *m_host;          // 主机名
+    char *m_if_none_match; // If-None-Match 首部的值
+    bool m_accept_gzip;    // Accept-Encoding 中是否有gzip
+    char *m_session;       // Cookie 首部中会话令牌的值，指向 m_session_buf，没有令牌时为NULL
+    char m_session_buf[session_store::TOKEN_LEN + 1]; // 从 Cookie 首部复制的令牌，不修改 m_read_buf 中的首部行
+    char m_set_cookie[session_store::TOKEN_LEN + 1]; // 本次登录创建的会话令牌，为空时不下发
 
     CHECK_STATE m_check_state; // HTTP解析状态机的状态位
 
+    // 超时状态，工作线程和主线程都会更新，主线程的定时器读取
+    // set_phase() 最后以 release 写入 m_phase，读取时先以 acquire 读 m_phase，不会看到新阶段和旧的开始时间
+    std::atomic<int> m_phase;              // 当前阶段，CONN_PHASE
+    std::atomic<time_t> m_phase_start;     // 进入当前阶段的时间，请求体和发送阶段为本轮速率统计开始的时间
+    std::atomic<time_t> m_last_active;     // 当前阶段最后一次传输数据的时间
+    std::atomic<long long> m_phase_bytes;  // 本轮统计传输的字节数，发送阶段只统计客户端已确认的数据
+    std::atomic<long long> m_unsent;       // 发送阶段已写入内核、上次检查时还在发送队列中的字节数
+
     char *doc_root;                 // 文档的根目录
     char m_real_file[FILENAME_LEN]; // 相应的HTML文件目录
     struct stat m_file_stat;        // 获取对应URL的文件信息
@@ -177,6 +347,7 @@ private:
     int bytes_have_send;                 // 服务器已经发送的字节数
 
     struct iovec m_iv[2]; // 数据发送缓冲区
+    char *m_body_address; // m_iv[1] 的起始地址，为映射的文件或应用进程的输出
     int m_iv_count;       // 数据发送缓冲区数量
 
     map<string, string> m_users; // 类里面没用到
@@ -187,6 +358,60 @@ private:
     char sql_user[100];
     char sql_passwd[100];
     char sql_name[100];
+
+    const route_entry *m_route; // 当前请求匹配到的路由，未匹配为NULL
+
+    int m_pipe[2]; // splice 中转管道，上传和代理共用
+
+    // 上传状态
+    int m_upload_fd;                  // 临时文件
+    long long m_upload_left;          // 还需接收的请求体字节数
+    char m_upload_tmp[FILENAME_LEN];  // 临时文件路径
+    char m_upload_path[FILENAME_LEN]; // 目标文件路径
+
+    // 代理状态
+    int m_headers_idx;        // 请求首部行在 m_read_buf 中的起始位置
+    upstream *m_proxy_up;     // 所用的上游服务器组
+    int m_proxy_backend;      // 所用后端在上游服务器组中的下标
+    int m_proxy_fd;           // 上游连接
+    bool m_proxy_registered;  // 上游连接是否已加入 m_epollfd
+    int m_proxy_tries;        // 本次转发还可以新建连接的次数，连接建立失败时换下一个后端
+    PROXY_STATE m_proxy_state;
+    char *m_proxy_buf;        // 前半部分接收上游响应头，后半部分存放改写后待发送的数据，首次代理时分配
+    int m_proxy_idx;          // 已接收的上游响应字节数
+    char *m_proxy_out;        // 待发送数据的起始地址，先是发给上游的请求，之后是发给客户端的响应头
+    int m_proxy_out_len;      // 待发送数据的长度
+    int m_proxy_sent;         // 已发送的字节数
+    long long m_proxy_left;   // 剩余响应体字节数，-1表示由上游关闭连接界定；FastCGI 读到 END_REQUEST 前为-1，之后为0
+    long long m_proxy_piped;  // 管道中尚未发送给客户端的字节数
+    bool m_proxy_reuse;       // 转发完毕后上游连接能否复用
+    bool m_proxy_fcgi;        // 上游为 FastCGI 应用进程，由 fastcgi_write() 转发
+
+    // FastCGI状态
+    fastcgi *m_fcgi;          // 请求组装与响应读取，首次使用时分配
+    int m_fcgi_status;        // 响应状态码
+    char *m_fcgi_title;       // 响应状态短语
+    char *m_fcgi_head;        // 响应首部行，以'\0'分隔
+    char *m_fcgi_head_end;    // 响应首部行的结束位置
+    bool m_fcgi_chunked;      // 收完响应头时应用进程尚未结束，响应体以分块传输发给客户端
+    bool m_fcgi_no_body;      // 状态码不允许响应体(1xx、204、304)，应用进程的输出丢弃
+    long long m_fcgi_total;   // 已读到的响应体字节数
+
+    response_writer *m_writer; // 处理函数的响应写入器，响应发送完毕后在 init() 中释放
+
+    // 资源包状态
+    bundle *m_bundle;                   // 正在使用的资源包，响应发送完毕后在 init() 中释放
+    const bundle_entry *m_bundle_entry; // 请求的文件
+    off_t m_send_offset;                // 下一次 sendfile 的起始偏移
+
+    // 异步数据库查询和批量写入状态
+    int m_sql_status;        // 查询等待的事件 MYSQL_WAIT_*，为0表示没有进行中的查询
+    bool m_sql_registered;   // 数据库连接是否已加入 m_epollfd
+    char m_sql_name[100];    // 注册的用户名和密码，查询完成后提交到 user_table，批量写入时提交给写入线程
+    char m_sql_passwd[100];
+    MYSQL_STMT *m_sql_stmt;  // 进行中的预处理语句，参数绑定在 m_sql_name 和 m_sql_passwd 上
+    long long m_sql_begin;   // 查询开始的时间(毫秒)，完成后连同结果计入熔断器
+    std::atomic<int> m_batch_state; // BATCH_STATE，写入线程在批次写完后以 release 写入结果，读取时用 acquire
 };
 
 #endif
@@ -2,8 +2,12 @@
 #define LOCKER_H
 
 #include <exception>
+#include <atomic>
 #include <pthread.h>
 #include <semaphore.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 class sem
 {
@@ -134,4 +138,35 @@ private:
     //static pthread_mutex_t m_mutex;
     pthread_cond_t m_cond;
 };
+
+
+//单个线程的休眠和唤醒，基于 futex，不需要互斥锁
+//unpark() 留下一个许可，park() 有许可时消耗许可立即返回，没有时休眠到 unpark()
+//先 unpark() 后 park() 也不会丢失唤醒；多次 unpark() 只留一个许可，park() 返回后调用者需要重新检查条件
+class parker
+{
+public:
+    parker() : m_state(0) {}
+
+    //只能由所属线程调用
+    void park()
+    {
+        //1 -> 0：消耗许可；0 -> -1：休眠
+        if (m_state.fetch_sub(1, std::memory_order_acquire) == 1)
+            return;
+        while (m_state.load(std::memory_order_acquire) == -1)
+            syscall(SYS_futex, &m_state, FUTEX_WAIT_PRIVATE, -1, NULL, NULL, 0);
+        m_state.exchange(0, std::memory_order_acquire);
+    }
+
+    //任意线程调用，所属线程休眠时唤醒
+    void unpark()
+    {
+        if (m_state.exchange(1, std::memory_order_release) == -1)
+            syscall(SYS_futex, &m_state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+
+private:
+    std::atomic<int> m_state; //1 有许可，0 没有许可，-1 正在休眠
+};
 #endif
@@ -16,19 +16,38 @@ int main(int argc, char *argv[])
     //初始化server类
     server.init(config.PORT, user, passwd, databasename, config.LOGWrite, 
                 config.OPT_LINGER, config.TRIGMode,  config.sql_num,  config.thread_num, 
-                config.close_log, config.actor_model);
+                config.close_log, config.actor_model, config.upload_max,
+                config.proxy_pass, config.proxy_balance, config.fastcgi_pass,
+                config.handler_dir, config.bundle_path, config.timeouts,
+                config.reg_batch, config.sql_limits, config.user_cache,
+                config.sql_replicas, config.sessions, config.backend,
+                config.workers);
 
     // 使用 Log::get_instance() 初始化一个单例LOG对象
     // 使用 init() 初始化该LOG对象
     server.log_write();
 
-    // 初始化 m_connPool 数据库连接池
-    // 调用 http_conn::initmysql_result 初始化`用户名-密码对`全局变量
-    server.sql_pool();
+    // 创建用户数据后端，mysql 时初始化 m_connPool 数据库连接池
+    server.backend();
+
+    // 初始化用户缓存，按需开始后台预热
+    server.user_cache();
+
+    // 初始化登录会话
+    server.sessions();
+
+    // 开启注册的批量写入时启动写入线程
+    server.reg_batch();
 
     // 初始化 m_pool 线程池，每个线程创建worker成员函数
     server.thread_pool();
 
+    // 初始化 http_conn::m_routes 路由表
+    server.route_table();
+
+    // 设置各阶段的超时时间
+    server.deadlines();
+
     // 指定触发方式标志位
     server.trig_mode();
 
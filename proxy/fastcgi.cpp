@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include "fastcgi.h"
+
+// 写入一条记录：8字节记录头 + 数据 + 填充到8字节对齐
+void fastcgi::add_record(int type, const char *data, int len)
+{
+    int padding = (8 - len % 8) % 8;
+    char header[HEADER_LEN];
+    header[0] = VERSION_1;
+    header[1] = type;
+    header[2] = (REQUEST_ID >> 8) & 0xff;
+    header[3] = REQUEST_ID & 0xff;
+    header[4] = (len >> 8) & 0xff;
+    header[5] = len & 0xff;
+    header[6] = padding;
+    header[7] = 0;
+    m_out.append(header, HEADER_LEN);
+    m_out.append(data, len);
+    m_out.append(padding, '\0');
+}
+
+// 名值对的长度：小于128用1字节，否则用4字节且最高位为1
+void fastcgi::add_length(int len)
+{
+    if (len < 128)
+    {
+        m_params.push_back((char)len);
+        return;
+    }
+    m_params.push_back((char)(((len >> 24) & 0x7f) | 0x80));
+    m_params.push_back((char)((len >> 16) & 0xff));
+    m_params.push_back((char)((len >> 8) & 0xff));
+    m_params.push_back((char)(len & 0xff));
+}
+
+// BEGIN_REQUEST：响应者角色，带 KEEP_CONN 让应用进程保持连接
+void fastcgi::begin()
+{
+    m_out.clear();
+    m_params.clear();
+    m_in.clear();
+    m_stdout.clear();
+    m_client.clear();
+    m_stderr.clear();
+    m_app_status = 0;
+    m_protocol_status = 0;
+
+    char body[8] = {0, RESPONDER, KEEP_CONN, 0, 0, 0, 0, 0};
+    add_record(BEGIN_REQUEST, body, sizeof(body));
+}
+
+// 名值对先攒在 m_params 中，超过一条记录的容量时写出一条 PARAMS 记录
+void fastcgi::add_param(const char *name, const char *value)
+{
+    int name_len = strlen(name);
+    int value_len = strlen(value);
+    add_length(name_len);
+    add_length(value_len);
+    m_params.append(name, name_len);
+    m_params.append(value, value_len);
+
+    while (m_params.size() > (size_t)MAX_CONTENT)
+    {
+        add_record(PARAMS, m_params.data(), MAX_CONTENT);
+        m_params.erase(0, MAX_CONTENT);
+    }
+}
+
+void fastcgi::add_param(const char *name, long long value)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lld", value);
+    add_param(name, buf);
+}
+
+// 写出剩余的名值对，并以空的 PARAMS 记录结束
+void fastcgi::end_params()
+{
+    if (!m_params.empty())
+        add_record(PARAMS, m_params.data(), m_params.size());
+    m_params.clear();
+    add_record(PARAMS, NULL, 0);
+}
+
+// 请求体按记录容量切分为 STDIN 记录，len 为0时写入结束 STDIN 的空记录
+void fastcgi::add_stdin(const char *data, int len)
+{
+    if (len == 0)
+    {
+        add_record(STDIN, NULL, 0);
+        return;
+    }
+    while (len > 0)
+    {
+        int n = len > MAX_CONTENT ? MAX_CONTENT : len;
+        add_record(STDIN, data, n);
+        data += n;
+        len -= n;
+    }
+}
+
+// 释放较大的缓冲区
+void fastcgi::release()
+{
+    if (m_out.capacity() > (size_t)MAX_CONTENT)
+        string().swap(m_out);
+    if (m_in.capacity() > (size_t)MAX_CONTENT)
+        string().swap(m_in);
+    if (m_stdout.capacity() > (size_t)MAX_CONTENT)
+        string().swap(m_stdout);
+    if (m_client.capacity() > (size_t)MAX_CONTENT)
+        string().swap(m_client);
+}
+
+// 从 m_in 中拆出完整的记录
+// STDOUT 追加到 m_stdout，STDERR 追加到 m_stderr，END_REQUEST 记录应用状态
+// 读到 END_REQUEST 返回1，需要更多数据返回0，出错返回-1
+int fastcgi::parse_records()
+{
+    size_t pos = 0;
+    int ret = 0;
+    while (m_in.size() - pos >= (size_t)HEADER_LEN)
+    {
+        const unsigned char *header = (const unsigned char *)m_in.data() + pos;
+        int type = header[1];
+        int id = (header[2] << 8) | header[3];
+        int len = (header[4] << 8) | header[5];
+        int padding = header[6];
+        if (header[0] != VERSION_1)
+        {
+            ret = -1;
+            break;
+        }
+        if (m_in.size() - pos < (size_t)(HEADER_LEN + len + padding))
+            break;
+
+        const char *content = m_in.data() + pos + HEADER_LEN;
+        pos += HEADER_LEN + len + padding;
+        // 其它请求ID及管理记录与本次请求无关
+        if (id != REQUEST_ID)
+            continue;
+
+        if (STDOUT == type)
+            m_stdout.append(content, len);
+        else if (STDERR == type)
+        {
+            if (m_stderr.size() + len <= (size_t)MAX_CONTENT)
+                m_stderr.append(content, len);
+        }
+        else if (END_REQUEST == type)
+        {
+            if (len < 8)
+            {
+                ret = -1;
+                break;
+            }
+            const unsigned char *body = (const unsigned char *)content;
+            m_app_status = (body[0] << 24) | (body[1] << 16) | (body[2] << 8) | body[3];
+            m_protocol_status = body[4];
+            // END_REQUEST 之后不应再有数据，否则连接不能复用
+            ret = (pos == m_in.size() && 0 == m_protocol_status) ? 1 : -1;
+            break;
+        }
+    }
+    m_in.erase(0, pos);
+    return ret;
+}
+
+// 读取一次应用进程的响应，m_stdout 每次最多增加一次读取的数据和此前未收完的一条记录
+fastcgi::RECV_RESULT fastcgi::receive(int fd)
+{
+    char buf[8192];
+    int ret = recv(fd, buf, sizeof(buf), 0);
+    if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return RECV_AGAIN;
+    if (ret <= 0)
+        return RECV_ERROR;
+
+    m_in.append(buf, ret);
+    int parsed = parse_records();
+    if (parsed < 0)
+        return RECV_ERROR;
+    return parsed > 0 ? RECV_END : RECV_DATA;
+}
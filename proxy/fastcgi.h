@@ -0,0 +1,88 @@
+#ifndef FASTCGI_H
+#define FASTCGI_H
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <string>
+
+using namespace std;
+
+// FastCGI 协议的一次请求：按记录格式组装请求，并从应用进程的连接上读取、拆分响应记录
+// 连接由 upstream 管理，请求带 FCGI_KEEP_CONN，应用进程处理完后不关闭连接，可放回空闲连接池
+// 一个连接上同一时刻只有一个请求，请求ID固定为1
+// 响应不整体缓冲：每次 receive() 读到的 STDOUT 由 http_conn 取走转发给客户端，客户端发送缓冲区满时不再读取
+class fastcgi
+{
+public:
+    static const int VERSION_1 = 1;
+    static const int HEADER_LEN = 8;           // 记录头长度
+    static const int MAX_CONTENT = 65535;      // 一条记录最多携带的数据
+    static const int REQUEST_ID = 1;
+    static const int MAX_HEAD = 65536;         // 响应头的上限(字节)，收完响应头之前的输出都要缓冲
+    static const int MAX_RESPONSE = 16 << 20;  // 应用进程输出的上限(字节)
+
+    // 记录类型
+    enum RECORD_TYPE
+    {
+        BEGIN_REQUEST = 1,
+        ABORT_REQUEST,
+        END_REQUEST,
+        PARAMS,
+        STDIN,
+        STDOUT,
+        STDERR
+    };
+    static const int RESPONDER = 1; // BEGIN_REQUEST 中的角色
+    static const int KEEP_CONN = 1; // BEGIN_REQUEST 中的标志，请求结束后应用进程不关闭连接
+
+    // receive() 的结果
+    enum RECV_RESULT
+    {
+        RECV_ERROR = -1, // 连接关闭、出错或记录格式错误
+        RECV_AGAIN,      // 暂时没有数据，等连接可读
+        RECV_DATA,       // 读到了数据，m_stdout 中可能有新的输出
+        RECV_END         // 读到 END_REQUEST，连接上恰好没有多余的数据，可以复用
+    };
+
+public:
+    fastcgi() : m_app_status(0), m_protocol_status(0) {}
+
+    // 组装请求：BEGIN_REQUEST，随后是若干 PARAMS 和 STDIN 记录，各自以空记录结束
+    void begin();
+    void add_param(const char *name, const char *value);
+    void add_param(const char *name, long long value);
+    void end_params();
+    void add_stdin(const char *data, int len); // len 为0时写入结束 STDIN 的空记录
+
+    // 从非阻塞的 fd 读取一次应用进程的响应并拆分记录，STDOUT 数据追加到 m_stdout
+    RECV_RESULT receive(int fd);
+
+    // 释放较大的缓冲区，避免每个连接长期占用上一次响应的内存
+    void release();
+
+    const string &request() { return m_out; } // 组装好的请求，由 http_conn 非阻塞地发出
+    string &stdout_data() { return m_stdout; }
+    string &client_data() { return m_client; }
+    const string &stderr_data() { return m_stderr; }
+    int app_status() { return m_app_status; }
+
+private:
+    void add_record(int type, const char *data, int len);
+    void add_length(int len); // 名值对的长度：小于128用1字节，否则用4字节且最高位为1
+
+    // 从 m_in 中拆出完整的记录，读到 END_REQUEST 返回1，需要更多数据返回0，出错返回-1
+    int parse_records();
+
+    string m_out;     // 待发送的请求
+    string m_params;  // 尚未写成记录的名值对
+    string m_in;      // 尚未拆分的响应数据
+    string m_stdout;  // 应用进程尚未转发的输出
+    string m_client;  // 待发给客户端的响应头和响应体
+    string m_stderr;  // 应用进程的错误输出
+    int m_app_status;
+    int m_protocol_status;
+};
+
+#endif
@@ -0,0 +1,319 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include "upstream.h"
+
+upstream::upstream(int balance, int close_log)
+{
+    m_balance = balance;
+    m_next = 0;
+    m_started = false;
+    m_close_log = close_log;
+}
+
+// 关闭所有空闲连接
+upstream::~upstream()
+{
+    m_lock.lock();
+    for (size_t i = 0; i < m_backends.size(); ++i)
+    {
+        list<int>::iterator it;
+        for (it = m_backends[i].idle.begin(); it != m_backends[i].idle.end(); ++it)
+            close(*it);
+        m_backends[i].idle.clear();
+    }
+    m_lock.unlock();
+}
+
+// 解析后端地址，addr 形如 127.0.0.1:8080，主机名在此处解析一次
+// 以 unix: 开头的为本机的Unix域套接字路径
+bool upstream::parse_address(const string &addr, sockaddr_storage &address, socklen_t &addrlen)
+{
+    bzero(&address, sizeof(address));
+    if (addr.compare(0, 5, "unix:") == 0)
+    {
+        sockaddr_un *un = (sockaddr_un *)&address;
+        string path = addr.substr(5);
+        if (path.empty() || path.size() >= sizeof(un->sun_path))
+            return false;
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, path.c_str());
+        addrlen = sizeof(sockaddr_un);
+        return true;
+    }
+
+    size_t colon = addr.rfind(':');
+    if (colon == string::npos || colon == 0)
+        return false;
+
+    string host = addr.substr(0, colon);
+    int port = atoi(addr.c_str() + colon + 1);
+    if (port <= 0 || port > 65535)
+        return false;
+
+    sockaddr_in *in = (sockaddr_in *)&address;
+    in->sin_family = AF_INET;
+    in->sin_port = htons(port);
+    addrlen = sizeof(sockaddr_in);
+    if (inet_pton(AF_INET, host.c_str(), &in->sin_addr) != 1)
+    {
+        addrinfo hints, *res = NULL;
+        bzero(&hints, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host.c_str(), NULL, &hints, &res) != 0 || !res)
+            return false;
+        in->sin_addr = ((sockaddr_in *)res->ai_addr)->sin_addr;
+        freeaddrinfo(res);
+    }
+    return true;
+}
+
+// 添加后端
+bool upstream::add_backend(const string &addr)
+{
+    backend b;
+    if (!parse_address(addr, b.address, b.addrlen))
+        return false;
+    b.addr = addr;
+    b.alive = true;
+    b.fails = 0;
+    b.active = 0;
+
+    m_lock.lock();
+    m_backends.push_back(b);
+    m_lock.unlock();
+    return true;
+}
+
+// 启动健康检查线程
+void upstream::start()
+{
+    if (m_started || m_backends.empty())
+        return;
+    if (pthread_create(&m_tid, NULL, health_worker, this) == 0)
+    {
+        pthread_detach(m_tid);
+        m_started = true;
+    }
+}
+
+// 发起非阻塞connect，返回EINPROGRESS时 connecting 为true，由调用者等待连接可写
+// 不响应的TCP后端只重传 SYN_RETRIES 次SYN，避免等待中的连接挂起到内核默认的两分钟
+int upstream::connect_backend(const sockaddr_storage &address, socklen_t addrlen, bool &connecting)
+{
+    int fd = socket(address.ss_family, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    if (AF_INET == address.ss_family)
+    {
+        int retries = SYN_RETRIES;
+        setsockopt(fd, IPPROTO_TCP, TCP_SYNCNT, &retries, sizeof(retries));
+    }
+
+    connecting = false;
+    if (connect(fd, (sockaddr *)&address, addrlen) < 0)
+    {
+        if (errno != EINPROGRESS)
+        {
+            int err = errno;
+            close(fd);
+            errno = err;
+            return -1;
+        }
+        connecting = true;
+    }
+    return fd;
+}
+
+// 后端连续失败达到 MAX_FAILS 次时标记为不可用，调用前需持有 m_lock
+void upstream::add_fail(int index, int err)
+{
+    backend &b = m_backends[index];
+    --b.active;
+    if (++b.fails >= MAX_FAILS)
+        b.alive = false;
+    LOG_ERROR("upstream %s connect error:%d", b.addr.c_str(), err);
+}
+
+// 按均衡策略选择可用的后端，调用前需持有 m_lock
+// 轮询：从 m_next 开始找第一个可用的后端
+// 最少连接：选择 active 最小的可用后端
+int upstream::choose_backend()
+{
+    int n = m_backends.size();
+    int chosen = -1;
+    if (LEAST_CONN == m_balance)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            int k = (m_next + i) % n;
+            if (m_backends[k].alive && (chosen < 0 || m_backends[k].active < m_backends[chosen].active))
+                chosen = k;
+        }
+    }
+    else
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            int k = (m_next + i) % n;
+            if (m_backends[k].alive)
+            {
+                chosen = k;
+                break;
+            }
+        }
+    }
+    if (chosen >= 0)
+        m_next = chosen + 1;
+    return chosen;
+}
+
+// 按均衡策略选择一个可用的后端，优先复用其空闲连接，否则新建连接
+// 空闲连接可能已被后端关闭，取出时用 MSG_PEEK 检查一次
+// 新建连接不等待建立：connect 立即失败的计入失败次数并换下一个后端重试，只有一个后端时最多重试 MAX_FAILS 次；
+// 返回EINPROGRESS的连接由调用者等到可写后通过 connect_result() 报告结果
+int upstream::get_connection(int &index, bool &connecting)
+{
+    int tries = m_backends.size() * MAX_FAILS;
+    while (tries-- > 0)
+    {
+        m_lock.lock();
+        int k = choose_backend();
+        if (k < 0)
+        {
+            m_lock.unlock();
+            return -1;
+        }
+        backend &b = m_backends[k];
+        ++b.active;
+
+        while (!b.idle.empty())
+        {
+            int fd = b.idle.front();
+            b.idle.pop_front();
+
+            char c;
+            int ret = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+            if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                m_lock.unlock();
+                index = k;
+                connecting = false;
+                return fd;
+            }
+            close(fd);
+        }
+        sockaddr_storage address = b.address;
+        socklen_t addrlen = b.addrlen;
+        m_lock.unlock();
+
+        int fd = connect_backend(address, addrlen, connecting);
+        int err = errno;
+        m_lock.lock();
+        if (fd >= 0)
+        {
+            if (!connecting)
+                m_backends[k].fails = 0;
+            m_lock.unlock();
+            index = k;
+            return fd;
+        }
+        add_fail(k, err);
+        m_lock.unlock();
+    }
+    return -1;
+}
+
+// 新建连接的结果：成功清零失败次数，失败关闭fd并计入失败次数
+void upstream::connect_result(int index, int fd, int err)
+{
+    m_lock.lock();
+    if (0 == err)
+        m_backends[index].fails = 0;
+    else
+        add_fail(index, err);
+    m_lock.unlock();
+
+    if (err != 0)
+        close(fd);
+}
+
+// 归还连接，reuse 为true且空闲连接未满时放回空闲连接池，否则直接关闭
+// 能完整转发一次响应说明后端可用，即使期间被标记为不可用也一并恢复
+void upstream::release_connection(int index, int fd, bool reuse)
+{
+    m_lock.lock();
+    backend &b = m_backends[index];
+    --b.active;
+    if (reuse)
+    {
+        b.alive = true;
+        b.fails = 0;
+    }
+    if (reuse && b.idle.size() < MAX_IDLE)
+    {
+        b.idle.push_back(fd);
+        fd = -1;
+    }
+    m_lock.unlock();
+
+    if (fd >= 0)
+        close(fd);
+}
+
+void *upstream::health_worker(void *arg)
+{
+    upstream *up = (upstream *)arg;
+    while (true)
+    {
+        sleep(HEALTH_INTERVAL);
+        up->health_check();
+    }
+    return up;
+}
+
+// 对不可用的后端尝试建立连接，成功则恢复，并把该连接放入空闲连接池
+void upstream::health_check()
+{
+    for (size_t i = 0; i < m_backends.size(); ++i)
+    {
+        m_lock.lock();
+        bool alive = m_backends[i].alive;
+        sockaddr_storage address = m_backends[i].address;
+        socklen_t addrlen = m_backends[i].addrlen;
+        m_lock.unlock();
+        if (alive)
+            continue;
+
+        // 健康检查在后台线程中进行，可以等待连接建立
+        bool connecting;
+        int fd = connect_backend(address, addrlen, connecting);
+        if (fd < 0)
+            continue;
+        if (connecting)
+        {
+            pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if (poll(&pfd, 1, CONNECT_TIMEOUT) != 1 ||
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+            {
+                close(fd);
+                continue;
+            }
+        }
+
+        m_lock.lock();
+        m_backends[i].alive = true;
+        m_backends[i].fails = 0;
+        m_backends[i].idle.push_back(fd);
+        m_lock.unlock();
+        LOG_INFO("upstream %s is up", m_backends[i].addr.c_str());
+    }
+}
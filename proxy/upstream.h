@@ -0,0 +1,99 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <list>
+#include "../lock/locker.h"
+#include "../log/log.h"
+
+using namespace std;
+
+// 后端服务器
+struct backend
+{
+    string addr;              // host:port 或 unix:路径，用于日志
+    sockaddr_storage address; // 后端地址，TCP为 sockaddr_in，Unix域套接字为 sockaddr_un
+    socklen_t addrlen;        // 后端地址长度
+    bool alive;           // 是否可用，连续连接失败 MAX_FAILS 次后置为false，由健康检查恢复
+    int fails;            // 连续连接失败的次数，连接成功后清零
+    int active;           // 正在转发请求的连接数，最少连接均衡使用
+    list<int> idle;       // 空闲的keep-alive连接
+};
+
+// 反向代理的上游服务器组
+// 每个后端维护一个空闲连接池，转发完成且后端允许复用的连接放回池中
+// 后台线程每 HEALTH_INTERVAL 秒尝试连接不可用的后端，连接成功则恢复
+class upstream
+{
+public:
+    static const int MAX_IDLE = 32;          // 每个后端最多保留的空闲连接数
+    static const int CONNECT_TIMEOUT = 1000; // 健康检查线程等待连接建立的超时时间(ms)
+    static const int SYN_RETRIES = 1;        // 新建TCP连接的SYN重传次数，后端不响应时约3秒后连接失败
+    static const int HEALTH_INTERVAL = 2;    // 健康检查间隔(s)
+    static const int MAX_FAILS = 3;          // 连续失败多少次后标记为不可用
+
+    enum BALANCE
+    {
+        ROUND_ROBIN = 0, // 轮询
+        LEAST_CONN       // 最少连接
+    };
+
+    upstream(int balance, int close_log);
+    ~upstream();
+
+    // 添加后端，addr 形如 127.0.0.1:8080 或 unix:/tmp/app.sock，解析失败返回false
+    bool add_backend(const string &addr);
+
+    // 启动健康检查线程
+    void start();
+
+    // 按均衡策略选择一个可用的后端，优先复用其空闲连接，否则新建连接，不等待连接建立
+    // 成功返回非阻塞的连接fd，并将后端下标写入 index，连接尚未建立时 connecting 为true；没有可用后端返回-1
+    int get_connection(int &index, bool &connecting);
+
+    // 新建的连接可写后由调用者取得 SO_ERROR 交给此函数
+    // err 为0时清零后端的失败次数；否则关闭fd，计入失败次数，连接不再计入 active
+    void connect_result(int index, int fd, int err);
+
+    // 归还连接，reuse 为true时放回空闲连接池，否则直接关闭
+    void release_connection(int index, int fd, bool reuse);
+
+    int size() { return m_backends.size(); }
+
+private:
+    // 解析 host:port 或 unix:路径 形式的后端地址
+    static bool parse_address(const string &addr, sockaddr_storage &address, socklen_t &addrlen);
+
+    // 发起非阻塞connect，返回fd，连接尚未建立时 connecting 为true；立即失败返回-1
+    int connect_backend(const sockaddr_storage &address, socklen_t addrlen, bool &connecting);
+
+    // 后端连续失败达到 MAX_FAILS 次时标记为不可用，调用前需持有 m_lock
+    void add_fail(int index, int err);
+
+    // 按均衡策略选择可用的后端，调用前需持有 m_lock
+    int choose_backend();
+
+    // 健康检查线程
+    static void *health_worker(void *arg);
+    void health_check();
+
+    vector<backend> m_backends;
+    int m_balance;     // 均衡策略
+    unsigned m_next;   // 轮询的下一个后端
+    locker m_lock;     // 保护 m_backends
+    pthread_t m_tid;   // 健康检查线程
+    bool m_started;
+    int m_close_log;
+};
+
+#endif
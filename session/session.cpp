@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/random.h>
+#include "session.h"
+#include "../log/log.h"
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND                                                     \
+    do                                                               \
+    {                                                                \
+        v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32);     \
+        v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2;                       \
+        v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0;                       \
+        v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32);     \
+    } while (0)
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+static void to_hex(const unsigned char *data, size_t len, char *out)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        out[2 * i] = hex_digits[data[i] >> 4];
+        out[2 * i + 1] = hex_digits[data[i] & 0xf];
+    }
+}
+
+session_store::session_store() : m_ttl(0), m_capacity(1), m_close_log(0)
+{
+    m_key[0] = m_key[1] = 0;
+}
+
+// 密钥取自内核的随机数，取不到时不使用会话
+void session_store::init(int ttl, size_t capacity, int close_log)
+{
+    m_close_log = close_log;
+    m_capacity = capacity / SHARDS > 0 ? capacity / SHARDS : 1;
+    if (ttl <= 0)
+        return;
+    if (getrandom(m_key, sizeof(m_key), 0) != sizeof(m_key))
+    {
+        LOG_ERROR("%s", "getrandom for session key error, sessions disabled");
+        return;
+    }
+    m_ttl = ttl;
+}
+
+// SipHash-2-4，结果按小端序转为16位十六进制写入 out
+void session_store::sign(const char *id, size_t len, char *out) const
+{
+    uint64_t v0 = m_key[0] ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = m_key[1] ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = m_key[0] ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = m_key[1] ^ 0x7465646279746573ULL;
+    const unsigned char *p = (const unsigned char *)id;
+    size_t blocks = len / 8;
+
+    for (size_t i = 0; i < blocks; ++i, p += 8)
+    {
+        uint64_t m = 0;
+        for (int j = 0; j < 8; ++j)
+            m |= (uint64_t)p[j] << (8 * j);
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+
+    uint64_t b = (uint64_t)len << 56;
+    for (size_t j = 0; j < len % 8; ++j)
+        b |= (uint64_t)p[j] << (8 * j);
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+
+    uint64_t h = v0 ^ v1 ^ v2 ^ v3;
+    unsigned char mac[8];
+    for (int i = 0; i < 8; ++i)
+        mac[i] = (unsigned char)(h >> (8 * i));
+    to_hex(mac, sizeof(mac), out);
+}
+
+// 比较签名时不提前退出，耗时与第几位不同无关
+bool session_store::verify(const char *token) const
+{
+    const int id_len = ID_BYTES * 2;
+    if (strlen(token) != (size_t)TOKEN_LEN || token[id_len] != '.')
+        return false;
+    for (int i = 0; i < id_len; ++i)
+        if (hex_value(token[i]) < 0)
+            return false;
+
+    char expected[16];
+    sign(token, id_len, expected);
+
+    unsigned char diff = 0;
+    for (int i = 0; i < 16; ++i)
+        diff |= expected[i] ^ token[id_len + 1 + i];
+    return 0 == diff;
+}
+
+// ID是随机的，直接用前两位十六进制选择分片
+session_store::shard &session_store::shard_of(const char *id)
+{
+    return m_shards[(hex_value(id[0]) * 16 + hex_value(id[1])) % SHARDS];
+}
+
+bool session_store::create(const char *user, char *token)
+{
+    if (!enabled())
+        return false;
+
+    unsigned char raw[ID_BYTES];
+    if (getrandom(raw, sizeof(raw), 0) != sizeof(raw))
+        return false;
+    const int id_len = ID_BYTES * 2;
+    to_hex(raw, sizeof(raw), token);
+    token[id_len] = '.';
+    sign(token, id_len, token + id_len + 1);
+    token[TOKEN_LEN] = '\0';
+
+    session_record record;
+    record.id.assign(token, id_len);
+    record.user = user;
+    record.expire = time(NULL) + m_ttl;
+
+    shard &s = shard_of(token);
+    s.lock.lock();
+    s.order.push_back(record);
+    s.index[record.id] = --s.order.end();
+    // 超过容量时淘汰最早过期的会话
+    while (s.index.size() > m_capacity)
+    {
+        s.index.erase(s.order.front().id);
+        s.order.pop_front();
+    }
+    s.lock.unlock();
+    return true;
+}
+
+bool session_store::find(const char *token, string &user)
+{
+    if (!enabled() || !verify(token))
+        return false;
+
+    string id(token, ID_BYTES * 2);
+    time_t now = time(NULL);
+    bool found = false;
+    shard &s = shard_of(token);
+    s.lock.lock();
+    unordered_map<string, list<session_record>::iterator>::iterator it = s.index.find(id);
+    if (it != s.index.end() && it->second->expire > now)
+    {
+        it->second->expire = now + m_ttl;
+        s.order.splice(s.order.end(), s.order, it->second);
+        user = it->second->user;
+        found = true;
+    }
+    s.lock.unlock();
+    return found;
+}
+
+void session_store::remove(const char *token)
+{
+    if (!enabled() || !verify(token))
+        return;
+
+    string id(token, ID_BYTES * 2);
+    shard &s = shard_of(token);
+    s.lock.lock();
+    unordered_map<string, list<session_record>::iterator>::iterator it = s.index.find(id);
+    if (it != s.index.end())
+    {
+        s.order.erase(it->second);
+        s.index.erase(it);
+    }
+    s.lock.unlock();
+}
+
+// 每个分片只从头部检查到第一个未过期的会话
+void session_store::expire()
+{
+    if (!enabled())
+        return;
+
+    time_t now = time(NULL);
+    int removed = 0;
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        shard &s = m_shards[i];
+        s.lock.lock();
+        while (!s.order.empty() && s.order.front().expire <= now)
+        {
+            s.index.erase(s.order.front().id);
+            s.order.pop_front();
+            ++removed;
+        }
+        s.lock.unlock();
+    }
+    if (removed > 0)
+        LOG_INFO("expire %d sessions", removed);
+}
+
+size_t session_store::size()
+{
+    size_t total = 0;
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        m_shards[i].lock.lock();
+        total += m_shards[i].index.size();
+        m_shards[i].lock.unlock();
+    }
+    return total;
+}
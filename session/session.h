@@ -0,0 +1,79 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdint.h>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include "../lock/locker.h"
+
+using namespace std;
+
+// 会话ID为 ID_BYTES 个随机字节的十六进制，令牌为 ID.签名，签名为 SipHash-2-4(密钥, ID) 的十六进制
+#define SESSION_COOKIE "sid"
+
+// 一个登录会话
+struct session_record
+{
+    string id;
+    string user;
+    time_t expire; // 过期时间，每次使用后顺延 ttl 秒
+};
+
+// 登录会话，单例
+// 登录成功后创建会话，响应中通过 Set-Cookie 下发签名的令牌，之后的请求带上令牌即可识别用户，不再解析和校验用户名、密码
+// 令牌先用进程启动时生成的随机密钥验证签名，伪造的令牌不查表；签名正确再在分片的哈希表中查找，O(1)
+// 每个分片的链表按过期时间排序(ttl固定，使用后移到尾部)，定时器每次触发时从头部移除过期的会话，超过容量时也从头部淘汰
+// 会话只在内存中，进程重启后密钥变化，之前的令牌全部失效
+class session_store
+{
+public:
+    static const int SHARDS = 16;
+    static const int ID_BYTES = 16;
+    static const int TOKEN_LEN = ID_BYTES * 2 + 1 + 16; // ID.签名，不含结尾的'\0'
+
+    static session_store *get_instance()
+    {
+        static session_store instance;
+        return &instance;
+    }
+
+    // ttl 为会话空闲多少秒后过期，为0时不使用会话；capacity 为会话总数上限
+    void init(int ttl, size_t capacity, int close_log);
+    bool enabled() const { return m_ttl > 0; }
+    int ttl() const { return m_ttl; }
+
+    // 为用户创建会话，令牌写入 token，缓冲区至少 TOKEN_LEN + 1 字节
+    bool create(const char *user, char *token);
+    // 验证令牌，有效时 user 为会话的用户并顺延过期时间
+    bool find(const char *token, string &user);
+    void remove(const char *token); // 注销会话
+
+    void expire(); // 定时器触发时调用，移除过期的会话
+    size_t size(); // 会话数
+
+private:
+    session_store();
+    ~session_store() {}
+
+    struct shard
+    {
+        locker lock;
+        list<session_record> order; // 头部最早过期
+        unordered_map<string, list<session_record>::iterator> index;
+    };
+
+    void sign(const char *id, size_t len, char *out) const; // 计算签名，写入16个十六进制字符
+    bool verify(const char *token) const;                   // 检查令牌格式和签名
+    shard &shard_of(const char *id);
+
+    int m_ttl;
+    size_t m_capacity; // 每个分片的容量
+    uint64_t m_key[2]; // 签名密钥，启动时随机生成
+
+    shard m_shards[SHARDS];
+
+    int m_close_log;
+};
+
+#endif
@@ -0,0 +1,409 @@
+#!/usr/bin/env python3
+# 只用于测试的 MySQL 替身：实现 MySQL 客户端/服务器协议中连接池和注册、登录用到的部分，user 表在内存中
+# 可以注入固定延迟、随机抖动、错误和断开，在没有真实数据库时压测登录、注册路径，观察连接池竞争和工作线程阻塞
+# 用法：python3 fakedb.py [-P 端口] [-S unix socket] [-u 预置用户数] [-l 延迟毫秒] [-w 写延迟毫秒] [-j 抖动毫秒]
+#                         [-c 建立连接的延迟毫秒] [-e 错误比例] [-d 断开比例] [--lag 秒] [--stats 秒]
+import argparse
+import os
+import random
+import re
+import socketserver
+import struct
+import sys
+import threading
+import time
+
+# 能力标志，不支持 SSL、CLIENT_DEPRECATE_EOF 和查询属性，结果集使用EOF包结尾
+CLIENT_LONG_PASSWORD = 0x1
+CLIENT_FOUND_ROWS = 0x2
+CLIENT_LONG_FLAG = 0x4
+CLIENT_CONNECT_WITH_DB = 0x8
+CLIENT_PROTOCOL_41 = 0x200
+CLIENT_TRANSACTIONS = 0x2000
+CLIENT_SECURE_CONNECTION = 0x8000
+CLIENT_MULTI_RESULTS = 0x20000
+CLIENT_PS_MULTI_RESULTS = 0x40000
+CLIENT_PLUGIN_AUTH = 0x80000
+CLIENT_PLUGIN_AUTH_LENENC_DATA = 0x200000
+CAPABILITIES = (CLIENT_LONG_PASSWORD | CLIENT_FOUND_ROWS | CLIENT_LONG_FLAG | CLIENT_CONNECT_WITH_DB |
+                CLIENT_PROTOCOL_41 | CLIENT_TRANSACTIONS | CLIENT_SECURE_CONNECTION | CLIENT_MULTI_RESULTS |
+                CLIENT_PS_MULTI_RESULTS | CLIENT_PLUGIN_AUTH | CLIENT_PLUGIN_AUTH_LENENC_DATA)
+
+SERVER_STATUS_AUTOCOMMIT = 0x2
+CHARSET_UTF8 = 33
+
+COM_QUIT = 0x01
+COM_INIT_DB = 0x02
+COM_QUERY = 0x03
+COM_PING = 0x0e
+COM_STMT_PREPARE = 0x16
+COM_STMT_EXECUTE = 0x17
+COM_STMT_CLOSE = 0x19
+COM_STMT_RESET = 0x1a
+
+TYPE_LONG = 0x03
+TYPE_LONGLONG = 0x08
+TYPE_VAR_STRING = 0xfd
+
+SELECT_USER = re.compile(r"^\s*SELECT\s+passwd\s+FROM\s+user\s+WHERE\s+username\s*=\s*\?\s*$", re.I)
+INSERT_USER = re.compile(r"^\s*INSERT\s+INTO\s+user\s*\(\s*username\s*,\s*passwd\s*\)\s*VALUES", re.I)
+SCAN_USERS = re.compile(r"^\s*SELECT\s+username\s*,\s*passwd\s+FROM\s+user(?:\s+LIMIT\s+(\d+))?\s*$", re.I)
+SLAVE_STATUS = re.compile(r"^\s*SHOW\s+SLAVE\s+STATUS\s*$", re.I)
+LITERAL_ROW = re.compile(r"\(\s*'((?:[^'\\]|\\.)*)'\s*,\s*'((?:[^'\\]|\\.)*)'\s*\)")
+NO_RESULT = re.compile(r"^\s*(SET|USE|BEGIN|COMMIT|ROLLBACK|START)\b", re.I)
+
+
+class Store:
+    """内存中的 user 表和统计"""
+
+    def __init__(self, users):
+        self.lock = threading.Lock()
+        self.users = {}
+        for i in range(users):
+            self.users["user%d" % i] = "pass%d" % i
+        self.connections = 0
+        self.queries = 0
+        self.errors = 0
+
+    def find(self, name):
+        with self.lock:
+            return self.users.get(name)
+
+    def insert(self, rows):
+        """整条语句原子地写入，有重复的用户名时一行都不写，返回重复的用户名"""
+        with self.lock:
+            seen = set()
+            for name, _ in rows:
+                if name in self.users or name in seen:
+                    return name
+                seen.add(name)
+            for name, password in rows:
+                self.users[name] = password
+        return None
+
+    def scan(self, limit):
+        with self.lock:
+            items = list(self.users.items())
+        return items if limit is None else items[:limit]
+
+    def count(self, field, n=1):
+        with self.lock:
+            setattr(self, field, getattr(self, field) + n)
+
+
+def lenenc_int(n):
+    if n < 251:
+        return struct.pack("<B", n)
+    if n < 1 << 16:
+        return b"\xfc" + struct.pack("<H", n)
+    if n < 1 << 24:
+        return b"\xfd" + struct.pack("<I", n)[:3]
+    return b"\xfe" + struct.pack("<Q", n)
+
+
+def lenenc_str(s):
+    if isinstance(s, str):
+        s = s.encode()
+    return lenenc_int(len(s)) + s
+
+
+def read_lenenc_int(data, pos):
+    first = data[pos]
+    if first < 251:
+        return first, pos + 1
+    if first == 0xfc:
+        return struct.unpack_from("<H", data, pos + 1)[0], pos + 3
+    if first == 0xfd:
+        return struct.unpack_from("<I", data[pos + 1:pos + 4] + b"\0")[0], pos + 4
+    return struct.unpack_from("<Q", data, pos + 1)[0], pos + 9
+
+
+class Disconnect(Exception):
+    pass
+
+
+class Handler(socketserver.BaseRequestHandler):
+    """一个客户端连接，按请求逐条处理命令"""
+
+    def setup(self):
+        self.args = self.server.args
+        self.store = self.server.store
+        self.seq = 0
+        self.statements = {}  # id -> [sql, 参数个数, 参数类型]
+        self.next_statement = 1
+        self.buffer = b""
+
+    # ---------- 包的读写 ----------
+    def recv_exact(self, n):
+        while len(self.buffer) < n:
+            data = self.request.recv(65536)
+            if not data:
+                raise Disconnect()
+            self.buffer += data
+        data, self.buffer = self.buffer[:n], self.buffer[n:]
+        return data
+
+    def read_packet(self):
+        header = self.recv_exact(4)
+        length = header[0] | header[1] << 8 | header[2] << 16
+        self.seq = (header[3] + 1) & 0xff
+        return self.recv_exact(length)
+
+    def send(self, *payloads):
+        out = b""
+        for payload in payloads:
+            out += struct.pack("<I", len(payload))[:3] + struct.pack("<B", self.seq) + payload
+            self.seq = (self.seq + 1) & 0xff
+        self.request.sendall(out)
+
+    def ok(self, affected=0):
+        return b"\x00" + lenenc_int(affected) + lenenc_int(0) + struct.pack("<HH", SERVER_STATUS_AUTOCOMMIT, 0)
+
+    def eof(self):
+        return b"\xfe" + struct.pack("<HH", 0, SERVER_STATUS_AUTOCOMMIT)
+
+    def err(self, code, state, message):
+        self.store.count("errors")
+        return b"\xff" + struct.pack("<H", code) + b"#" + state.encode() + message.encode()
+
+    def column(self, name, type_code=TYPE_VAR_STRING, length=150):
+        return (lenenc_str("def") + lenenc_str("fakedb") + lenenc_str("user") + lenenc_str("user") +
+                lenenc_str(name) + lenenc_str(name) + b"\x0c" +
+                struct.pack("<HIBHB", CHARSET_UTF8, length, type_code, 0, 0) + b"\0\0")
+
+    # ---------- 连接 ----------
+    def handshake(self):
+        """不校验用户名和密码，收到握手响应后直接回复OK"""
+        scramble = os.urandom(20).replace(b"\0", b"\1")
+        payload = (b"\x0a" + b"5.7.29-fakedb\0" + struct.pack("<I", threading.get_ident() & 0xffffffff) +
+                   scramble[:8] + b"\0" + struct.pack("<H", CAPABILITIES & 0xffff) + struct.pack("<B", CHARSET_UTF8) +
+                   struct.pack("<H", SERVER_STATUS_AUTOCOMMIT) + struct.pack("<H", CAPABILITIES >> 16) +
+                   struct.pack("<B", 21) + b"\0" * 10 + scramble[8:] + b"\0" + b"mysql_native_password\0")
+        self.seq = 0
+        self.send(payload)
+        self.read_packet()
+        if self.args.connect_latency > 0:
+            time.sleep(self.args.connect_latency / 1000.0)
+        self.send(self.ok())
+
+    def handle(self):
+        self.store.count("connections")
+        try:
+            self.handshake()
+            while True:
+                packet = self.read_packet()
+                if not packet or packet[0] == COM_QUIT:
+                    break
+                self.command(packet)
+        except (Disconnect, ConnectionError):
+            pass
+        finally:
+            self.store.count("connections", -1)
+
+    # ---------- 命令 ----------
+    def inject(self, write):
+        """模拟数据库耗时和故障：断开连接时抛出 Disconnect，返回错误包或None"""
+        delay = self.args.write_latency if write else self.args.latency
+        if self.args.jitter > 0:
+            delay += random.uniform(0, self.args.jitter)
+        if delay > 0:
+            time.sleep(delay / 1000.0)
+        if self.args.drop_rate > 0 and random.random() < self.args.drop_rate:
+            self.request.close()
+            raise Disconnect()
+        if self.args.error_rate > 0 and random.random() < self.args.error_rate:
+            return self.err(1213, "40001", "Deadlock found when trying to get lock; try restarting transaction")
+        return None
+
+    def command(self, packet):
+        code = packet[0]
+        if code == COM_PING or code == COM_INIT_DB or code == COM_STMT_RESET:
+            self.send(self.ok())
+        elif code == COM_QUERY:
+            self.store.count("queries")
+            self.query(packet[1:].decode(errors="replace"))
+        elif code == COM_STMT_PREPARE:
+            self.prepare(packet[1:].decode(errors="replace"))
+        elif code == COM_STMT_EXECUTE:
+            self.store.count("queries")
+            self.execute(packet)
+        elif code == COM_STMT_CLOSE:
+            self.statements.pop(struct.unpack_from("<I", packet, 1)[0], None)
+        else:
+            self.send(self.err(1047, "08S01", "Unknown command"))
+
+    def query(self, sql):
+        if NO_RESULT.match(sql):
+            self.send(self.ok())
+            return
+        error = self.inject(INSERT_USER.match(sql) is not None)
+        if error:
+            self.send(error)
+        elif SLAVE_STATUS.match(sql):
+            self.slave_status()
+        elif SCAN_USERS.match(sql):
+            limit = SCAN_USERS.match(sql).group(1)
+            rows = self.store.scan(int(limit) if limit else None)
+            packets = [lenenc_int(2), self.column("username"), self.column("passwd"), self.eof()]
+            packets += [lenenc_str(name) + lenenc_str(password) for name, password in rows]
+            self.send(*(packets + [self.eof()]))
+        elif INSERT_USER.match(sql):
+            self.insert([(m.group(1), m.group(2)) for m in LITERAL_ROW.finditer(sql)])
+        else:
+            self.send(self.err(1064, "42000", "fakedb does not support: %s" % sql[:64]))
+
+    def slave_status(self):
+        """没有 --lag 时是没有配置复制的实例，返回空结果集"""
+        names = ["Slave_IO_State", "Seconds_Behind_Master", "Last_Error"]
+        packets = [lenenc_int(len(names))] + [self.column(n) for n in names] + [self.eof()]
+        if self.args.lag is not None:
+            lag = b"\xfb" if self.args.lag < 0 else lenenc_str(str(self.args.lag))
+            packets.append(lenenc_str("Waiting for master to send event") + lag + lenenc_str(""))
+        self.send(*(packets + [self.eof()]))
+
+    def insert(self, rows):
+        if not rows:
+            self.send(self.err(1064, "42000", "no rows"))
+            return
+        duplicate = self.store.insert(rows)
+        if duplicate is None:
+            self.send(self.ok(len(rows)))
+        else:
+            self.send(self.err(1062, "23000", "Duplicate entry '%s' for key 'PRIMARY'" % duplicate))
+
+    def prepare(self, sql):
+        if not (SELECT_USER.match(sql) or INSERT_USER.match(sql)):
+            self.send(self.err(1064, "42000", "fakedb cannot prepare: %s" % sql[:64]))
+            return
+        params = sql.count("?")
+        columns = 1 if SELECT_USER.match(sql) else 0
+        statement = self.next_statement
+        self.next_statement += 1
+        self.statements[statement] = [sql, params, [TYPE_VAR_STRING] * params]
+
+        packets = [b"\x00" + struct.pack("<IHHBH", statement, columns, params, 0, 0)]
+        if params:
+            packets += [self.column("?") for _ in range(params)] + [self.eof()]
+        if columns:
+            packets += [self.column("passwd"), self.eof()]
+        self.send(*packets)
+
+    def params(self, packet, statement):
+        """按二进制协议解出参数，类型只在 new_params_bound_flag 为1时发送"""
+        _, count, types = statement
+        pos = 1 + 4 + 1 + 4
+        if count == 0:
+            return []
+        null_bitmap = packet[pos:pos + (count + 7) // 8]
+        pos += (count + 7) // 8
+        bound = packet[pos]
+        pos += 1
+        if bound:
+            for i in range(count):
+                types[i] = packet[pos + 2 * i]
+            pos += 2 * count
+        values = []
+        for i in range(count):
+            if null_bitmap[i // 8] & (1 << (i % 8)):
+                values.append(None)
+            elif types[i] == TYPE_LONGLONG:
+                values.append(str(struct.unpack_from("<q", packet, pos)[0]))
+                pos += 8
+            elif types[i] == TYPE_LONG:
+                values.append(str(struct.unpack_from("<i", packet, pos)[0]))
+                pos += 4
+            else:
+                length, pos = read_lenenc_int(packet, pos)
+                values.append(packet[pos:pos + length].decode(errors="replace"))
+                pos += length
+        return values
+
+    def execute(self, packet):
+        statement = self.statements.get(struct.unpack_from("<I", packet, 1)[0])
+        if statement is None:
+            self.send(self.err(1243, "HY000", "Unknown prepared statement handler"))
+            return
+        values = self.params(packet, statement)
+        select = SELECT_USER.match(statement[0]) is not None
+        error = self.inject(not select)
+        if error:
+            self.send(error)
+        elif select:
+            password = self.store.find(values[0] or "")
+            packets = [lenenc_int(1), self.column("passwd"), self.eof()]
+            if password is not None:
+                packets.append(b"\x00" + b"\x00" + lenenc_str(password))  # 行头、NULL位图(1列+2位偏移)
+            self.send(*(packets + [self.eof()]))
+        else:
+            self.insert(list(zip(values[0::2], values[1::2])))
+
+
+class TCPServer(socketserver.ThreadingTCPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+    request_queue_size = 1024
+
+
+class UnixServer(socketserver.ThreadingUnixStreamServer):
+    daemon_threads = True
+    request_queue_size = 1024
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-P", "--port", type=int, default=3306, help="TCP端口，0为不监听")
+    parser.add_argument("-S", "--socket", default="", help="unix socket路径，连接 localhost 的客户端使用")
+    parser.add_argument("-u", "--users", type=int, default=0, help="预置用户 userN/passN 的个数")
+    parser.add_argument("-l", "--latency", type=float, default=0, help="每条查询的延迟(毫秒)")
+    parser.add_argument("-w", "--write-latency", type=float, default=None, help="每条INSERT的延迟(毫秒)，默认同 -l")
+    parser.add_argument("-j", "--jitter", type=float, default=0, help="在延迟上随机增加 0~jitter 毫秒")
+    parser.add_argument("-c", "--connect-latency", type=float, default=0, help="认证的延迟(毫秒)，模拟远程数据库建立连接的耗时")
+    parser.add_argument("-e", "--error-rate", type=float, default=0, help="返回死锁错误(1213)的比例")
+    parser.add_argument("-d", "--drop-rate", type=float, default=0, help="不回复直接断开连接的比例")
+    parser.add_argument("--lag", type=int, default=None, help="SHOW SLAVE STATUS 报告的复制延迟，-1为复制中断")
+    parser.add_argument("--stats", type=float, default=0, help="每隔这么多秒打印一次连接数和每秒查询数")
+    parser.add_argument("--seed", type=int, default=None, help="随机数种子，相同的种子注入相同的故障序列")
+    args = parser.parse_args()
+    if args.write_latency is None:
+        args.write_latency = args.latency
+    if args.seed is not None:
+        random.seed(args.seed)
+
+    store = Store(args.users)
+    servers = []
+    if args.port:
+        servers.append(TCPServer(("127.0.0.1", args.port), Handler))
+    if args.socket:
+        if os.path.exists(args.socket):
+            os.unlink(args.socket)
+        servers.append(UnixServer(args.socket, Handler))
+    if not servers:
+        parser.error("nothing to listen on")
+    for server in servers:
+        server.args = args
+        server.store = store
+        threading.Thread(target=server.serve_forever, daemon=True).start()
+    print("fakedb listening on port %d socket %s, %d users" % (args.port, args.socket or "-", args.users))
+    sys.stdout.flush()
+
+    last = 0
+    try:
+        while True:
+            time.sleep(args.stats if args.stats > 0 else 3600)
+            if args.stats > 0:
+                queries = store.queries
+                print("connections %d, %.0f queries/s, errors %d" % (
+                    store.connections, (queries - last) / args.stats, store.errors))
+                sys.stdout.flush()
+                last = queries
+    except KeyboardInterrupt:
+        pass
+    finally:
+        for server in servers:
+            server.shutdown()
+        if args.socket and os.path.exists(args.socket):
+            os.unlink(args.socket)
+
+
+if __name__ == "__main__":
+    main()
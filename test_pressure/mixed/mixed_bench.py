@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+# 大小请求混合压测：若干连接持续下载大文件，同时测量小页面请求的延迟分布
+# 用法：python3 mixed_bench.py [-H host] [-p port] [-L 大文件路径] [-S 小页面路径] [-l 下载连接数] [-s 小请求连接数] [-t 秒]
+import argparse
+import socket
+import threading
+import time
+
+
+def read_response(sock, buf):
+    """读取一个响应，响应体直接丢弃，返回状态行和多读到的数据"""
+    while b"\r\n\r\n" not in buf:
+        data = sock.recv(65536)
+        if not data:
+            raise IOError("connection closed")
+        buf += data
+    head, _, rest = buf.partition(b"\r\n\r\n")
+    length = 0
+    for line in head.split(b"\r\n"):
+        if line.lower().startswith(b"content-length:"):
+            length = int(line.split(b":", 1)[1])
+    left = length - len(rest)
+    if left <= 0:
+        return head.split(b"\r\n", 1)[0], rest[length:]
+    chunk = bytearray(1 << 20)
+    while left > 0:
+        n = sock.recv_into(chunk, min(left, len(chunk)))
+        if n == 0:
+            raise IOError("connection closed")
+        left -= n
+    return head.split(b"\r\n", 1)[0], b""
+
+
+def client(args, path, deadline, latencies, counters, index):
+    request = ("GET %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n" % (path, args.host)).encode()
+    sock, buf = None, b""
+    while time.time() < deadline:
+        try:
+            if sock is None:
+                sock = socket.create_connection((args.host, args.port))
+                buf = b""
+            start = time.time()
+            sock.sendall(request)
+            status, buf = read_response(sock, buf)
+            if b" 200 " in status:
+                counters[index] += 1
+                if latencies is not None:
+                    latencies.append(time.time() - start)
+            else:
+                counters[2] += 1
+        except (IOError, OSError):
+            counters[2] += 1
+            if sock:
+                sock.close()
+            sock = None
+    if sock:
+        sock.close()
+
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100.0))] * 1000
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-H", "--host", default="127.0.0.1")
+    parser.add_argument("-p", "--port", type=int, default=9006)
+    parser.add_argument("-L", "--large", default="/test1.jpg")
+    parser.add_argument("-S", "--small", default="/judge.html")
+    parser.add_argument("-l", "--large-clients", type=int, default=8)
+    parser.add_argument("-s", "--small-clients", type=int, default=8)
+    parser.add_argument("-t", "--time", type=int, default=10)
+    args = parser.parse_args()
+
+    deadline = time.time() + args.time
+    latencies = []
+    counters = [0, 0, 0]  # 大文件完成数、小页面完成数、错误数
+    threads = []
+    for _ in range(args.large_clients):
+        threads.append(threading.Thread(target=client, args=(args, args.large, deadline, None, counters, 0)))
+    for _ in range(args.small_clients):
+        threads.append(threading.Thread(target=client, args=(args, args.small, deadline, latencies, counters, 1)))
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    print("large: %d responses, %.1f/s" % (counters[0], counters[0] / float(args.time)))
+    print("small: %d responses, %.1f/s, p50 %.2fms p99 %.2fms max %.2fms" % (
+        counters[1], counters[1] / float(args.time), percentile(latencies, 50), percentile(latencies, 99),
+        percentile(latencies, 100)))
+    print("errors: %d" % counters[2])
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,176 @@
+// 线程池请求队列的微基准：原来的 list + 互斥锁 + 信号量 与无锁环形队列 ring_queue 对比
+// 生产者(默认1个，对应主线程)不断入队，消费者(对应工作线程)取出后做少量计算，统计每秒出队数
+// 用法：./queue_bench [-p 生产者数] [-n 每个生产者入队数] [-q 队列容量] [-w 每个请求的计算量] [-t 最多消费者数]
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <list>
+#include <vector>
+#include <pthread.h>
+#include "../../lock/locker.h"
+#include "../../threadpool/ring_queue.h"
+
+// 改动前 threadpool 的请求队列
+class list_queue
+{
+public:
+    explicit list_queue(size_t capacity) : m_capacity(capacity) {}
+
+    bool push(int *request)
+    {
+        m_locker.lock();
+        if (m_queue.size() >= m_capacity)
+        {
+            m_locker.unlock();
+            return false;
+        }
+        m_queue.push_back(request);
+        m_locker.unlock();
+        m_stat.post();
+        return true;
+    }
+
+    void pop(int *&request)
+    {
+        while (true)
+        {
+            m_stat.wait();
+            m_locker.lock();
+            if (m_queue.empty())
+            {
+                m_locker.unlock();
+                continue;
+            }
+            request = m_queue.front();
+            m_queue.pop_front();
+            m_locker.unlock();
+            return;
+        }
+    }
+
+private:
+    size_t m_capacity;
+    std::list<int *> m_queue;
+    locker m_locker;
+    sem m_stat;
+};
+
+static long g_items = 1000000;
+static int g_producers = 1;
+static size_t g_capacity = 10000;
+static int g_work = 100;
+
+static int g_token = 0; // 入队的请求都指向它，NULL 通知消费者退出
+
+template <typename Q>
+struct bench
+{
+    Q *queue;
+    volatile unsigned long sink;
+
+    static void *produce(void *arg)
+    {
+        bench *b = (bench *)arg;
+        for (long i = 0; i < g_items; ++i)
+        {
+            // 队列满时服务器会丢弃请求，这里等待后重试，保证每轮的请求数相同
+            while (!b->queue->push(&g_token))
+                sched_yield();
+        }
+        return NULL;
+    }
+
+    static void *consume(void *arg)
+    {
+        bench *b = (bench *)arg;
+        unsigned long x = 0;
+        while (true)
+        {
+            int *request = NULL;
+            b->queue->pop(request);
+            if (!request)
+                break;
+            for (int i = 0; i < g_work; ++i)
+                x = x * 31 + i;
+        }
+        b->sink += x;
+        return NULL;
+    }
+
+    // 返回每秒出队的请求数
+    double run(int consumers)
+    {
+        Q q(g_capacity);
+        queue = &q;
+        sink = 0;
+        std::vector<pthread_t> threads(consumers + g_producers);
+
+        struct timeval begin, end;
+        gettimeofday(&begin, NULL);
+        for (int i = 0; i < consumers; ++i)
+            pthread_create(&threads[i], NULL, consume, this);
+        for (int i = 0; i < g_producers; ++i)
+            pthread_create(&threads[consumers + i], NULL, produce, this);
+        for (int i = 0; i < g_producers; ++i)
+            pthread_join(threads[consumers + i], NULL);
+        for (int i = 0; i < consumers; ++i)
+        {
+            while (!q.push(NULL))
+                sched_yield();
+        }
+        for (int i = 0; i < consumers; ++i)
+            pthread_join(threads[i], NULL);
+        gettimeofday(&end, NULL);
+
+        double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_usec - begin.tv_usec) / 1e6;
+        return g_items * g_producers / seconds;
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    int max_threads = 64;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:n:q:w:t:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            g_producers = atoi(optarg);
+            break;
+        case 'n':
+            g_items = atol(optarg);
+            break;
+        case 'q':
+            g_capacity = atol(optarg);
+            break;
+        case 'w':
+            g_work = atoi(optarg);
+            break;
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-p producers] [-n items] [-q capacity] [-w work] [-t max consumers]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (g_producers <= 0 || g_items <= 0 || g_capacity <= 0 || max_threads <= 0)
+        return 1;
+
+    printf("%d producer(s), %ld items each, capacity %zu, work %d, %ld cpus\n",
+           g_producers, g_items, g_capacity, g_work, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%10s %16s %16s %8s\n", "consumers", "list+mutex(/s)", "ring_queue(/s)", "speedup");
+    for (int threads = 1; threads <= max_threads; threads *= 2)
+    {
+        bench<list_queue> locked;
+        bench<ring_queue<int *> > ring;
+        double a = locked.run(threads);
+        double b = ring.run(threads);
+        printf("%10d %16.0f %16.0f %7.2fx\n", threads, a, b, b / a);
+        fflush(stdout);
+    }
+    return 0;
+}
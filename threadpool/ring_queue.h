@@ -0,0 +1,215 @@
+#ifndef RING_QUEUE_H
+#define RING_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// 有界多生产者多消费者环形队列(Vyukov)
+// 每个槽位带一个序号：序号等于位置时可写，等于位置+1时可读，入队和出队各用一次CAS抢占位置，不分配内存、不加锁
+// 队列满时 push() 立即返回false；pop() 先自旋 SPIN_COUNT 次(单核机器上不自旋)，仍为空时在 futex 上休眠，
+// push() 只在有消费者休眠时才进入内核唤醒，繁忙时入队和出队都不经过系统调用
+// 入队位置、出队位置和休眠计数各占一个缓存行，生产者和消费者之间不互相使缓存行失效
+// T 需要可以默认构造和赋值，线程池中为请求的指针
+template <typename T>
+class ring_queue
+{
+public:
+    static const int CACHE_LINE = 64;
+    static const int SPIN_COUNT = 256; // 休眠前尝试出队的次数
+
+    // 容量向上取2的幂
+    explicit ring_queue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        m_mask = size - 1;
+        m_spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_COUNT : 0;
+        m_buffer = new cell[size];
+        for (size_t i = 0; i < size; ++i)
+            m_buffer[i].seq.store(i, std::memory_order_relaxed);
+        m_enqueue.store(0, std::memory_order_relaxed);
+        m_dequeue.store(0, std::memory_order_relaxed);
+        m_sleepers.store(0, std::memory_order_relaxed);
+        m_epoch.store(0, std::memory_order_relaxed);
+    }
+
+    ~ring_queue()
+    {
+        delete[] m_buffer;
+    }
+
+    size_t capacity() const { return m_mask + 1; }
+
+    // 队列中的元素数，有并发入队和出队时只是近似值
+    size_t size() const
+    {
+        size_t dequeue = m_dequeue.load(std::memory_order_relaxed);
+        size_t enqueue = m_enqueue.load(std::memory_order_relaxed);
+        return enqueue > dequeue ? enqueue - dequeue : 0;
+    }
+
+    // 入队，队列满时返回false，有消费者休眠时唤醒一个
+    bool push(const T &value)
+    {
+        if (!try_push(value))
+            return false;
+        // 与 pop() 中登记休眠后的屏障配对：要么这里看到休眠的消费者，要么消费者看到新元素
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_sleepers.load(std::memory_order_relaxed) > 0)
+        {
+            m_epoch.fetch_add(1, std::memory_order_release);
+            futex(FUTEX_WAKE_PRIVATE, 1);
+        }
+        return true;
+    }
+
+    // 入队但不唤醒休眠的消费者，只用 try_pop() 取出、自行休眠和唤醒时使用，如线程池的各线程队列
+    bool try_push(const T &value)
+    {
+        size_t pos = m_enqueue.load(std::memory_order_relaxed);
+        cell *c;
+        while (true)
+        {
+            c = &m_buffer[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (0 == dif)
+            {
+                if (m_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (dif < 0)
+                return false;
+            else
+                pos = m_enqueue.load(std::memory_order_relaxed);
+        }
+        c->data = value;
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 不阻塞地出队，队列为空时返回false
+    bool try_pop(T &value)
+    {
+        size_t pos = m_dequeue.load(std::memory_order_relaxed);
+        cell *c;
+        while (true)
+        {
+            c = &m_buffer[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (0 == dif)
+            {
+                if (m_dequeue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (dif < 0)
+                return false;
+            else
+                pos = m_dequeue.load(std::memory_order_relaxed);
+        }
+        value = c->data;
+        c->seq.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 不阻塞地出队最多 max 个连续的元素，一次CAS占用全部位置，返回出队的个数，队列为空时返回0
+    size_t try_pop_bulk(T *values, size_t max)
+    {
+        size_t pos = m_dequeue.load(std::memory_order_relaxed);
+        size_t n;
+        while (true)
+        {
+            for (n = 0; n < max; ++n)
+            {
+                size_t seq = m_buffer[(pos + n) & m_mask].seq.load(std::memory_order_acquire);
+                if (seq != pos + n + 1)
+                    break;
+            }
+            if (0 == n)
+            {
+                intptr_t dif = (intptr_t)m_buffer[pos & m_mask].seq.load(std::memory_order_relaxed) - (intptr_t)(pos + 1);
+                if (dif < 0)
+                    return 0;
+                pos = m_dequeue.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (m_dequeue.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed))
+                break;
+        }
+        for (size_t i = 0; i < n; ++i)
+        {
+            cell *c = &m_buffer[(pos + i) & m_mask];
+            values[i] = c->data;
+            c->seq.store(pos + i + m_mask + 1, std::memory_order_release);
+        }
+        return n;
+    }
+
+    // 出队，队列为空时先自旋，再休眠到有元素入队
+    // 读取 m_epoch 后才登记休眠，其间入队的生产者会改变 m_epoch，FUTEX_WAIT 立即返回，不会错过唤醒
+    void pop(T &value)
+    {
+        for (int i = 0; i < m_spin; ++i)
+        {
+            if (try_pop(value))
+                return;
+            cpu_relax();
+        }
+        while (true)
+        {
+            int epoch = m_epoch.load(std::memory_order_acquire);
+            m_sleepers.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (try_pop(value))
+            {
+                m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+                return;
+            }
+            futex(FUTEX_WAIT_PRIVATE, epoch);
+            m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+            if (try_pop(value))
+                return;
+        }
+    }
+
+    // 自旋等待时调用，降低自旋对同一核心上另一个超线程的影响
+    static void cpu_relax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+private:
+    struct cell
+    {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    void futex(int op, int value)
+    {
+        syscall(SYS_futex, &m_epoch, op, value, NULL, NULL, 0);
+    }
+
+    // 构造后不再修改，生产者和消费者都只读
+    cell *m_buffer;
+    size_t m_mask;
+    int m_spin; // 休眠前自旋的次数，单核时生产者要等消费者让出CPU才能入队，自旋没有意义
+    char m_pad0[CACHE_LINE];
+    std::atomic<size_t> m_enqueue; // 下一个入队的位置，生产者修改
+    char m_pad1[CACHE_LINE - sizeof(size_t)];
+    std::atomic<size_t> m_dequeue; // 下一个出队的位置，消费者修改
+    char m_pad2[CACHE_LINE - sizeof(size_t)];
+    std::atomic<int> m_sleepers; // 在 futex 上休眠或准备休眠的消费者数
+    std::atomic<int> m_epoch;    // futex 字，每次唤醒加一
+    char m_pad3[CACHE_LINE - 2 * sizeof(int)];
+};
+
+#endif
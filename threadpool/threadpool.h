@@ -1,133 +1,502 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
-#include <list>
 #include <cstdio>
 #include <exception>
+#include <atomic>
+#include <stdint.h>
+#include <time.h>
 #include <pthread.h>
 #include "../lock/locker.h"
-#include "../CGImysql/sql_connection_pool.h"
+#include "../log/log.h"
+#include "ring_queue.h"
 
 template <typename T>
 class threadpool
 {
 public:
-    /*thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的、等待处理的请求的数量*/
+    /*thread_number是线程池中最少的线程数，max_requests是请求队列中最多允许的、等待处理的请求的数量，平分到各线程的队列*/
 
     // 1.初始化成员变量
     // 2.为 m_threads 动态分配线程
     // 3.pthread_create 创建线程运行worker成员函数，pthread_detach分离线程
-    threadpool(int actor_model, connection_pool *connPool, int thread_number = 8, int max_request = 10000);
+    // 4.max_threads 大于 thread_number 时启动控制线程，线程数在两者之间按排队时间伸缩
+    // 工作线程不持有数据库连接，需要访问数据库的请求在处理时自行从连接池获取
+    // target_wait 为请求排队时间的目标(毫秒)，idle_timeout 为多余线程的最长空闲时间(秒)
+    threadpool(int actor_model, int thread_number = 8, int max_request = 10000, int max_threads = 0,
+               int target_wait = 5, int idle_timeout = 30, int close_log = 0);
 
-    // 回收m_threads分配的线程空间
+    // 停止控制线程和所有工作线程，等它们都不再访问线程池后，回收m_threads分配的线程空间和各线程的请求队列
     ~threadpool();
 
-    // 将request 添加到 m_workqueue队列中
+    // 将request 添加到所属工作线程的队列中，所有队列都满时返回false
     // 设置 request->m_state = state;
+    // 只能由主线程调用，线程数的调整也在这里执行
     bool append(T *request, int state);
 
-    // 将request 添加到 m_workqueue队列中
+    // 将request 添加到所属工作线程的队列中，所有队列都满时返回false
     bool append_p(T *request);
 
+    // 将一轮 epoll_wait 得到的 count 个请求全部放入队列后，只唤醒需要的线程，返回放入的请求数
+    // 最多唤醒 count 个休眠的线程，已有线程在运行时不进入内核
+    int append_batch(T **requests, int count);
+
+    // 执行控制线程对线程数的决定，只能由主线程调用
+    // 放入请求时会先调用，没有请求时由定时器调用，使空闲的线程能够退出
+    void adjust();
+
 private:
+    static const int SPIN_COUNT = 64;        // 休眠前查找请求的次数
+    static const int BATCH_SIZE = 8;         // 从本线程队列一次最多取出的请求数
+    static const int CONTROL_INTERVAL = 100; // 控制线程检查排队时间的间隔(毫秒)
+    static const int REPORT_INTERVAL = 60;   // 记录统计信息的间隔(秒)
+
+    // 工作线程的状态，只有 RUNNING 的线程接收新的请求
+    enum WORKER_STATE
+    {
+        STOPPED = 0, // 线程未启动或已退出
+        RUNNING,
+        RETIRING // 已不再接收请求，处理完自己队列中的请求后退出
+    };
+
+    // 队列中的请求和入队时间(微秒)，出队时得到排队时间
+    struct task
+    {
+        T *request;
+        long long enqueued;
+    };
+
+    // 每个工作线程一个请求队列和休眠状态，各自占用单独的缓存行
+    struct worker_slot
+    {
+        threadpool *pool;
+        int index;
+        ring_queue<task> *queue;
+        parker waker;
+        std::atomic<int> idle;             // 1 表示已经或准备休眠，唤醒者置0后 unpark
+        std::atomic<int> state;            // WORKER_STATE
+        std::atomic<long long> idle_since; // 最近一次休眠的时间(微秒)
+        // 本线程取出的请求的排队时间，由控制线程读取后清零
+        std::atomic<long long> wait_sum;
+        std::atomic<long long> wait_count;
+        std::atomic<long long> wait_max;
+        char pad[64]; // 与相邻线程的 worker_slot 不共享缓存行
+    };
+
     /*工作线程运行的函数，它不断从工作队列中取出任务并执行之*/
 
-    // 传递的是this指针，实际上执行的是run()成员函数
+    // 传递的是线程的 worker_slot，实际上执行的是run()成员函数
     static void *worker(void *arg);
 
-    // 在while循环中，从请求队列中获取第一个任务，并进行处理
-    void run();
+    // 在while循环中，取得一个请求并进行处理，没有请求时休眠，状态为 RETIRING 时退出
+    void run(int index);
+    // 记录排队时间，处理一个请求
+    void handle(worker_slot *self, const task &t);
+
+    // 放入请求所属线程的队列，满时放入下一个线程的队列，返回放入的队列，都满时返回-1
+    int push(T *request, long long now);
+    // 先取本线程队列中的请求，为空时依次从其它线程的队列中窃取，返回取出的请求数
+    // 没有线程休眠时从本线程队列一次取出最多 BATCH_SIZE 个，有线程休眠时只取一个，其余留给被唤醒的线程窃取
+    int take(int index, task *tasks);
+    // 优先唤醒 index 号线程，它没有休眠时唤醒另一个休眠的线程来窃取，没有休眠的线程时返回false
+    bool wake(int index);
+
+    // 启动 index 号线程，成功返回true
+    bool start(int index);
+    // 主线程调用：执行控制线程的决定，增加一个线程或让最后一个线程退出
+    void resize(int decision);
+
+    static void *controller(void *arg);
+    void control();                            // 控制线程，每 CONTROL_INTERVAL 毫秒检查一次
+    int decide(long long now, long long &avg); // 按排队时间和空闲时间决定增加(1)、减少(-1)或不变(0)
+    void report();                             // 记录并清零统计信息
+
+    static long long now_us();
 
 private:
-    // 这五个成员变量在构造函数中初始化
-    int m_thread_number;         // 线程池中的线程数
+    // 这四个成员变量在构造函数中初始化
+    int m_thread_number;         // 线程池中最少的线程数
     int m_max_requests;          // 请求队列中允许的最大请求数
-    pthread_t *m_threads;        // 描述线程池的数组，其大小为m_thread_number
-    connection_pool *m_connPool; // 数据库连接池
+    pthread_t *m_threads;        // 描述线程池的数组，其大小为m_max_threads
     int m_actor_model;           // 模型切换标志
 
-    std::list<T *> m_workqueue; // 请求队列
-    locker m_queuelocker;       // 保护请求队列的互斥锁
-    sem m_queuestat;            // 是否有任务需要处理
+    // 各工作线程的请求队列，有界无锁环形队列，主线程入队，所属线程和窃取的线程出队
+    // 同一连接的请求放入同一个线程的队列，连接对象留在该线程所在核心的缓存中
+    worker_slot **m_slots;
+    std::atomic<int> m_idle; // 休眠的工作线程数，为0时放入请求不需要查找休眠的线程
+    int m_spin;              // 休眠前查找请求的次数，单核时为0
+
+    // 弹性线程数：m_slots[0, m_live) 的线程接收请求，只有主线程在 resize() 中修改 m_live
+    // 控制线程只做决定，放入 m_decision，由主线程在下一次放入请求时执行，放入请求和调整线程数不会交错
+    int m_max_threads;             // 最多的线程数
+    std::atomic<int> m_live;       // 接收请求的线程数
+    std::atomic<int> m_decision;   // 控制线程的决定，1 增加一个线程，-1 减少一个线程
+    long long m_target_wait;       // 平均排队时间超过它时增加线程(微秒)
+    long long m_idle_timeout;      // 最后一个线程空闲超过它时减少线程(微秒)
+    size_t m_last_backlog;         // 上一次检查时队列中的请求数
+    std::atomic<bool> m_stop;     // 析构时置为true，控制线程和工作线程看到后退出
+    std::atomic<int> m_workers;   // 已创建、还没退出的工作线程数，包括正在退出的 RETIRING 线程
+    bool m_controlling;
+    pthread_t m_controller;
+
+    // 统计信息，REPORT_INTERVAL 秒清零一次，只有控制线程访问
+    long long m_waits;    // 取出的请求数
+    long long m_wait_sum; // 排队时间之和(微秒)
+    long long m_wait_max; // 最长的排队时间(微秒)
+    int m_peak;           // 最多的线程数
+    int m_low;            // 最少的线程数
+    // 主线程执行决定后增加，控制线程读取
+    std::atomic<int> m_grown;  // 增加线程的次数
+    std::atomic<int> m_shrunk; // 减少线程的次数
+
+    int m_close_log;
 };
 
 
-// 1.初始化 m_actor_model、m_thread_number、m_max_requests、m_connPool 成员变量
-// 2.为 m_threads 动态分配线程线程数组
-// 3.pthread_create 创建线程，每一个线程都运行worker成员函数，并通过pthread_detach分离线程
+// 1.初始化 m_actor_model、m_thread_number、m_max_requests 成员变量
+// 2.为每个线程创建请求队列，容量为 max_requests / thread_number 向上取2的幂，线程少于 max_threads 时总容量不减少
+// 3.为 m_threads 动态分配线程线程数组
+// 4.pthread_create 创建 thread_number 个线程，每一个线程都运行worker成员函数，并通过pthread_detach分离线程
+// 5.max_threads 大于 thread_number 时创建控制线程
 template <typename T>
-threadpool<T>::threadpool(int actor_model, connection_pool *connPool, int thread_number, int max_requests) : m_actor_model(actor_model), m_thread_number(thread_number), m_max_requests(max_requests), m_threads(NULL), m_connPool(connPool)
+threadpool<T>::threadpool(int actor_model, int thread_number, int max_requests, int max_threads, int target_wait,
+                          int idle_timeout, int close_log)
+    : m_thread_number(thread_number), m_max_requests(max_requests), m_threads(NULL), m_actor_model(actor_model),
+      m_slots(NULL), m_idle(0), m_live(0), m_decision(0), m_last_backlog(0), m_stop(false), m_workers(0), m_controlling(false),
+      m_waits(0), m_wait_sum(0), m_wait_max(0), m_grown(0), m_shrunk(0), m_close_log(close_log)
 {
     if (thread_number <= 0 || max_requests <= 0)
         throw std::exception();
-    m_threads = new pthread_t[m_thread_number];
+    m_max_threads = max_threads > thread_number ? max_threads : thread_number;
+    m_target_wait = (target_wait > 0 ? target_wait : 1) * 1000LL;
+    m_idle_timeout = (idle_timeout > 0 ? idle_timeout : 1) * 1000000LL;
+    m_peak = m_low = thread_number;
+    m_spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_COUNT : 0;
+    m_slots = new worker_slot *[m_max_threads];
+    for (int i = 0; i < m_max_threads; ++i)
+    {
+        worker_slot *slot = new worker_slot;
+        slot->pool = this;
+        slot->index = i;
+        slot->queue = new ring_queue<task>((max_requests + thread_number - 1) / thread_number);
+        slot->idle.store(0, std::memory_order_relaxed);
+        slot->state.store(STOPPED, std::memory_order_relaxed);
+        slot->idle_since.store(0, std::memory_order_relaxed);
+        slot->wait_sum.store(0, std::memory_order_relaxed);
+        slot->wait_count.store(0, std::memory_order_relaxed);
+        slot->wait_max.store(0, std::memory_order_relaxed);
+        m_slots[i] = slot;
+    }
+    m_threads = new pthread_t[m_max_threads];
     if (!m_threads)
         throw std::exception();
     for (int i = 0; i < thread_number; ++i)
     {
-        if (pthread_create(m_threads + i, NULL, worker, this) != 0)
-        {
-            delete[] m_threads;
-            throw std::exception();
-        }
-        if (pthread_detach(m_threads[i]))
+        if (!start(i))
         {
             delete[] m_threads;
             throw std::exception();
         }
     }
+    m_live.store(thread_number, std::memory_order_release);
+
+    if (m_max_threads > thread_number)
+    {
+        m_controlling = (pthread_create(&m_controller, NULL, controller, this) == 0);
+        if (!m_controlling)
+            LOG_ERROR("%s", "create thread pool controller error");
+    }
 }
 
-// 回收m_threads分配的线程空间
+// 1.置 m_stop，等待控制线程退出
+// 2.唤醒所有工作线程，正在处理请求的线程处理完当前请求后退出
+// 3.工作线程是分离的，等 m_workers 减为0，即所有线程都不再访问线程池后，再释放各线程的请求队列
 template <typename T>
 threadpool<T>::~threadpool()
 {
+    m_stop.store(true);
+    if (m_controlling)
+        pthread_join(m_controller, NULL);
+    for (int i = 0; i < m_max_threads; ++i)
+        m_slots[i]->waker.unpark();
+    while (m_workers.load(std::memory_order_acquire) > 0)
+        usleep(1000);
+
     delete[] m_threads;
+    for (int i = 0; i < m_max_threads; ++i)
+    {
+        delete m_slots[i]->queue;
+        delete m_slots[i];
+    }
+    delete[] m_slots;
 }
 
-// 将request 添加到 m_workqueue队列中
-// 设置 request->m_state = state;
+// 线程退出前把状态改为 STOPPED，之后不再访问 worker_slot，同一个 worker_slot 可以立即启动新的线程
 template <typename T>
-bool threadpool<T>::append(T *request, int state)
+bool threadpool<T>::start(int index)
 {
-    m_queuelocker.lock();
-    if (m_workqueue.size() >= m_max_requests)
+    worker_slot *slot = m_slots[index];
+    slot->state.store(RUNNING, std::memory_order_release);
+    m_workers.fetch_add(1, std::memory_order_relaxed);
+    if (pthread_create(m_threads + index, NULL, worker, slot) != 0)
     {
-        m_queuelocker.unlock();
+        m_workers.fetch_sub(1, std::memory_order_relaxed);
+        slot->state.store(STOPPED, std::memory_order_relaxed);
         return false;
     }
-    request->m_state = state;
-    m_workqueue.push_back(request);
-    m_queuelocker.unlock();
-    m_queuestat.post();
+    pthread_detach(m_threads[index]);
     return true;
 }
 
-// 将request 添加到 m_workqueue队列中
+template <typename T>
+long long threadpool<T>::now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// 将request 添加到所属工作线程的队列中
+// 设置 request->m_state = state; 入队后工作线程可能立即取走，须在入队之前设置
+template <typename T>
+bool threadpool<T>::append(T *request, int state)
+{
+    request->m_state = state;
+    return append_batch(&request, 1) == 1;
+}
+
+// 将request 添加到所属工作线程的队列中
 template <typename T>
 bool threadpool<T>::append_p(T *request)
 {
-    m_queuelocker.lock();
-    if (m_workqueue.size() >= m_max_requests)
+    return append_batch(&request, 1) == 1;
+}
+
+// 1.先把所有请求放入各自的队列，入队不唤醒任何线程
+// 2.一次屏障后按请求依次唤醒休眠的线程，唤醒的线程数不超过放入的请求数，没有休眠的线程时立即停止
+template <typename T>
+int threadpool<T>::append_batch(T **requests, int count)
+{
+    adjust();
+
+    long long now = now_us();
+    int pushed = 0;
+    for (int i = 0; i < count; ++i)
     {
-        m_queuelocker.unlock();
-        return false;
+        int index = push(requests[i], now);
+        if (index < 0)
+            break;
+        ++pushed;
     }
-    m_workqueue.push_back(request);
-    m_queuelocker.unlock();
-    m_queuestat.post();
-    return true;
+    // 与 run() 中登记休眠后的屏障配对：要么这里看到休眠的线程，要么它再次查找时看到这些请求
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int live = m_live.load(std::memory_order_relaxed);
+    for (int i = 0; i < pushed && m_idle.load(std::memory_order_relaxed) > 0; ++i)
+    {
+        if (!wake((int)(((uintptr_t)requests[i] / sizeof(T)) % live)))
+            break;
+    }
+    return pushed;
 }
 
-// 传递的是this指针，实际上执行的是run()成员函数
+// 连接对象在 users 数组中连续存放，地址除以对象大小即数组下标，同一连接的请求总是先放入同一个线程的队列
+// 线程数变化后连接改由新的线程处理
+template <typename T>
+int threadpool<T>::push(T *request, long long now)
+{
+    int live = m_live.load(std::memory_order_relaxed);
+    int home = (int)(((uintptr_t)request / sizeof(T)) % live);
+    int index = home;
+    task t = {request, now};
+    // 入队之前计入，工作线程可能立即取走并处理完
+    request->m_inflight.fetch_add(1, std::memory_order_relaxed);
+    while (!m_slots[index]->queue->try_push(t))
+    {
+        index = (index + 1) % live;
+        if (index == home)
+        {
+            request->m_inflight.fetch_sub(1, std::memory_order_relaxed);
+            return -1;
+        }
+    }
+    return index;
+}
+
+template <typename T>
+void threadpool<T>::adjust()
+{
+    int decision = m_decision.load(std::memory_order_relaxed);
+    if (decision)
+        resize(decision);
+}
+
+// 增加：使用 m_slots[m_live]，它的线程还没退出时改回 RUNNING 继续使用，已退出时启动新的线程
+// 减少：只减少最后一个线程，并且它仍在休眠，先从 m_live 中去掉，之后的请求不再放入它的队列，再唤醒它退出
+template <typename T>
+void threadpool<T>::resize(int decision)
+{
+    m_decision.store(0, std::memory_order_relaxed);
+    int live = m_live.load(std::memory_order_relaxed);
+    if (decision > 0 && live < m_max_threads)
+    {
+        worker_slot *slot = m_slots[live];
+        int state = RETIRING;
+        if (!slot->state.compare_exchange_strong(state, RUNNING) && !start(live))
+        {
+            LOG_ERROR("%s", "create worker thread error");
+            return;
+        }
+        m_live.store(live + 1, std::memory_order_release);
+        m_grown.fetch_add(1, std::memory_order_relaxed);
+        LOG_INFO("thread pool: requests are waiting, %d -> %d threads", live, live + 1);
+    }
+    else if (decision < 0 && live > m_thread_number)
+    {
+        worker_slot *slot = m_slots[live - 1];
+        int idle = 1;
+        if (!slot->idle.compare_exchange_strong(idle, 0))
+            return;
+        m_idle.fetch_sub(1, std::memory_order_relaxed);
+        m_live.store(live - 1, std::memory_order_release);
+        slot->state.store(RETIRING, std::memory_order_release);
+        slot->waker.unpark();
+        m_shrunk.fetch_add(1, std::memory_order_relaxed);
+        LOG_INFO("thread pool: idle for %llds, %d -> %d threads", m_idle_timeout / 1000000, live, live - 1);
+    }
+}
+
+template <typename T>
+int threadpool<T>::take(int index, task *tasks)
+{
+    int max = m_idle.load(std::memory_order_relaxed) > 0 ? 1 : BATCH_SIZE;
+    int n = (int)m_slots[index]->queue->try_pop_bulk(tasks, max);
+    if (n > 0)
+        return n;
+    int live = m_live.load(std::memory_order_acquire);
+    for (int i = 0; i < live; ++i)
+    {
+        if (i != index && m_slots[i]->queue->try_pop(tasks[0]))
+            return 1;
+    }
+    return 0;
+}
+
+// 所属线程正在处理其它请求时，请求不必排在它后面，由休眠的线程窃取
+// 比较并交换 idle，多个请求同时放入时各自唤醒不同的线程
+template <typename T>
+bool threadpool<T>::wake(int index)
+{
+    int live = m_live.load(std::memory_order_relaxed);
+    for (int i = 0; i < live; ++i)
+    {
+        worker_slot *slot = m_slots[(index + i) % live];
+        int idle = 1;
+        if (slot->idle.load(std::memory_order_relaxed) == 1 && slot->idle.compare_exchange_strong(idle, 0))
+        {
+            m_idle.fetch_sub(1, std::memory_order_relaxed);
+            slot->waker.unpark();
+            return true;
+        }
+    }
+    return false;
+}
+
+// 传递的是线程的 worker_slot，实际上执行的是run()成员函数
 template <typename T>
 void *threadpool<T>::worker(void *arg)
+{
+    worker_slot *slot = (worker_slot *)arg;
+    threadpool *pool = slot->pool;
+    pool->run(slot->index);
+    // 最后一次访问线程池，之后析构函数可能立即释放它
+    pool->m_workers.fetch_sub(1, std::memory_order_release);
+    return NULL;
+}
+
+template <typename T>
+void *threadpool<T>::controller(void *arg)
 {
     threadpool *pool = (threadpool *)arg;
-    pool->run();
+    pool->control();
     return pool;
 }
 
+// 每 CONTROL_INTERVAL 毫秒汇总一次各线程的排队时间并做出决定，每 REPORT_INTERVAL 秒记录一次统计信息
+template <typename T>
+void threadpool<T>::control()
+{
+    long long report_at = now_us() + REPORT_INTERVAL * 1000000LL;
+    while (!m_stop.load(std::memory_order_relaxed))
+    {
+        usleep(CONTROL_INTERVAL * 1000);
+        long long now = now_us(), avg = 0;
+        int decision = decide(now, avg);
+        if (decision)
+            m_decision.store(decision, std::memory_order_relaxed);
+        if (now >= report_at)
+        {
+            report();
+            report_at += REPORT_INTERVAL * 1000000LL;
+        }
+    }
+}
+
+// 1.平均排队时间超过 m_target_wait，或者队列中一直有请求而这段时间没有取出任何请求(线程都阻塞在数据库等调用上)时增加
+// 2.否则最后一个线程休眠超过 m_idle_timeout 时减少，每次只减少一个
+template <typename T>
+int threadpool<T>::decide(long long now, long long &avg)
+{
+    int live = m_live.load(std::memory_order_acquire);
+    long long sum = 0, count = 0, max = 0;
+    size_t backlog = 0;
+    for (int i = 0; i < m_max_threads; ++i)
+    {
+        worker_slot *slot = m_slots[i];
+        sum += slot->wait_sum.exchange(0, std::memory_order_relaxed);
+        count += slot->wait_count.exchange(0, std::memory_order_relaxed);
+        long long m = slot->wait_max.exchange(0, std::memory_order_relaxed);
+        if (m > max)
+            max = m;
+        if (i < live)
+            backlog += slot->queue->size();
+    }
+    m_waits += count;
+    m_wait_sum += sum;
+    if (max > m_wait_max)
+        m_wait_max = max;
+    if (live > m_peak)
+        m_peak = live;
+    if (live < m_low)
+        m_low = live;
+
+    avg = count ? sum / count : 0;
+    bool stalled = backlog > 0 && m_last_backlog > 0 && 0 == count;
+    m_last_backlog = backlog;
+    if (live < m_max_threads && (avg > m_target_wait || stalled))
+        return 1;
+
+    if (live > m_thread_number)
+    {
+        worker_slot *last = m_slots[live - 1];
+        if (last->idle.load(std::memory_order_relaxed) == 1 &&
+            now - last->idle_since.load(std::memory_order_relaxed) >= m_idle_timeout)
+            return -1;
+    }
+    return 0;
+}
+
+// 记录线程数范围、排队时间和伸缩次数，之后清零
+template <typename T>
+void threadpool<T>::report()
+{
+    int live = m_live.load(std::memory_order_relaxed);
+    LOG_INFO("thread pool: %d threads (min %d, max %d, range %d-%d); %lld requests, queue wait avg %lldus, max %lldus; grown %d, shrunk %d",
+             live, m_thread_number, m_max_threads, m_low, m_peak, m_waits, m_waits ? m_wait_sum / m_waits : 0LL,
+             m_wait_max, m_grown.exchange(0), m_shrunk.exchange(0));
+    m_waits = m_wait_sum = m_wait_max = 0;
+    m_peak = m_low = live;
+}
+
 
 // 不断地从工作队列中获取第一个request
 // 如果 m_actor_model = 1
@@ -140,70 +509,113 @@ void *threadpool<T>::worker(void *arg)
 // 如果 m_actor_model = 0
     // process()组HTTP回复包，并映射到m_file_address处
 
+// 没有请求时先查找 m_spin 次，再登记休眠、最后查找一次，仍没有时休眠到 append_batch() 唤醒
+// 被 resize() 设为 RETIRING 后处理完自己队列中剩余的请求，改为 STOPPED 后退出；其间又被改回 RUNNING 时继续运行
 template <typename T>
-void threadpool<T>::run()
+void threadpool<T>::run(int index)
 {
+    worker_slot *self = m_slots[index];
     while (true)
     {
-        m_queuestat.wait();
-        m_queuelocker.lock();
-        if (m_workqueue.empty())
+        // 线程池正在析构，队列中剩余的请求不再处理
+        if (m_stop.load(std::memory_order_acquire))
+            return;
+        if (self->state.load(std::memory_order_acquire) == RETIRING)
         {
-            m_queuelocker.unlock();
+            task t;
+            while (self->queue->try_pop(t))
+                handle(self, t);
+            int state = RETIRING;
+            if (self->state.compare_exchange_strong(state, STOPPED))
+                return;
             continue;
         }
 
-        // 在while循环中，从请求队列中获取第一个任务，并进行处理
-        T *request = m_workqueue.front();
-        m_workqueue.pop_front();
-        m_queuelocker.unlock();
-        if (!request)
-            continue;
+        // 在while循环中，先取本线程队列中的请求，没有时窃取其它线程的，并依次进行处理
+        task tasks[BATCH_SIZE];
+        int found = take(index, tasks);
+        for (int i = 0; !found && i < m_spin; ++i)
+        {
+            ring_queue<task>::cpu_relax();
+            found = take(index, tasks);
+        }
+        if (!found)
+        {
+            self->idle_since.store(now_us(), std::memory_order_relaxed);
+            self->idle.store(1, std::memory_order_relaxed);
+            m_idle.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            found = take(index, tasks);
+            if (!found)
+                self->waker.park();
+            // 没有被唤醒者置0时自己撤销登记
+            int idle = 1;
+            if (self->idle.compare_exchange_strong(idle, 0))
+                m_idle.fetch_sub(1, std::memory_order_relaxed);
+            if (!found)
+                continue;
+        }
+        for (int i = 0; i < found; ++i)
+            handle(self, tasks[i]);
+    }
+}
+
+template <typename T>
+void threadpool<T>::handle(worker_slot *self, const task &t)
+{
+    T *request = t.request;
+    if (!request)
+        return;
 
-        if (1 == m_actor_model)
+    long long wait = now_us() - t.enqueued;
+    self->wait_sum.fetch_add(wait, std::memory_order_relaxed);
+    self->wait_count.fetch_add(1, std::memory_order_relaxed);
+    if (wait > self->wait_max.load(std::memory_order_relaxed))
+        self->wait_max.store(wait, std::memory_order_relaxed);
+
+    if (1 == m_actor_model)
+    {
+        if (0 == request->m_state)
         {
-            if (0 == request->m_state)
+            // 读取网络数据，LT模式下只读取一次，ET模式下使用while循环读取
+            if (request->read_once())
             {
-                // 读取网络数据，LT模式下只读取一次，ET模式下使用while循环读取
-                if (request->read_once())
-                {
-                    request->improv = 1;
-                    connectionRAII mysqlcon(&request->mysql, m_connPool);
-
-                    // 从接收缓冲区读取数据，解析HTTP
-                    // 根据m_url将需要显示的文件路径放在 m_real_file 中，并映射到m_file_address处
-                    // 根据对应的HTTP状态码，组成HTTP数据包
-                    request->process();
-                }
-                else
-                {
-                    request->improv = 1;
-                    request->timer_flag = 1;
-                }
+                request->improv = 1;
+
+                // 从接收缓冲区读取数据，解析HTTP
+                // 根据m_url将需要显示的文件路径放在 m_real_file 中，并映射到m_file_address处
+                // 根据对应的HTTP状态码，组成HTTP数据包
+                request->process();
             }
             else
             {
-                // bytes_to_send为0，则将 m_sockfd 设置为 EPOLLIN ，调用init函数，返回
-                // 否则调用 writev 持续发送数据，直到发送完成
-                if (request->write())
-                {
-                    request->improv = 1;
-                }
-                else
-                {
-                    request->improv = 1;
-                    request->timer_flag = 1;
-                }
+                request->improv = 1;
+                request->timer_flag = 1;
             }
         }
         else
         {
-            connectionRAII mysqlcon(&request->mysql, m_connPool);
-            // 从接收缓冲区读取数据，解析HTTP
-            // 根据m_url将需要显示的文件路径放在 m_real_file 中，并映射到m_file_address处
-            // 根据对应的HTTP状态码，组成HTTP数据包
-            request->process();
+            // bytes_to_send为0，则将 m_sockfd 设置为 EPOLLIN ，调用init函数，返回
+            // 否则调用 writev 持续发送数据，直到发送完成
+            if (request->write())
+            {
+                request->improv = 1;
+            }
+            else
+            {
+                request->improv = 1;
+                request->timer_flag = 1;
+            }
         }
     }
+    else
+    {
+        // 从接收缓冲区读取数据，解析HTTP
+        // 根据m_url将需要显示的文件路径放在 m_real_file 中，并映射到m_file_address处
+        // 根据对应的HTTP状态码，组成HTTP数据包
+        request->process();
+    }
+    // 处理完毕，主线程的定时器此后才能关闭这个连接
+    request->m_inflight.fetch_sub(1, std::memory_order_release);
 }
 #endif
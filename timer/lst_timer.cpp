@@ -54,6 +54,20 @@ void sort_timer_lst::adjust_timer(util_timer *timer)
         return;
     }
 
+    // 到期时间提前到上一个定时器之前：取下后从链表头重新插入
+    if (timer->prev && timer->expire < timer->prev->expire)
+    {
+        timer->prev->next = timer->next;
+        if (timer->next)
+            timer->next->prev = timer->prev;
+        else
+            tail = timer->prev;
+        timer->prev = NULL;
+        timer->next = NULL;
+        add_timer(timer);
+        return;
+    }
+
     // 如果timer的到期时间要早于下一个定时器，啥都不干
     util_timer *tmp = timer->next;
     if (!tmp || (timer->expire < tmp->expire))
@@ -115,6 +129,8 @@ void sort_timer_lst::del_timer(util_timer *timer)
 }
 
 // 触发已过期的定时器事件函数，并将已过期的定时器从链表中移除
+// 连接的阶段在工作线程中推进，到期时重新计算截止时间，尚未真正超时的定时器推迟后放回链表
+// 连接还在线程池中时推迟1秒，由下一次 tick 关闭，定时器只关闭没有工作线程访问的连接
 void sort_timer_lst::tick()
 {
     if (!head)
@@ -132,9 +148,6 @@ void sort_timer_lst::tick()
             break;
         }
 
-        // 执行定时器的回调函数
-        tmp->cb_func(tmp->user_data);
-
         // 更改链表头结点
         head = tmp->next;
         if (head)
@@ -142,7 +155,30 @@ void sort_timer_lst::tick()
             head->prev = NULL;
         }
 
-        delete tmp;
+        // 工作线程正在处理这个连接时不关闭，下一次 tick 再检查
+        http_conn *conn = tmp->user_data->conn;
+        if (conn->in_flight())
+        {
+            tmp->expire = cur + 1;
+            tmp->next = NULL;
+            add_timer(tmp);
+            tmp = head;
+            continue;
+        }
+
+        time_t deadline = conn->deadline(true);
+        if (cur < deadline)
+        {
+            tmp->expire = deadline;
+            tmp->next = NULL;
+            add_timer(tmp);
+        }
+        else
+        {
+            // 执行定时器的回调函数
+            tmp->cb_func(tmp->user_data);
+            delete tmp;
+        }
         tmp = head;
     }
 }
@@ -202,6 +238,7 @@ int Utils::setnonblocking(int fd)
 void Utils::addfd(int epollfd, int fd, bool one_shot, int TRIGMode)
 {
     epoll_event event;
+    bzero(&event, sizeof(event));
     event.data.fd = fd;
 
     // EPOLLIN       对应文件描述符可读
@@ -219,6 +256,20 @@ void Utils::addfd(int epollfd, int fd, bool one_shot, int TRIGMode)
     setnonblocking(fd);
 }
 
+// 重新注册fd的读事件
+// EPOLL_CTL_MOD 会重新检查fd的就绪状态，就绪则放回就绪队列末尾
+void Utils::rearm(int epollfd, int fd, int TRIGMode)
+{
+    epoll_event event;
+    bzero(&event, sizeof(event));
+    event.data.fd = fd;
+    if (1 == TRIGMode)
+        event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+    else
+        event.events = EPOLLIN | EPOLLRDHUP;
+    epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
+}
+
 // 信号处理函数，将 sig 参数通过管道u_pipefd[1]传输
 void Utils::sig_handler(int sig)
 {
@@ -262,14 +313,13 @@ void Utils::show_error(int connfd, const char *info)
 int *Utils::u_pipefd = 0; // 对应 WebServer 中的pipefd
 int Utils::u_epollfd = 0; // 对应 WebServer 中的epollfd
 
-// 将 user_data->sockfd 从 Utils::u_epollfd 中移除
-// 关闭 user_data->sockfd
+// 调用 user_data->conn->close_conn()
+// 将 sockfd 从 epollfd 中移除并关闭，释放上传、代理占用的资源
 // http_conn::m_user_count--;
+// 连接已被 close_conn() 关闭过时什么也不做，避免重复关闭被复用的fd
 class Utils;
 void cb_func(client_data *user_data)
 {
-    epoll_ctl(Utils::u_epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     assert(user_data);
-    close(user_data->sockfd);
-    http_conn::m_user_count--;
+    user_data->conn->close_conn();
 }
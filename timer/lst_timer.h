@@ -25,12 +25,14 @@
 #include "../log/log.h"
 
 class util_timer;
+class http_conn;
 
 struct client_data
 {
     sockaddr_in address; // 客户端的socket地址
     int sockfd;          // 本机与客户端通信的socket fd
     util_timer *timer;   // 该连接对应的定时器
+    http_conn *conn;     // 该连接对应的http_conn
 };
 
 class util_timer
@@ -90,6 +92,9 @@ public:
     // 设置fd文件描述符为非阻塞
     void addfd(int epollfd, int fd, bool one_shot, int TRIGMode);
 
+    // 重新注册fd的读事件，fd仍然就绪时，即使是ET模式下一轮 epoll_wait 也会再次返回它
+    void rearm(int epollfd, int fd, int TRIGMode);
+
     // 信号处理函数，将 sig 参数通过管道u_pipefd传输
     static void sig_handler(int sig);
 
@@ -112,8 +117,8 @@ public:
     int m_TIMESLOT;             // 每次定时的间隔时间
 };
 
-// 将 user_data->sockfd 从 Utils::u_epollfd 中移除
-// 关闭 user_data->sockfd
+// 调用 user_data->conn->close_conn()
+// 将 sockfd 从 epollfd 中移除并关闭，释放上传、代理占用的资源
 // http_conn::m_user_count--;
 void cb_func(client_data *user_data);
 
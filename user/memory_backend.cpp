@@ -0,0 +1,53 @@
+#include "memory_backend.h"
+
+// FNV-1a，与 user_table 的分片方式相同
+memory_backend::shard &memory_backend::shard_of(const char *name)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (; *name; ++name)
+    {
+        h ^= (unsigned char)*name;
+        h *= 1099511628211ULL;
+    }
+    return m_shards[h % SHARDS];
+}
+
+int memory_backend::find(const char *name, string &password)
+{
+    shard &s = shard_of(name);
+    s.lock.lock();
+    unordered_map<string, string>::iterator it = s.users.find(name);
+    bool found = it != s.users.end();
+    if (found)
+        password = it->second;
+    s.lock.unlock();
+    return found ? 1 : 0;
+}
+
+int memory_backend::insert(const char *name, const char *password)
+{
+    shard &s = shard_of(name);
+    s.lock.lock();
+    bool inserted = s.users.insert(make_pair(string(name), string(password))).second;
+    s.lock.unlock();
+    return inserted ? BACKEND_OK : BACKEND_DUPLICATE;
+}
+
+int memory_backend::scan(int count, bool (*fn)(void *arg, const char *name, const char *password), void *arg)
+{
+    int scanned = 0;
+    bool more = count > 0;
+    for (int i = 0; i < SHARDS && more; ++i)
+    {
+        shard &s = m_shards[i];
+        s.lock.lock();
+        unordered_map<string, string>::iterator it = s.users.begin();
+        for (; it != s.users.end() && more; ++it)
+        {
+            ++scanned;
+            more = fn(arg, it->first.c_str(), it->second.c_str()) && scanned < count;
+        }
+        s.lock.unlock();
+    }
+    return scanned;
+}
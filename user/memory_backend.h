@@ -0,0 +1,33 @@
+#ifndef MEMORY_BACKEND_H
+#define MEMORY_BACKEND_H
+
+#include <stdint.h>
+#include <unordered_map>
+#include "user_backend.h"
+#include "../lock/locker.h"
+
+// 只在内存中的后端，启动时为空，注册的用户在进程退出后丢失
+// 按用户名哈希分为 SHARDS 个分片，每个分片一把锁，查询和写入都不经过网络
+class memory_backend : public user_backend
+{
+public:
+    static const int SHARDS = 16;
+
+    const char *name() const { return "memory"; }
+    int find(const char *name, string &password);
+    int insert(const char *name, const char *password);
+    int scan(int count, bool (*fn)(void *arg, const char *name, const char *password), void *arg);
+
+private:
+    struct shard
+    {
+        locker lock;
+        unordered_map<string, string> users;
+    };
+
+    shard &shard_of(const char *name);
+
+    shard m_shards[SHARDS];
+};
+
+#endif
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <mysql/errmsg.h>
+#include "mysql_backend.h"
+#include "user_writer.h"
+#include "../log/log.h"
+
+// 主键冲突的错误码 ER_DUP_ENTRY
+static const int DUP_ENTRY = 1062;
+
+mysql_backend::mysql_backend(connection_pool *connPool, int close_log)
+    : m_connPool(connPool), m_close_log(close_log)
+{
+}
+
+// 优先查询延迟可以接受的从库，没有可用的从库或从库出错时查询主库
+// 从库上不存在的用户名再到主库确认，刚注册的用户不会因为复制延迟被缓存为不存在
+int mysql_backend::find(const char *name, string &password)
+{
+    connection_pool *replica = m_connPool->ReadPool();
+    int found = replica ? fetch(replica, name, password) : -1;
+    if (found <= 0)
+        found = fetch(m_connPool, name, password);
+    return found;
+}
+
+int mysql_backend::fetch(connection_pool *connPool, const char *name, string &password)
+{
+    MYSQL *mysql = NULL;
+    connectionRAII mysqlcon(&mysql, connPool);
+    if (!mysql)
+        return -1;
+
+    char value[100];
+    const char *params[1] = {name};
+    int found = connPool->Fetch(mysql, SELECT_USER_SQL, params, 1, value, sizeof(value));
+    if (found < 0)
+        LOG_ERROR("SELECT user %s error on %s:%d", name, connPool->m_url.c_str(), connPool->m_Port);
+    if (found > 0)
+        password = value;
+    return found;
+}
+
+// 取不到连接(熔断、超时或无法建立连接)时按出错处理
+int mysql_backend::insert(const char *name, const char *password)
+{
+    MYSQL *mysql = NULL;
+    connectionRAII mysqlcon(&mysql, m_connPool);
+    if (!mysql)
+        return BACKEND_ERROR;
+
+    const char *params[2] = {name, password};
+    int err = m_connPool->Execute(mysql, INSERT_USER_SQL, params, 2);
+    if (0 == err)
+        return BACKEND_OK;
+    return DUP_ENTRY == err ? BACKEND_DUPLICATE : BACKEND_ERROR;
+}
+
+// 先用一条多行INSERT写入整批
+// 被数据库拒绝(不是连接错误)时，在同一个连接上逐行重写，被拒绝的行记为0
+// 连接出错时尚未写入的行记为-1，丢弃该连接，下次取连接时重连
+void mysql_backend::write(vector<user_write> &batch)
+{
+    size_t n = batch.size();
+    for (size_t i = 0; i < n; ++i)
+        batch[i].result = -1;
+
+    MYSQL *mysql = m_connPool->GetConnection();
+    if (!mysql)
+        return;
+
+    bool broken = false;
+    int err = insert_rows(mysql, batch, 0, n);
+    if (0 == err)
+    {
+        for (size_t i = 0; i < n; ++i)
+            batch[i].result = 1;
+    }
+    else if (err >= CR_MIN_ERROR)
+        broken = true;
+    else if (1 == n)
+        batch[0].result = 0;
+    else
+    {
+        for (size_t i = 0; i < n && !broken; ++i)
+        {
+            err = insert_rows(mysql, batch, i, i + 1);
+            if (0 == err)
+                batch[i].result = 1;
+            else if (err >= CR_MIN_ERROR)
+                broken = true;
+            else
+                batch[i].result = 0;
+        }
+    }
+
+    if (broken)
+    {
+        LOG_ERROR("write users error:%d", err);
+        m_connPool->DiscardConnection(mysql);
+    }
+    else
+        m_connPool->ReleaseConnection(mysql);
+}
+
+// 每种行数的语句在每个连接上只预处理一次，用户名和密码作为参数发送，不需要转义
+int mysql_backend::insert_rows(MYSQL *mysql, vector<user_write> &batch, size_t begin, size_t end)
+{
+    size_t rows = end - begin;
+    while (m_sql.size() < rows)
+        m_sql.push_back(m_sql.empty() ? string(INSERT_USER_SQL) : m_sql.back() + ", (?, ?)");
+
+    vector<const char *> params;
+    for (size_t i = begin; i < end; ++i)
+    {
+        params.push_back(batch[i].name.c_str());
+        params.push_back(batch[i].password.c_str());
+    }
+    return m_connPool->Execute(mysql, m_sql[rows - 1].c_str(), &params[0], params.size());
+}
+
+// 有可用的从库时从从库读取
+int mysql_backend::scan(int count, bool (*fn)(void *arg, const char *name, const char *password), void *arg)
+{
+    connection_pool *replica = m_connPool->ReadPool();
+    MYSQL *mysql = NULL;
+    connectionRAII mysqlcon(&mysql, replica ? replica : m_connPool);
+    if (!mysql)
+        return 0;
+
+    char sql[64];
+    snprintf(sql, sizeof(sql), "SELECT username,passwd FROM user LIMIT %d", count);
+    if (mysql_query(mysql, sql))
+    {
+        LOG_ERROR("SELECT error:%s", mysql_error(mysql));
+        return 0;
+    }
+
+    MYSQL_RES *result = mysql_store_result(mysql);
+    int scanned = 0;
+    while (scanned < count)
+    {
+        MYSQL_ROW row = mysql_fetch_row(result);
+        if (!row)
+            break;
+        ++scanned;
+        if (!fn(arg, row[0], row[1]))
+            break;
+    }
+    mysql_free_result(result);
+    return scanned;
+}
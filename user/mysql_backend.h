@@ -0,0 +1,42 @@
+#ifndef MYSQL_BACKEND_H
+#define MYSQL_BACKEND_H
+
+#include "user_backend.h"
+#include "../CGImysql/sql_connection_pool.h"
+
+// 按用户名查询密码的预处理语句，username 需为主键或唯一索引
+#define SELECT_USER_SQL "SELECT passwd FROM user WHERE username = ?"
+// 注册写入的预处理语句，多行写入时每多一行追加一组 ", (?, ?)"
+#define INSERT_USER_SQL "INSERT INTO user(username, passwd) VALUES(?, ?)"
+
+// MySQL 后端
+// 查询优先发往延迟可以接受的从库，写入使用主库，都使用预处理语句；可用性取决于主库的熔断器
+// 批量写入时用一条多行INSERT写入整批，被拒绝时在同一个连接上逐行重写
+class mysql_backend : public user_backend
+{
+public:
+    mysql_backend(connection_pool *connPool, int close_log);
+
+    const char *name() const { return "mysql"; }
+    int find(const char *name, string &password);
+    int insert(const char *name, const char *password);
+    void write(vector<user_write> &batch);
+    int scan(int count, bool (*fn)(void *arg, const char *name, const char *password), void *arg);
+
+    bool available() { return m_connPool->Available(); }
+    int retry_after() { return m_connPool->RetryAfter(); }
+
+    connection_pool *pool() { return m_connPool; }
+
+private:
+    int fetch(connection_pool *connPool, const char *name, string &password); // 在指定的连接池上查询
+    // 用一条INSERT写入 batch[begin, end)，成功返回0，失败返回错误码，只有写入线程调用
+    int insert_rows(MYSQL *mysql, vector<user_write> &batch, size_t begin, size_t end);
+
+    connection_pool *m_connPool;
+    vector<string> m_sql; // m_sql[n - 1] 为写入 n 行的语句，只有写入线程使用
+
+    int m_close_log;
+};
+
+#endif
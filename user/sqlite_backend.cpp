@@ -0,0 +1,121 @@
+#include "sqlite_backend.h"
+#include "user_writer.h"
+#include "../log/log.h"
+
+sqlite_backend::sqlite_backend() : m_db(NULL), m_select(NULL), m_insert(NULL), m_close_log(0)
+{
+}
+
+sqlite_backend::~sqlite_backend()
+{
+    sqlite3_finalize(m_select);
+    sqlite3_finalize(m_insert);
+    sqlite3_close(m_db);
+}
+
+bool sqlite_backend::init(const char *path, int close_log)
+{
+    m_close_log = close_log;
+    if (sqlite3_open_v2(path, &m_db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK)
+    {
+        LOG_ERROR("open sqlite %s error:%s", path, sqlite3_errmsg(m_db));
+        return false;
+    }
+
+    const char *schema =
+        "PRAGMA journal_mode=WAL;"
+        "PRAGMA synchronous=NORMAL;"
+        "CREATE TABLE IF NOT EXISTS user(username TEXT PRIMARY KEY, passwd TEXT NOT NULL);";
+    if (sqlite3_exec(m_db, schema, NULL, NULL, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(m_db, "SELECT passwd FROM user WHERE username = ?", -1, &m_select, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(m_db, "INSERT INTO user(username, passwd) VALUES(?, ?)", -1, &m_insert, NULL) != SQLITE_OK)
+    {
+        LOG_ERROR("init sqlite %s error:%s", path, sqlite3_errmsg(m_db));
+        return false;
+    }
+    return true;
+}
+
+int sqlite_backend::find(const char *name, string &password)
+{
+    m_lock.lock();
+    sqlite3_bind_text(m_select, 1, name, -1, SQLITE_STATIC);
+    int rc = sqlite3_step(m_select);
+    int found = -1;
+    if (SQLITE_ROW == rc)
+    {
+        password = (const char *)sqlite3_column_text(m_select, 0);
+        found = 1;
+    }
+    else if (SQLITE_DONE == rc)
+        found = 0;
+    else
+        LOG_ERROR("SELECT user %s error:%s", name, sqlite3_errmsg(m_db));
+    sqlite3_reset(m_select);
+    sqlite3_clear_bindings(m_select);
+    m_lock.unlock();
+    return found;
+}
+
+int sqlite_backend::step_insert(const char *name, const char *password)
+{
+    sqlite3_bind_text(m_insert, 1, name, -1, SQLITE_STATIC);
+    sqlite3_bind_text(m_insert, 2, password, -1, SQLITE_STATIC);
+    int rc = sqlite3_step(m_insert);
+    sqlite3_reset(m_insert);
+    sqlite3_clear_bindings(m_insert);
+    if (SQLITE_DONE == rc)
+        return BACKEND_OK;
+    if (SQLITE_CONSTRAINT == (rc & 0xff))
+        return BACKEND_DUPLICATE;
+    LOG_ERROR("INSERT user %s error:%s", name, sqlite3_errmsg(m_db));
+    return BACKEND_ERROR;
+}
+
+int sqlite_backend::insert(const char *name, const char *password)
+{
+    m_lock.lock();
+    int ret = step_insert(name, password);
+    m_lock.unlock();
+    return ret;
+}
+
+// 被拒绝的行不影响同一事务中的其它行，提交失败时整批按出错处理
+void sqlite_backend::write(vector<user_write> &batch)
+{
+    m_lock.lock();
+    bool ok = sqlite3_exec(m_db, "BEGIN", NULL, NULL, NULL) == SQLITE_OK;
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+        int ret = ok ? step_insert(batch[i].name.c_str(), batch[i].password.c_str()) : BACKEND_ERROR;
+        batch[i].result = BACKEND_OK == ret ? 1 : (BACKEND_DUPLICATE == ret ? 0 : -1);
+    }
+    if (ok && sqlite3_exec(m_db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+    {
+        LOG_ERROR("commit users error:%s", sqlite3_errmsg(m_db));
+        sqlite3_exec(m_db, "ROLLBACK", NULL, NULL, NULL);
+        for (size_t i = 0; i < batch.size(); ++i)
+            batch[i].result = -1;
+    }
+    m_lock.unlock();
+}
+
+int sqlite_backend::scan(int count, bool (*fn)(void *arg, const char *name, const char *password), void *arg)
+{
+    sqlite3_stmt *stmt = NULL;
+    int scanned = 0;
+    m_lock.lock();
+    if (sqlite3_prepare_v2(m_db, "SELECT username, passwd FROM user LIMIT ?", -1, &stmt, NULL) == SQLITE_OK)
+    {
+        sqlite3_bind_int(stmt, 1, count);
+        while (SQLITE_ROW == sqlite3_step(stmt))
+        {
+            ++scanned;
+            if (!fn(arg, (const char *)sqlite3_column_text(stmt, 0), (const char *)sqlite3_column_text(stmt, 1)))
+                break;
+        }
+    }
+    sqlite3_finalize(stmt);
+    m_lock.unlock();
+    return scanned;
+}
@@ -0,0 +1,37 @@
+#ifndef SQLITE_BACKEND_H
+#define SQLITE_BACKEND_H
+
+#include <sqlite3.h>
+#include "user_backend.h"
+#include "../lock/locker.h"
+
+// SQLite 后端，用户表保存在本地文件中，不需要数据库服务器，启动时表不存在则创建
+// 一个连接，查询和写入的预处理语句各一条，由 m_lock 串行化
+// 使用WAL日志，批量写入时整批在一个事务中，只同步一次
+class sqlite_backend : public user_backend
+{
+public:
+    sqlite_backend();
+    ~sqlite_backend();
+
+    // 打开或创建数据库文件，失败返回false
+    bool init(const char *path, int close_log);
+
+    const char *name() const { return "sqlite"; }
+    int find(const char *name, string &password);
+    int insert(const char *name, const char *password);
+    void write(vector<user_write> &batch);
+    int scan(int count, bool (*fn)(void *arg, const char *name, const char *password), void *arg);
+
+private:
+    int step_insert(const char *name, const char *password); // 持有 m_lock 时调用，返回 BACKEND_RESULT
+
+    sqlite3 *m_db;
+    sqlite3_stmt *m_select;
+    sqlite3_stmt *m_insert;
+    locker m_lock;
+
+    int m_close_log;
+};
+
+#endif
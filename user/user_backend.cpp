@@ -0,0 +1,11 @@
+#include "user_backend.h"
+#include "user_writer.h"
+
+void user_backend::write(vector<user_write> &batch)
+{
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+        int ret = insert(batch[i].name.c_str(), batch[i].password.c_str());
+        batch[i].result = BACKEND_OK == ret ? 1 : (BACKEND_DUPLICATE == ret ? 0 : -1);
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef USER_BACKEND_H
+#define USER_BACKEND_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct user_write;
+
+// insert() 的返回值
+enum BACKEND_RESULT
+{
+    BACKEND_ERROR = -1,   // 后端不可用或出错
+    BACKEND_OK = 0,       // 写入成功
+    BACKEND_DUPLICATE = 1 // 用户名已存在，被拒绝
+};
+
+// 用户名-密码 的存储后端，由 -j 选择
+// mysql：连接池、从库和熔断，见 mysql_backend
+// sqlite:路径：本地的 SQLite 数据库文件，需要 make SQLITE=1
+// memory：只在内存中，进程退出后丢失，不需要任何数据库，用于压测HTTP部分
+// 所有方法可能被多个工作线程同时调用
+class user_backend
+{
+public:
+    virtual ~user_backend() {}
+
+    virtual const char *name() const = 0;
+
+    // 按用户名查询密码，存在返回1，不存在返回0，出错返回-1
+    virtual int find(const char *name, string &password) = 0;
+    // 写入一个用户，返回 BACKEND_RESULT
+    virtual int insert(const char *name, const char *password) = 0;
+    // 写入一批注册，按行设置 batch[i].result：1 成功，0 被拒绝，-1 出错，由写入线程调用
+    // 默认逐行调用 insert()
+    virtual void write(vector<user_write> &batch);
+    // 读取前 count 个用户，逐个交给 fn，fn 返回false时停止，返回读取的个数，用于预热用户缓存
+    virtual int scan(int count, bool (*fn)(void *arg, const char *name, const char *password), void *arg) = 0;
+
+    // 后端当前是否可用，不可用时注册直接返回503
+    virtual bool available() { return true; }
+    // 不可用时建议客户端重试的秒数
+    virtual int retry_after() { return 1; }
+};
+
+#endif
@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <sys/time.h>
+#include "user_table.h"
+#include "../log/log.h"
+
+user_table::user_table()
+    : m_backend(NULL), m_capacity(1), m_ttl(0), m_negative_ttl(0), m_warm(0), m_warming(false), m_stop(false), m_close_log(0)
+{
+}
+
+user_table::~user_table()
+{
+    if (!m_warming)
+        return;
+    m_stop = true;
+    pthread_join(m_thread, NULL);
+}
+
+// FNV-1a 64位哈希，选择分片
+uint64_t user_table::hash_name(const char *name)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (; *name; ++name)
+    {
+        h ^= (unsigned char)*name;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+long long user_table::now_ms()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000LL + tv.tv_usec / 1000;
+}
+
+// 容量平均分到每个分片，预热的用户数不超过总容量
+void user_table::init(user_backend *backend, size_t capacity, int ttl, int negative_ttl, int warm, int close_log)
+{
+    m_backend = backend;
+    m_capacity = capacity / SHARDS > 0 ? capacity / SHARDS : 1;
+    m_ttl = ttl * 1000;
+    m_negative_ttl = negative_ttl * 1000;
+    m_warm = warm < (int)capacity ? warm : (int)capacity;
+    m_close_log = close_log;
+
+    if (m_warm <= 0)
+        return;
+    if (pthread_create(&m_thread, NULL, worker, this) != 0)
+    {
+        LOG_ERROR("%s", "create user warm thread error");
+        return;
+    }
+    m_warming = true;
+}
+
+user_record *user_table::find(shard &s, const char *name, bool stale)
+{
+    unordered_map<string, list<user_record>::iterator>::iterator it = s.index.find(name);
+    if (it == s.index.end())
+        return NULL;
+
+    list<user_record>::iterator record = it->second;
+    if (!stale && !record->pinned && record->expire <= now_ms())
+    {
+        s.lru.erase(record);
+        s.index.erase(it);
+        return NULL;
+    }
+    s.lru.splice(s.lru.begin(), s.lru, record);
+    return &*record;
+}
+
+// 从尾部向前淘汰没有固定的记录，新建的记录在头部，不会被淘汰
+user_record *user_table::add(shard &s, const char *name)
+{
+    user_record *found = find(s, name);
+    if (found)
+        return found;
+
+    user_record record;
+    record.name = name;
+    record.state = USER_ABSENT;
+    record.expire = 0;
+    record.pinned = false;
+    s.lru.push_front(record);
+    s.index[record.name] = s.lru.begin();
+
+    list<user_record>::iterator victim = s.lru.end();
+    while (s.index.size() > m_capacity && victim != s.lru.begin())
+    {
+        --victim;
+        if (victim->pinned)
+            continue;
+        s.index.erase(victim->name);
+        victim = s.lru.erase(victim);
+    }
+    return &s.lru.front();
+}
+
+void user_table::fill(const char *name, const char *password)
+{
+    shard &s = shard_of(name);
+    s.lock.lock();
+    if (!find(s, name))
+    {
+        user_record *record = add(s, name);
+        record->state = password ? USER_ACTIVE : USER_ABSENT;
+        record->password = password ? password : "";
+        record->expire = now_ms() + (password ? m_ttl : m_negative_ttl);
+    }
+    s.lock.unlock();
+}
+
+// 查询期间不持有分片锁，同一用户名的并发未命中可能各查询一次
+// 过期的记录在查询成功后由 fill() 替换，查询失败时保留，作为数据库恢复前的结果
+int user_table::get(const char *name, string &password)
+{
+    shard &s = shard_of(name);
+    s.lock.lock();
+    user_record *record = find(s, name, true);
+    int state = record ? record->state : USER_UNKNOWN;
+    bool fresh = record && (record->pinned || record->expire > now_ms());
+    string cached;
+    if (USER_ACTIVE == state)
+        cached = record->password;
+    s.lock.unlock();
+
+    if (!fresh)
+    {
+        int found = load(name, password);
+        if (found >= 0)
+        {
+            fill(name, found ? password.c_str() : NULL);
+            return found ? USER_ACTIVE : USER_ABSENT;
+        }
+    }
+    if (USER_ACTIVE == state)
+        password = cached;
+    return state;
+}
+
+// MySQL 后端优先查询从库，见 mysql_backend::find()
+int user_table::load(const char *name, string &password)
+{
+    if (!m_backend)
+        return -1;
+    return m_backend->find(name, password);
+}
+
+bool user_table::check(const char *name, const char *password)
+{
+    string stored;
+    return USER_ACTIVE == get(name, stored) && stored == password;
+}
+
+// 状态只在持有分片锁时修改，检查和占位在同一把锁内完成
+bool user_table::reserve(const char *name)
+{
+    shard &s = shard_of(name);
+    s.lock.lock();
+    user_record *record = find(s, name);
+    bool reserved = !record || USER_ABSENT == record->state;
+    if (reserved)
+    {
+        record = add(s, name);
+        record->state = USER_PENDING;
+        record->pinned = true;
+    }
+    s.lock.unlock();
+    return reserved;
+}
+
+void user_table::commit(const char *name, const string &password, bool pinned)
+{
+    shard &s = shard_of(name);
+    s.lock.lock();
+    user_record *record = find(s, name);
+    if (record && USER_PENDING == record->state)
+    {
+        record->password = password;
+        record->state = USER_ACTIVE;
+        record->expire = now_ms() + m_ttl;
+        record->pinned = pinned;
+    }
+    s.lock.unlock();
+}
+
+void user_table::cancel(const char *name)
+{
+    shard &s = shard_of(name);
+    s.lock.lock();
+    unordered_map<string, list<user_record>::iterator>::iterator it = s.index.find(name);
+    if (it != s.index.end() && USER_PENDING == it->second->state)
+    {
+        s.lru.erase(it->second);
+        s.index.erase(it);
+    }
+    s.lock.unlock();
+}
+
+void user_table::written(const char *name, bool ok)
+{
+    shard &s = shard_of(name);
+    s.lock.lock();
+    unordered_map<string, list<user_record>::iterator>::iterator it = s.index.find(name);
+    if (it != s.index.end() && USER_ACTIVE == it->second->state)
+    {
+        if (ok)
+        {
+            it->second->pinned = false;
+            it->second->expire = now_ms() + m_ttl;
+        }
+        else
+        {
+            s.lru.erase(it->second);
+            s.index.erase(it);
+        }
+    }
+    s.lock.unlock();
+}
+
+size_t user_table::size()
+{
+    size_t total = 0;
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        m_shards[i].lock.lock();
+        total += m_shards[i].index.size();
+        m_shards[i].lock.unlock();
+    }
+    return total;
+}
+
+void *user_table::worker(void *arg)
+{
+    user_table *table = (user_table *)arg;
+    table->warm();
+    return table;
+}
+
+// 与请求并发进行，已被请求缓存的用户不覆盖，MySQL 后端有可用的从库时从从库读取
+void user_table::warm()
+{
+    int count = m_backend->scan(m_warm, warm_one, this);
+    LOG_INFO("warm %d users", count);
+}
+
+bool user_table::warm_one(void *arg, const char *name, const char *password)
+{
+    user_table *table = (user_table *)arg;
+    table->fill(name, password);
+    return !table->m_stop;
+}
@@ -0,0 +1,115 @@
+#ifndef USER_TABLE_H
+#define USER_TABLE_H
+
+#include <stdint.h>
+#include <string>
+#include <list>
+#include <atomic>
+#include <unordered_map>
+#include "../lock/locker.h"
+#include "user_backend.h"
+
+using namespace std;
+
+// 用户状态
+enum USER_STATE
+{
+    USER_UNKNOWN = -1, // 不在缓存中且查询数据库失败，状态未知
+    USER_PENDING = 0,  // 注册中，已占用用户名，尚未写入数据库，登录不可见
+    USER_ACTIVE,       // 用户存在
+    USER_ABSENT        // 数据库中没有该用户名(负缓存)
+};
+
+// 缓存的一个用户名
+struct user_record
+{
+    string name;
+    string password;
+    int state;        // USER_STATE
+    long long expire; // 过期时间(毫秒)，之后需要重新查询数据库
+    bool pinned;      // 注册中或先写后确认尚未写入数据库，不过期也不淘汰
+};
+
+// 有界的 用户名-密码 缓存，单例
+// 启动时不再加载整个 user 表，登录时未命中才向后端按用户名查询，结果(包括用户不存在)缓存 ttl 秒
+// 按哈希值分为 SHARDS 个分片，每个分片一把锁、一个LRU链表和索引，超过容量时从链表尾部淘汰
+// 注册中的用户名占位不淘汰，总量超出容量的部分不超过进行中的注册数
+// 可选地在后台线程中预热前 warm 个用户，不阻塞启动
+class user_table
+{
+public:
+    static const int SHARDS = 64;
+
+    static user_table *get_instance()
+    {
+        static user_table instance;
+        return &instance;
+    }
+
+    // capacity 为缓存的用户名总数上限，ttl、negative_ttl 为存在、不存在的用户缓存的秒数
+    // warm 大于0时启动后台线程，从后端读取前 warm 个用户放入缓存
+    void init(user_backend *backend, size_t capacity, int ttl, int negative_ttl, int warm, int close_log);
+
+    // 查找用户，未命中或已过期时查询数据库并缓存结果，用户存在时 password 为其密码
+    // 数据库不可用(熔断或出错)时返回已过期的记录，已登录过的用户在数据库故障期间仍可登录
+    int get(const char *name, string &password);
+
+    // 用户存在、已完成注册且密码匹配时返回true
+    bool check(const char *name, const char *password);
+
+    // 检查并占位：用户名不在缓存中、已过期或确定不存在时记为 USER_PENDING 并返回true，同名的并发注册只有一个成功
+    // 缓存中没有的已存在用户由数据库的唯一约束拒绝
+    // 占位成功后必须调用 commit() 或 cancel() 其中之一
+    bool reserve(const char *name);
+    // 写入数据库成功，用户对登录可见；pinned 为true表示先写后确认，写入数据库前不淘汰
+    void commit(const char *name, const string &password, bool pinned = false);
+    void cancel(const char *name); // 写入数据库失败，释放用户名
+    // 先写后确认的注册写入完成：成功后可以淘汰，被数据库拒绝时移除，下次查找时以数据库为准
+    void written(const char *name, bool ok);
+
+    size_t size(); // 缓存的用户名数
+
+private:
+    user_table();
+    ~user_table(); // 等待预热线程退出
+
+    struct shard
+    {
+        locker lock;
+        list<user_record> lru; // 头部为最近使用
+        unordered_map<string, list<user_record>::iterator> index;
+    };
+
+    static uint64_t hash_name(const char *name);
+    shard &shard_of(const char *name) { return m_shards[hash_name(name) % SHARDS]; }
+    static long long now_ms();
+
+    // 持有分片锁时调用：查找未过期的记录并移到链表头部，过期的记录直接移除，没有返回NULL
+    // stale 为true时保留并返回过期的记录，由调用者判断是否过期
+    user_record *find(shard &s, const char *name, bool stale = false);
+    // 持有分片锁时调用：取得记录，没有时在链表头部新建，超过容量时从尾部淘汰
+    user_record *add(shard &s, const char *name);
+    // 缓存数据库的查询结果，password 为NULL表示不存在，已有未过期的记录时不覆盖
+    void fill(const char *name, const char *password);
+    // 查询后端，存在返回1，不存在返回0，出错返回-1
+    int load(const char *name, string &password);
+
+    static void *worker(void *arg);
+    void warm(); // 预热线程：读取前 m_warm 个用户
+    static bool warm_one(void *arg, const char *name, const char *password); // 预热时逐个缓存，退出时返回false
+
+    user_backend *m_backend;
+    size_t m_capacity; // 每个分片的容量
+    int m_ttl;         // 毫秒
+    int m_negative_ttl;
+    int m_warm;
+    bool m_warming;
+    atomic<bool> m_stop;
+    pthread_t m_thread;
+
+    shard m_shards[SHARDS];
+
+    int m_close_log;
+};
+
+#endif
@@ -0,0 +1,181 @@
+#include <sys/time.h>
+#include "user_writer.h"
+#include "user_table.h"
+#include "../log/log.h"
+
+user_writer::user_writer()
+    : m_backend(NULL), m_rows(1), m_wait_ms(0), m_behind(false), m_running(false), m_stop(false), m_backoff(0), m_close_log(0)
+{
+}
+
+user_writer::~user_writer()
+{
+    if (!m_running)
+        return;
+    m_lock.lock();
+    m_stop = true;
+    m_cond.signal();
+    m_lock.unlock();
+    pthread_join(m_thread, NULL);
+}
+
+long long user_writer::now_ms()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000LL + tv.tv_usec / 1000;
+}
+
+bool user_writer::init(user_backend *backend, int rows, int wait_ms, bool behind, int close_log)
+{
+    m_backend = backend;
+    m_rows = rows > 0 ? rows : 1;
+    m_wait_ms = wait_ms > 0 ? wait_ms : 0;
+    m_behind = behind;
+    m_close_log = close_log;
+
+    if (pthread_create(&m_thread, NULL, worker, this) != 0)
+    {
+        LOG_ERROR("%s", "create user writer thread error");
+        return false;
+    }
+    m_running = true;
+    return true;
+}
+
+// 队列由空变为非空时唤醒写入线程开始计时，攒够一批时唤醒写入线程立即写入
+void user_writer::submit(const char *name, const char *password, void (*done)(void *, bool), void *arg)
+{
+    user_write w;
+    w.name = name;
+    w.password = password;
+    w.done = done;
+    w.arg = arg;
+    w.arrive = now_ms();
+    w.result = -1;
+
+    m_lock.lock();
+    m_queue.push_back(w);
+    if (1 == m_queue.size() || m_rows == (int)m_queue.size())
+        m_cond.signal();
+    m_lock.unlock();
+}
+
+void user_writer::detach(void *arg)
+{
+    m_lock.lock();
+    for (size_t i = 0; i < m_queue.size(); ++i)
+        if (m_queue[i].arg == arg)
+            m_queue[i].arg = NULL;
+    for (size_t i = 0; i < m_batch.size(); ++i)
+        if (m_batch[i].arg == arg)
+            m_batch[i].arg = NULL;
+    m_lock.unlock();
+}
+
+void *user_writer::worker(void *arg)
+{
+    user_writer *writer = (user_writer *)arg;
+    writer->run();
+    return writer;
+}
+
+// 绝对时间 ms 毫秒(gettimeofday 的时钟)对应的 timespec，供 cond::timewait 使用
+static timespec abs_time(long long ms)
+{
+    timespec t;
+    t.tv_sec = ms / 1000;
+    t.tv_nsec = (ms % 1000) * 1000000;
+    return t;
+}
+
+// 1. 等待第一条注册
+// 2. 攒够 m_rows 行，或等到最早的一条满 m_wait_ms 毫秒，退出时不再等待
+// 3. 取出一批，释放锁后写入数据库
+// 4. 持有锁处理结果，有行需要重试时退避
+void user_writer::run()
+{
+    m_lock.lock();
+    while (true)
+    {
+        while (m_queue.empty() && !m_stop)
+            m_cond.wait(m_lock.get());
+        if (m_queue.empty())
+            break;
+
+        while (!m_stop && (int)m_queue.size() < m_rows)
+        {
+            long long until = m_queue.front().arrive + m_wait_ms;
+            if (until <= now_ms())
+                break;
+            m_cond.timewait(m_lock.get(), abs_time(until));
+        }
+
+        size_t n = m_queue.size() < (size_t)m_rows ? m_queue.size() : m_rows;
+        m_batch.assign(m_queue.begin(), m_queue.begin() + n);
+        m_queue.erase(m_queue.begin(), m_queue.begin() + n);
+        m_lock.unlock();
+
+        flush();
+
+        m_lock.lock();
+        finish();
+        m_batch.clear();
+
+        long long until = now_ms() + m_backoff;
+        while (!m_stop && now_ms() < until)
+            m_cond.timewait(m_lock.get(), abs_time(until));
+    }
+    m_lock.unlock();
+}
+
+// 写入前全部记为-1，后端取不到连接时保持出错
+void user_writer::flush()
+{
+    for (size_t i = 0; i < m_batch.size(); ++i)
+        m_batch[i].result = -1;
+    m_backend->write(m_batch);
+}
+
+// 等待确认的行：成功提交占位，失败取消占位，请求方仍在等待时回调
+// 先写后确认的行：写入后解除固定；连接出错时按原顺序放回队列头部，退避时间从100毫秒起每次翻倍
+// 数据库拒绝的行只能记录日志，从 user_table 中移除，之后以数据库为准
+// 退出时不再重试
+void user_writer::finish()
+{
+    user_table *table = user_table::get_instance();
+    vector<user_write> retry;
+    for (size_t i = 0; i < m_batch.size(); ++i)
+    {
+        user_write &w = m_batch[i];
+        if (w.done)
+        {
+            if (1 == w.result)
+                table->commit(w.name.c_str(), w.password);
+            else
+                table->cancel(w.name.c_str());
+            if (w.arg)
+                w.done(w.arg, 1 == w.result);
+        }
+        else if (-1 == w.result && !m_stop)
+            retry.push_back(w);
+        else if (1 == w.result)
+            table->written(w.name.c_str(), true);
+        else
+        {
+            LOG_ERROR("user %s is not written to database", w.name.c_str());
+            if (0 == w.result)
+                table->written(w.name.c_str(), false);
+        }
+    }
+
+    if (retry.empty())
+    {
+        m_backoff = 0;
+        return;
+    }
+    m_queue.insert(m_queue.begin(), retry.begin(), retry.end());
+    m_backoff = m_backoff ? m_backoff * 2 : 100;
+    if (m_backoff > MAX_BACKOFF)
+        m_backoff = MAX_BACKOFF;
+}
@@ -0,0 +1,79 @@
+#ifndef USER_WRITER_H
+#define USER_WRITER_H
+
+#include <time.h>
+#include <string>
+#include <vector>
+#include "../lock/locker.h"
+#include "user_backend.h"
+
+using namespace std;
+
+// 一条待写入数据库的注册，用户名已在 user_table 中占位
+struct user_write
+{
+    string name;
+    string password;
+    void (*done)(void *arg, bool ok); // 批次写完后在写入线程中回调，先写后确认模式下为NULL
+    void *arg;                        // 回调的参数，请求方不再等待时置为NULL
+    long long arrive;                 // 提交的时间(毫秒)
+    int result;                       // 写入结果：1 成功，0 数据库拒绝，-1 连接出错
+};
+
+// 注册的批量写入，单例
+// 工作线程提交注册后不等待数据库，写入线程攒够 m_rows 行或最早的一条等待满 m_wait_ms 毫秒后，
+// 交给后端写入整批：MySQL 用一条多行INSERT一次往返完成，被拒绝时逐行重写；SQLite 在一个事务中写入
+// 等待确认模式：写完后提交或取消 user_table 中的占位，再回调通知请求方
+// 先写后确认模式：提交时用户已对登录可见，连接出错的行放回队列，退避后重试直到写入成功
+class user_writer
+{
+public:
+    static const int MAX_BACKOFF = 5000; // 重试的最长退避时间(毫秒)
+
+    static user_writer *get_instance()
+    {
+        static user_writer instance;
+        return &instance;
+    }
+
+    // 启动写入线程，rows 为每批最多的行数，wait_ms 为最早的一条最多等待的毫秒数
+    // behind 为true时使用先写后确认模式
+    bool init(user_backend *backend, int rows, int wait_ms, bool behind, int close_log);
+
+    bool enabled() const { return m_running; }
+    bool write_behind() const { return m_behind; }
+
+    // 提交一条注册，done 为NULL表示不需要通知
+    void submit(const char *name, const char *password, void (*done)(void *, bool), void *arg);
+
+    // 请求方不再等待结果，之后不会再以 arg 回调，注册本身照常写入
+    void detach(void *arg);
+
+private:
+    user_writer();
+    ~user_writer(); // 写完队列中剩余的注册后再退出
+
+    static void *worker(void *arg);
+    void run();
+    void flush();  // 交给后端写入 m_batch，结果记录在每一项的 result 中
+    void finish(); // 持有 m_lock 时调用：按写入结果提交占位、回调，先写后确认模式下重新排队连接出错的行
+    static long long now_ms();
+
+    user_backend *m_backend;
+    int m_rows;
+    int m_wait_ms;
+    bool m_behind;
+    bool m_running;
+    bool m_stop;
+    int m_backoff;      // 当前的退避时间(毫秒)，写入成功后清零
+    pthread_t m_thread;
+
+    locker m_lock;              // 保护 m_queue、m_stop 和 m_batch 中的 arg
+    cond m_cond;
+    vector<user_write> m_queue; // 待写入的注册，按提交顺序
+    vector<user_write> m_batch; // 正在写入的一批，只有写入线程修改
+
+    int m_close_log;
+};
+
+#endif
@@ -1,4 +1,8 @@
 #include "webserver.h"
+#include "./user/memory_backend.h"
+#ifdef USE_SQLITE
+#include "./user/sqlite_backend.h"
+#endif
 
 // 分配 http_conn 类数组 到 users
 // 分配 client_data 类数组 到 users_timer
@@ -11,6 +15,10 @@ WebServer::WebServer()
     // 定时器
     users_timer = new client_data[MAX_FD];
 
+    m_backend = NULL;
+    m_connPool = NULL;
+    m_ready_num = 0;
+
     // root文件夹路径
     char server_path[200];
     // 获取当前工作目录的路径名
@@ -35,7 +43,11 @@ WebServer::~WebServer()
 
 // 初始化成员变量
 void WebServer::init(int port, string user, string passWord, string databaseName, int log_write,
-                     int opt_linger, int trigmode, int sql_num, int thread_num, int close_log, int actor_model)
+                     int opt_linger, int trigmode, int sql_num, int thread_num, int close_log, int actor_model,
+                     int upload_max, string proxy_pass, int proxy_balance, string fastcgi_pass,
+                     string handler_dir, string bundle_path, string timeouts, string reg_batch,
+                     string sql_limits, string user_cache, string sql_replicas, string sessions, string backend,
+                     string workers)
 {
     m_port = port; // socket监听端口
 
@@ -51,6 +63,21 @@ void WebServer::init(int port, string user, string passWord, string databaseName
     m_TRIGMode = trigmode;      // 指定触发模式，设置 m_LISTENTrigmode 和 m_CONNTrigmode
     m_close_log = close_log;    // 是否关闭日志，1为关闭
     m_actormodel = actor_model; // 网络模型，0:proactor 1:reactor
+    m_upload_max = upload_max;  // 上传文件大小上限(MB)，0为不开启上传
+
+    m_proxy_pass = proxy_pass;       // 反向代理路由
+    m_proxy_balance = proxy_balance; // 上游负载均衡策略，0:轮询 1:最少连接
+    m_fastcgi_pass = fastcgi_pass;   // FastCGI路由
+    m_handler_dir = handler_dir;     // 处理函数插件目录
+    m_bundle_path = bundle_path;     // 资源包路径
+    m_timeouts = timeouts;           // 各阶段的超时时间
+    m_reg_batch = reg_batch;         // 注册的批量写入
+    m_sql_limits = sql_limits;       // 数据库连接池的弹性参数
+    m_user_cache = user_cache;       // 用户缓存
+    m_sql_replicas = sql_replicas;   // 从库
+    m_sessions = sessions;           // 登录会话
+    m_backend_name = backend;        // 用户数据后端
+    m_workers = workers;             // 线程池的弹性参数
 }
 
 // 指定触发方式标志位
@@ -96,23 +123,321 @@ void WebServer::log_write()
     }
 }
 
-// 初始化 m_connPool 数据库连接池
-// 调用 http_conn::initmysql_result 初始化`用户名-密码对`全局变量
+// 逐项解析 名称=整数,名称=整数 形式的配置，option 为命令行选项，用于错误日志
+// 每一项调用 fn(名称, 值)，名称未知或值超出范围时 fn 返回false
+// 缺少=、值不是整数和 fn 返回false 的项记录错误后忽略，对应的参数保持默认值
+template <typename F>
+static void parse_kv(const char *option, const string &config, F fn, int m_close_log)
+{
+    size_t start = 0;
+    while (start < config.size())
+    {
+        size_t end = config.find(',', start);
+        if (end == string::npos)
+            end = config.size();
+        string item = config.substr(start, end - start);
+        start = end + 1;
+        if (item.empty())
+            continue;
+
+        size_t eq = item.find('=');
+        if (eq == string::npos || 0 == eq)
+        {
+            LOG_ERROR("%s: ignored %s, expected name=value", option, item.c_str());
+            continue;
+        }
+        const char *text = item.c_str() + eq + 1;
+        char *stop;
+        errno = 0;
+        long value = strtol(text, &stop, 10);
+        if (stop == text || *stop != '\0' || errno != 0 || value < INT_MIN || value > INT_MAX)
+        {
+            LOG_ERROR("%s: ignored %s, value is not an integer", option, item.c_str());
+            continue;
+        }
+        if (!fn(item.substr(0, eq), (int)value))
+            LOG_ERROR("%s: ignored %s, unknown name or value out of range", option, item.c_str());
+    }
+}
+
+// 解析 min=连接数,idle=秒,ping=秒,wait=毫秒,local=0或1,lag=秒,fail=百分比,slow=毫秒,calls=次数,open=毫秒,ready=连接数 形式的配置，
+// 未出现的项为 1 个、60 秒、30 秒、3000 毫秒、不开启线程暂存、5 秒、50%、1000 毫秒、20 次、5000 毫秒、1 个，fail=0 关闭熔断
+// 初始化 m_connPool 数据库连接池，m_sql_num 为最大连接数，设置熔断参数
+// 按 m_sql_replicas 为每个 host:port 添加从库连接池
 void WebServer::sql_pool()
 {
+    int min_conn = 1, idle = 60, ping = 30, wait = 3000, local = 0, lag = 5;
+    int fail = 50, slow = 1000, calls = 20, open_ms = 5000, ready = 1;
+    parse_kv("-n", m_sql_limits, [&](const string &name, int value) {
+        if ("min" == name && value >= 0)
+            min_conn = value;
+        else if ("idle" == name && value > 0)
+            idle = value;
+        else if ("ping" == name && value > 0)
+            ping = value;
+        else if ("wait" == name && value >= 0)
+            wait = value;
+        else if ("local" == name && (0 == value || 1 == value))
+            local = value;
+        else if ("lag" == name && value >= 0)
+            lag = value;
+        else if ("fail" == name && value >= 0 && value <= 100)
+            fail = value;
+        else if ("slow" == name && value >= 0)
+            slow = value;
+        else if ("calls" == name && value > 0)
+            calls = value;
+        else if ("open" == name && value > 0)
+            open_ms = value;
+        else if ("ready" == name && value >= 0)
+            ready = value;
+        else
+            return false;
+        return true;
+    }, m_close_log);
+
     // 初始化数据库连接池
     m_connPool = connection_pool::GetInstance();
-    m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log);
+    m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log,
+                     min_conn, idle, ping, wait, 1 == local, lag, ready);
+    m_connPool->SetBreaker(fail, slow, calls, open_ms);
+
+    // 从库，host 或 host:port，端口默认 3306
+    size_t start = 0;
+    while (start < m_sql_replicas.size())
+    {
+        size_t end = m_sql_replicas.find(',', start);
+        if (end == string::npos)
+            end = m_sql_replicas.size();
+        string item = m_sql_replicas.substr(start, end - start);
+        start = end + 1;
+        if (item.empty())
+            continue;
+
+        size_t colon = item.find(':');
+        int port = colon == string::npos ? 3306 : atoi(item.c_str() + colon + 1);
+        m_connPool->AddReplica(item.substr(0, colon), port);
+    }
+}
+
+// memory 和 sqlite 不连接 MySQL，启动时不建立任何数据库连接
+// sqlite 需要 make SQLITE=1，未编译或打开失败时退出
+void WebServer::backend()
+{
+    if ("memory" == m_backend_name)
+        m_backend = new memory_backend;
+    else if (0 == m_backend_name.compare(0, 7, "sqlite:"))
+    {
+#ifdef USE_SQLITE
+        sqlite_backend *sqlite = new sqlite_backend;
+        if (!sqlite->init(m_backend_name.c_str() + 7, m_close_log))
+            exit(1);
+        m_backend = sqlite;
+#else
+        LOG_ERROR("%s", "sqlite backend is not built, make SQLITE=1");
+        exit(1);
+#endif
+    }
+    else
+    {
+        sql_pool();
+        m_backend = new mysql_backend(m_connPool, m_close_log);
+    }
+    LOG_INFO("user backend: %s", m_backend->name());
 
-    // 初始化数据库读取表
-    users->initmysql_result(m_connPool);
+    // 保存后端，请求按需访问
+    http_conn::init_backend(m_backend, m_connPool);
+}
+
+// 解析 size=用户数,ttl=秒,neg=秒,warm=用户数 形式的配置，未出现的项为 100000 个、300 秒、30 秒、0 个
+void WebServer::user_cache()
+{
+    int size = 100000, ttl = 300, neg = 30, warm = 0;
+    parse_kv("-k", m_user_cache, [&](const string &name, int value) {
+        if ("size" == name && value > 0)
+            size = value;
+        else if ("ttl" == name && value > 0)
+            ttl = value;
+        else if ("neg" == name && value >= 0)
+            neg = value;
+        else if ("warm" == name && value >= 0)
+            warm = value;
+        else
+            return false;
+        return true;
+    }, m_close_log);
+    user_table::get_instance()->init(m_backend, size, ttl, neg, warm, m_close_log);
+}
+
+// 解析 ttl=秒,size=会话数 形式的配置，未出现的项为 1800 秒、100000 个，ttl=0 不使用会话
+void WebServer::sessions()
+{
+    int ttl = 1800, size = 100000;
+    parse_kv("-i", m_sessions, [&](const string &name, int value) {
+        if ("ttl" == name && value >= 0)
+            ttl = value;
+        else if ("size" == name && value > 0)
+            size = value;
+        else
+            return false;
+        return true;
+    }, m_close_log);
+    session_store::get_instance()->init(ttl, size, m_close_log);
 }
 
 // 初始化 m_pool 线程池，每个线程创建worker成员函数
+// 解析 min=线程数,max=线程数,wait=毫秒,idle=秒 形式的配置，未出现的项为 -t 个、同 min、5 毫秒、30 秒
+// max 大于 min 时，请求的平均排队时间超过 wait 就增加线程，多出的线程空闲 idle 秒后退出
 void WebServer::thread_pool()
 {
+    int min = m_thread_num, max = 0, wait = 5, idle = 30;
+    parse_kv("-w", m_workers, [&](const string &name, int value) {
+        if ("min" == name && value > 0)
+            min = value;
+        else if ("max" == name && value > 0)
+            max = value;
+        else if ("wait" == name && value > 0)
+            wait = value;
+        else if ("idle" == name && value > 0)
+            idle = value;
+        else
+            return false;
+        return true;
+    }, m_close_log);
+    if (max < min)
+        max = min;
+
     // 线程池
-    m_pool = new threadpool<http_conn>(m_actormodel, m_connPool, m_thread_num);
+    m_pool = new threadpool<http_conn>(m_actormodel, min, 10000, max, wait, idle, m_close_log);
+}
+
+// 初始化 http_conn::m_routes 路由表
+// m_upload_max 不为0时，添加 /upload/ 上传路由，文件保存在 当前目录/upload 下
+// 按 m_proxy_pass 为每个前缀创建上游服务器组，添加代理路由
+//     例如 /api/=127.0.0.1:8080,127.0.0.1:8081;/static2/=127.0.0.1:8090
+void WebServer::route_table()
+{
+    if (m_upload_max > 0)
+    {
+        char server_path[200];
+        getcwd(server_path, 200);
+        string upload_dir = string(server_path) + "/upload";
+
+        // 临时文件和目标文件在同一目录下，保证rename是原子的
+        if (mkdir(upload_dir.c_str(), 0755) < 0 && errno != EEXIST)
+        {
+            LOG_ERROR("mkdir %s error:%d", upload_dir.c_str(), errno);
+        }
+        else
+        {
+            http_conn::add_route("/upload/", ROUTE_UPLOAD, upload_dir, (long long)m_upload_max * 1024 * 1024);
+        }
+    }
+
+    upstream_routes(m_proxy_pass, ROUTE_PROXY);
+    upstream_routes(m_fastcgi_pass, ROUTE_FASTCGI);
+
+    if (!m_bundle_path.empty())
+        bundle::reload(m_bundle_path, m_close_log);
+
+    // 静态注册的处理函数在main之前已加入注册表，插件在此加载
+    handler_registry *registry = handler_registry::get_instance();
+    if (!m_handler_dir.empty())
+        registry->load_dir(m_handler_dir, m_close_log);
+    for (size_t i = 0; i < registry->size(); ++i)
+        http_conn::add_route(registry->prefix(i), ROUTE_HANDLER, "", 0, NULL, registry->handler(i));
+}
+
+// 解析 前缀=后端,后端;前缀=... 形式的配置
+// 每个前缀对应一个上游服务器组，按 m_proxy_balance 均衡，并启动其健康检查线程
+void WebServer::upstream_routes(const string &pass, int type)
+{
+    size_t start = 0;
+    while (start < pass.size())
+    {
+        size_t end = pass.find(';', start);
+        if (end == string::npos)
+            end = pass.size();
+        string item = pass.substr(start, end - start);
+        start = end + 1;
+
+        size_t eq = item.find('=');
+        if (eq == string::npos || eq == 0 || item[0] != '/')
+        {
+            LOG_ERROR("bad upstream route: %s", item.c_str());
+            continue;
+        }
+        string prefix = item.substr(0, eq);
+        string backends = item.substr(eq + 1);
+
+        upstream *up = new upstream(m_proxy_balance, m_close_log);
+        size_t pos = 0;
+        while (pos < backends.size())
+        {
+            size_t comma = backends.find(',', pos);
+            if (comma == string::npos)
+                comma = backends.size();
+            string addr = backends.substr(pos, comma - pos);
+            pos = comma + 1;
+            if (!up->add_backend(addr))
+                LOG_ERROR("bad upstream address: %s", addr.c_str());
+        }
+
+        if (0 == up->size())
+        {
+            delete up;
+            continue;
+        }
+        up->start();
+        http_conn::add_route(prefix, type, backends, 0, up);
+    }
+}
+
+// 解析 head=秒,body=秒,send=秒,idle=秒,rate=字节每秒 形式的配置
+// 设置 http_conn::m_timeouts 和 http_conn::m_min_rate，未出现的项保持默认值
+void WebServer::deadlines()
+{
+    static const char *names[http_conn::PHASE_COUNT] = {"head", "body", "send", "idle"};
+    parse_kv("-e", m_timeouts, [&](const string &name, int value) {
+        if ("rate" == name)
+        {
+            if (value < 0)
+                return false;
+            http_conn::m_min_rate = value;
+            return true;
+        }
+        for (int i = 0; i < http_conn::PHASE_COUNT; ++i)
+        {
+            if (name == names[i] && value > 0)
+            {
+                http_conn::m_timeouts[i] = value;
+                return true;
+            }
+        }
+        return false;
+    }, m_close_log);
+}
+
+// 解析 rows=行数,wait=毫秒,behind=0或1 形式的配置，未出现的项为 64 行、5 毫秒、等待确认
+// 写入线程交给 m_backend 写入，MySQL 后端写入一批时占用连接池中的一个连接
+void WebServer::reg_batch()
+{
+    if (m_reg_batch.empty())
+        return;
+
+    int rows = 64, wait = 5, behind = 0;
+    parse_kv("-g", m_reg_batch, [&](const string &name, int value) {
+        if ("rows" == name && value > 0)
+            rows = value;
+        else if ("wait" == name && value >= 0)
+            wait = value;
+        else if ("behind" == name && (0 == value || 1 == value))
+            behind = value;
+        else
+            return false;
+        return true;
+    }, m_close_log);
+    user_writer::get_instance()->init(m_backend, rows, wait, 1 == behind, m_close_log);
 }
 
 // 1. 创建 m_listenfd
@@ -127,6 +452,7 @@ void WebServer::thread_pool()
 // 10. 不处理SIGPIPE信号，设置重启系统调用
 // 11. 接受 SIGALRM 由 utils.sig_handler 处理, 不重启系统调用
 // 12. 接受 SIGTERM 由 utils.sig_handler 处理, 不重启系统调用
+//     接受 SIGHUP 由 utils.sig_handler 处理, 不重启系统调用
 // 13. alarm() 定时 TIMESLOT 秒
 // 14. Utils::u_pipefd = m_pipefd; Utils::u_epollfd = m_epollfd;
 
@@ -134,6 +460,7 @@ void WebServer::thread_pool()
 // SIGPIPE：进程尝试在被对端关闭的套接字上写数据 时触发
 // SIGALRM: 定时器到期后产生
 // SIGTERM：请求正常终止进程
+// SIGHUP：重新加载资源包
 // sig_handler信号处理函数，将 sig 参数通过管道u_pipefd[1]传输
 void WebServer::eventListen()
 {
@@ -207,6 +534,8 @@ void WebServer::eventListen()
     // utils.sig_handler: 向 m_pipefd[1] 发送 sig 参数
     utils.addsig(SIGALRM, utils.sig_handler, false);
     utils.addsig(SIGTERM, utils.sig_handler, false);
+    // SIGHUP: 重新加载资源包
+    utils.addsig(SIGHUP, utils.sig_handler, false);
 
     // 定时 TIMESLOT 秒
     alarm(TIMESLOT);
@@ -222,7 +551,7 @@ void WebServer::eventListen()
 // 若 m_CONNTrigmode = 1 设置边缘触发，否则为电平触发 
 
 // 初始化 users_timer[connfd]的 address 和 sockfd
-// 创建一个新的timer,到期时间 cur + 3 * TIMESLOT，赋值给 users_timer[connfd].timer
+// 创建一个新的timer,到期时间为连接接收请求头的截止时间，赋值给 users_timer[connfd].timer
 // 将这个定时器添加到 utils.m_timer_lst 中
 void WebServer::timer(int connfd, struct sockaddr_in client_address)
 {
@@ -232,23 +561,22 @@ void WebServer::timer(int connfd, struct sockaddr_in client_address)
     // 创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
     users_timer[connfd].address = client_address;
     users_timer[connfd].sockfd = connfd;
+    users_timer[connfd].conn = users + connfd;
 
     util_timer *timer = new util_timer;
     timer->user_data = &users_timer[connfd];
     timer->cb_func = cb_func;
-    time_t cur = time(NULL);
-    timer->expire = cur + 3 * TIMESLOT;
+    timer->expire = users[connfd].deadline();
 
     users_timer[connfd].timer = timer;
     utils.m_timer_lst.add_timer(timer);
 }
 
-// 将 timer 的到期时间往后推迟3个TIMESLOT
+// 将 timer 的到期时间设为连接当前阶段的截止时间
 // 在 utils.m_timer_lst 中调整 timer 的位置，保持有序
 void WebServer::adjust_timer(util_timer *timer)
 {
-    time_t cur = time(NULL);
-    timer->expire = cur + 3 * TIMESLOT;
+    timer->expire = timer->user_data->conn->deadline();
     utils.m_timer_lst.adjust_timer(timer);
 
     LOG_INFO("%s", "adjust timer once");
@@ -270,6 +598,7 @@ void WebServer::deal_timer(util_timer *timer, int sockfd)
 // 处理客户端请求建立的连接
 // 从 m_listenfd 中 accpet 一个连接到 connfd
 // 若 http_conn::m_user_count >= MAX_FD，通过 connfd 发送错误信息后直接返回
+// ET模式下每次最多accept ACCEPT_BUDGET 个连接
 
 // 根据传入的参数初始化 users[connfd] 的 m_sockfd、m_address、doc_root、m_TRIGMode、m_close_log、sql_user、sql_user、sql_user
 // 将 sockfd 添加到 epollfd 中，监听读事件、对端关闭事件、仅监听一次、非阻塞
@@ -304,7 +633,8 @@ bool WebServer::dealclientdata()
 
     else
     {
-        while (1)
+        int i;
+        for (i = 0; i < ACCEPT_BUDGET; ++i)
         {
             int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
             if (connfd < 0)
@@ -320,6 +650,9 @@ bool WebServer::dealclientdata()
             }
             timer(connfd, client_address);
         }
+        // 本轮已accept ACCEPT_BUDGET 个连接，剩余的连接留到下一轮，先处理其它就绪事件
+        if (ACCEPT_BUDGET == i)
+            utils.rearm(m_epollfd, m_listenfd, m_LISTENTrigmode);
         return false;
     }
     return true;
@@ -328,6 +661,7 @@ bool WebServer::dealclientdata()
 // 从 m_pipefd[0] 中接收数据，主要是信号量
 // 如果接收到了SIGALRM，timeout = true
 // 如果接收到了SIGTERM，stop_server = true
+// 如果接收到了SIGHUP，重新加载资源包，加载失败时继续使用原来的资源包
 bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
 {
     int ret = 0;
@@ -358,6 +692,12 @@ bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
                 stop_server = true;
                 break;
             }
+            case SIGHUP:
+            {
+                if (!m_bundle_path.empty())
+                    bundle::reload(m_bundle_path, m_close_log);
+                break;
+            }
             }
         }
     }
@@ -365,17 +705,17 @@ bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
 }
 
 // reactor模式：
-// 1.首先调整定时器，往后推迟3个单位
-// 2.将对应的 http_conn* 放入线程池的工作队列，标志m_state为读
-// 3.等待线程池的工作线程读取数据
+// 1.将对应的 http_conn* 放入线程池的工作队列，标志m_state为读
+// 2.等待线程池的工作线程读取数据
 // 如果读取失败:
     // 执行 timer 的回调函数，传入的用户参数为 users_timer[sockfd]
     // 删除 timer 定时器
+// 否则按连接所处的阶段调整定时器
 
 // proactor模式:
 // 读取网络数据，LT模式下只读取一次，ET模式下使用while循环读取
 // 如果读取成功:
-    // 将该事件放入请求队列,调整定时器
+    // 将该连接加入 m_ready，本轮事件处理完后由 eventLoop() 一次放入请求队列,调整定时器
 // 如果读取失败:
     // 执行 timer 的回调函数，传入的用户参数为 users_timer[sockfd]
     // 删除 timer 定时器
@@ -386,12 +726,6 @@ void WebServer::dealwithread(int sockfd)
     // reactor
     if (1 == m_actormodel)
     {
-        // 首先调整定时器，往后推迟3个单位
-        if (timer)
-        {
-            adjust_timer(timer);
-        }
-
         // 若监测到读事件，将该事件放入请求队列
         m_pool->append(users + sockfd, 0);
 
@@ -404,6 +738,11 @@ void WebServer::dealwithread(int sockfd)
                     deal_timer(timer, sockfd);
                     users[sockfd].timer_flag = 0;
                 }
+                // 工作线程已推进连接的阶段，按新阶段的截止时间调整定时器
+                else if (timer)
+                {
+                    adjust_timer(timer);
+                }
                 users[sockfd].improv = 0;
                 break;
             }
@@ -418,8 +757,8 @@ void WebServer::dealwithread(int sockfd)
         {
             LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
 
-            // 若监测到读事件，将该事件放入请求队列
-            m_pool->append_p(users + sockfd);
+            // 若监测到读事件，将该连接加入本轮的就绪请求
+            m_ready[m_ready_num++] = users + sockfd;
 
             if (timer)
             {
@@ -434,15 +773,15 @@ void WebServer::dealwithread(int sockfd)
 }
 
 // reactor模式：
-// 1.调整定时器到期时间,往后推迟 3 个单位
-// 2.将http_conn 添加到 m_workqueue队列中,设置 http_conn->m_state = 1
-// 3.等待线程池写入完成，若写入失败，删除对应的定时器
+// 1.将http_conn 添加到 m_workqueue队列中,设置 http_conn->m_state = 1
+// 2.等待线程池写入完成，若写入失败，删除对应的定时器
     // 执行 timer 的回调函数，传入的用户参数为 users_timer[sockfd]
     // 删除 timer 定时器
+// 3.否则按连接所处的阶段调整定时器
 
 // proactor模式:
 // 写入数据
-    // 若写入成功，定时器推迟3个单位
+    // 若写入成功，按连接所处的阶段调整定时器
     // 若写入失败：
         // 执行 timer 的回调函数，传入的用户参数为 users_timer[sockfd]
         // 删除 timer 定时器  
@@ -452,11 +791,6 @@ void WebServer::dealwithwrite(int sockfd)
     // reactor
     if (1 == m_actormodel)
     {
-        if (timer)
-        {
-            adjust_timer(timer);
-        }
-
         m_pool->append(users + sockfd, 1);
 
         while (true)
@@ -468,6 +802,10 @@ void WebServer::dealwithwrite(int sockfd)
                     deal_timer(timer, sockfd);
                     users[sockfd].timer_flag = 0;
                 }
+                else if (timer)
+                {
+                    adjust_timer(timer);
+                }
                 users[sockfd].improv = 0;
                 break;
             }
@@ -499,7 +837,8 @@ void WebServer::dealwithwrite(int sockfd)
 // 5. 若监听到 m_pipefd[0] 的 EPOLLIN，使用 dealwithsignal() 处理信号
 // 6. 若监听到 通信SOCKET 的 EPOLLIN， 处理读事件
 // 7. 若监听到 通信SOCKET 的 EPOLLOUT，处理写事件
-// 8. 若监听到的是定时器到期信号：
+// 8. proactor模式下把本轮读取完成的请求一次放入线程池，只唤醒需要的工作线程
+// 9. 若监听到的是定时器到期信号：
     // 触发已过期的定时器事件函数，并将已过期的定时器从链表中移除
     // 使用alarm() 定时 m_TIMESLOT 后发送 SIGALRM 信号
 void WebServer::eventLoop()
@@ -520,8 +859,13 @@ void WebServer::eventLoop()
         {
             int sockfd = events[i].data.fd;
 
+            // 上游连接等辅助fd上的事件，低32位为所属连接，交给该连接继续处理
+            if (events[i].data.u64 & http_conn::AUX_EVENT)
+            {
+                dealwithwrite((int)(events[i].data.u64 & 0xffffffff));
+            }
             // 处理新到的客户连接
-            if (sockfd == m_listenfd)
+            else if (sockfd == m_listenfd)
             {
                 bool flag = dealclientdata();
                 if (false == flag)
@@ -550,9 +894,18 @@ void WebServer::eventLoop()
                 dealwithwrite(sockfd);
             }
         }
+        if (m_ready_num > 0)
+        {
+            m_pool->append_batch(m_ready, m_ready_num);
+            m_ready_num = 0;
+        }
         if (timeout)
         {
             utils.timer_handler();
+            // 登录会话的过期也由定时器驱动
+            session_store::get_instance()->expire();
+            // 没有请求时线程池的线程数也由定时器调整
+            m_pool->adjust();
 
             LOG_INFO("%s", "timer tick");
 
@@ -9,6 +9,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <cassert>
 #include <sys/epoll.h>
 
@@ -18,6 +19,7 @@
 const int MAX_FD = 65536;           // 最大文件描述符
 const int MAX_EVENT_NUMBER = 10000; // 最大事件数
 const int TIMESLOT = 5;             // 最小超时单位
+const int ACCEPT_BUDGET = 64;       // ET模式下每个监听事件最多accept的连接数
 
 class WebServer
 {
@@ -28,16 +30,46 @@ public:
     // 初始化成员变量
     void init(int port, string user, string passWord, string databaseName,
               int log_write, int opt_linger, int trigmode, int sql_num,
-              int thread_num, int close_log, int actor_model);
+              int thread_num, int close_log, int actor_model, int upload_max,
+              string proxy_pass, int proxy_balance, string fastcgi_pass,
+              string handler_dir, string bundle_path, string timeouts, string reg_batch,
+              string sql_limits, string user_cache, string sql_replicas, string sessions, string backend,
+              string workers);
     void trig_mode();   // 指定触发方式标志位
-    void thread_pool(); // 初始化 m_pool 线程池，为线程池的每个线程创建worker成员函数
+    void thread_pool(); // 按 m_workers 初始化 m_pool 线程池，为线程池的每个线程创建worker成员函数
 
-    // 初始化 m_connPool 数据库连接池
-    // 调用 http_conn::initmysql_result 初始化 用户名-密码对
+    // 初始化 http_conn::m_routes 路由表
+    // m_upload_max 不为0时，添加 /upload/ 上传路由，文件保存在 当前目录/upload 下
+    // 按 m_proxy_pass 为每个前缀创建上游服务器组，添加代理路由
+    // 按 m_fastcgi_pass 为每个前缀创建应用进程组，添加FastCGI路由
+    // 加载 m_handler_dir 下的插件，为注册表中的每个处理函数添加路由
+    // m_bundle_path 不为空时加载资源包，静态文件优先从资源包发送
+    void route_table();
+
+    // 解析 前缀=后端,后端;前缀=... 形式的配置，为每个前缀创建上游服务器组并添加 type 类型的路由
+    void upstream_routes(const string &pass, int type);
+
+    // 按 m_backend_name 创建用户数据后端，mysql 时调用 sql_pool()，保存到 http_conn
+    void backend();
+
+    // 按 m_sql_limits 初始化 m_connPool 数据库连接池，按 m_sql_replicas 添加从库
     void sql_pool();
+
+    // 解析 size=用户数,ttl=秒,neg=秒,warm=用户数 形式的配置，初始化用户缓存
+    void user_cache();
+
+    // 解析 ttl=秒,size=会话数 形式的配置，初始化登录会话
+    void sessions();
     
     void log_write(); // 初始化一个单例LOG对象
 
+    // 解析 head=秒,body=秒,send=秒,idle=秒,rate=字节每秒 形式的配置，设置各阶段的超时时间和最低传输速率
+    // 未出现的项保持默认值
+    void deadlines();
+
+    // 解析 rows=行数,wait=毫秒,behind=0或1 形式的配置，不为空时启动注册的批量写入线程
+    void reg_batch();
+
     // 1. 设置 m_listenfd
     // 2. 将 m_listenfd 添加到 m_epollfd 中
     // 3. 通过 utils 设置信号处理函数
@@ -46,7 +78,7 @@ public:
     void eventLoop();
     void timer(int connfd, struct sockaddr_in client_address);
 
-    // 将 timer 的到期时间往后推迟3个单位
+    // 将 timer 的到期时间设为连接当前阶段的截止时间
     // 在 utils.m_timer_lst 中调整 timer 的位置，保持有序
     void adjust_timer(util_timer *timer);
 
@@ -67,12 +99,12 @@ public:
     bool dealwithsignal(bool &timeout, bool &stop_server);
 
     // reactor模式：
-    // 1.首先调整定时器，往后推迟3个单位
-    // 2.将对应的 http_conn* 放入线程池的工作队列，标志m_state为读
-    // 3.等待线程池的工作线程读取数据
+    // 1.将对应的 http_conn* 放入线程池的工作队列，标志m_state为读
+    // 2.等待线程池的工作线程读取数据
         // 如果读取失败
-        // 4.执行 timer 的回调函数，传入的用户参数为 users_timer[sockfd]
-        // 5.删除 timer 定时器
+        // 3.执行 timer 的回调函数，传入的用户参数为 users_timer[sockfd]
+        // 4.删除 timer 定时器
+        // 否则调整定时器
 
     // proactor模式:
     // 1.读取网络数据，LT模式下只读取一次，ET模式下使用while循环读取
@@ -82,6 +114,7 @@ public:
         // 2.删除定时器
     void dealwithread(int sockfd);
 
+    // 上游连接等辅助fd可读时也由此处理，交给所属连接的 write() 继续转发
     // reactor模式：
         //1.调整定时器到期时间
         //2.将http_conn 添加到 m_workqueue队列中
@@ -108,16 +141,35 @@ public:
     int m_TRIGMode;   // 触发方式选择
     int m_close_log;  // 为 1 则关闭 LOG 记录
     int m_actormodel; // 线程池对象的模型切换标志
+    int m_upload_max; // 上传文件大小上限(MB)，为0时不开启上传
+    string m_proxy_pass; // 反向代理路由，前缀=host:port,host:port;前缀=...
+    int m_proxy_balance; // 上游负载均衡策略，0:轮询 1:最少连接
+    string m_fastcgi_pass; // FastCGI路由，前缀=unix:路径,host:port;前缀=...
+    string m_handler_dir;  // 处理函数插件目录
+    string m_bundle_path;  // 资源包路径，收到SIGHUP时重新加载
+    string m_timeouts;     // 各阶段的超时时间，head=秒,body=秒,send=秒,idle=秒,rate=字节每秒
+    string m_reg_batch;    // 注册的批量写入，rows=行数,wait=毫秒,behind=0或1，为空时不开启
+    string m_sql_limits;   // 数据库连接池的弹性参数，min=连接数,idle=秒,ping=秒,wait=毫秒,local=0或1,lag=秒,fail=百分比,...
+    string m_sql_replicas; // 从库，host:port,host:port
+    string m_user_cache;   // 用户缓存，size=用户数,ttl=秒,neg=秒,warm=用户数
+    string m_sessions;     // 登录会话，ttl=秒,size=会话数
+    string m_backend_name; // 用户数据后端，mysql、memory 或 sqlite:路径
+    string m_workers;      // 线程池的弹性参数，min=线程数,max=线程数,wait=毫秒,idle=秒
 
     int m_pipefd[2]; // 双向管道，由eventListen()创建
     int m_epollfd;   // epoll事件表，由eventListen()赋值
 
-    connection_pool *m_connPool;   // 数据库连接池，由sql_pool()创建
+    user_backend *m_backend;       // 用户数据后端，由backend()创建，写入线程和用户缓存在进程退出前一直使用，不释放
+    connection_pool *m_connPool;   // 数据库连接池，由sql_pool()创建，不使用 MySQL 时为NULL
     threadpool<http_conn> *m_pool; // 线程池，由thread_pool()创建
 
     // epoll_event相关
     epoll_event events[MAX_EVENT_NUMBER];
 
+    // proactor模式下本轮 epoll_wait 读取完成的连接，处理完所有事件后一次放入线程池
+    http_conn *m_ready[MAX_EVENT_NUMBER];
+    int m_ready_num;
+
     int m_listenfd; // 监听socket，由 eventListen() 创建并设置
 
     // trig_mode()函数中指定